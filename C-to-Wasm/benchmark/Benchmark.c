@@ -0,0 +1,310 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Benchmark.h"
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define BENCHMARK_HAVE_PERF 1
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Initial capacity of the sample array, doubled when full
+#define BENCHMARK_INITIAL_SAMPLES 64
+
+typedef struct {
+    int cycles;
+    int cacheMisses;
+} Counters;
+
+BenchmarkConfig defaultBenchmarkConfig(void) {
+    BenchmarkConfig config = {
+        .warmup = 1,
+        .minIterations = 10,
+        .maxIterations = 100000,
+        .minTime = 0.2,
+        .counters = 0,
+        .format = BENCHMARK_TEXT
+    };
+    return config;
+}
+
+static const char* findArgument(int argc, char** argv, const char* name) {
+    for(int i = 1; i + 1 < argc; i++) {
+        if(!strcmp(argv[i], name)) return argv[i + 1];
+    }
+    return NULL;
+}
+
+const char* benchmarkStringArgument(int argc, char** argv, const char* name, const char* fallback) {
+    const char* value = findArgument(argc, argv, name);
+    return value ? value : fallback;
+}
+
+long benchmarkLongArgument(int argc, char** argv, const char* name, long fallback) {
+    const char* value = findArgument(argc, argv, name);
+    if(!value) return fallback;
+
+    char* end;
+    long parsed = strtol(value, &end, 10);
+    return *value && !*end ? parsed : fallback;
+}
+
+double benchmarkDoubleArgument(int argc, char** argv, const char* name, double fallback) {
+    const char* value = findArgument(argc, argv, name);
+    if(!value) return fallback;
+
+    char* end;
+    double parsed = strtod(value, &end);
+    return *value && !*end ? parsed : fallback;
+}
+
+static int isListed(const char* const* names, const char* argument) {
+    for(size_t i = 0; names && names[i]; i++) {
+        if(!strcmp(names[i], argument)) return 1;
+    }
+    return 0;
+}
+
+int parseBenchmarkArguments(int argc, char** argv, const char* const* options, const char* const* flags,
+    BenchmarkConfig* config) {
+    if(!config) return -1;
+
+    static const char* const benchmarkOptions[] = { "--warmup", "--min-iterations", "--max-iterations", "--min-time",
+        "--format", NULL };
+    for(int i = 1; i < argc; i++) {
+        if(isListed(benchmarkOptions, argv[i]) || isListed(options, argv[i])) {
+            if(++i == argc) {
+                fprintf(stderr, "Missing value after %s\n", argv[i - 1]);
+                return -1;
+            }
+        }
+        else if(strcmp(argv[i], "--counters") && !isListed(flags, argv[i])) {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    long warmup = benchmarkLongArgument(argc, argv, "--warmup", (long) config->warmup);
+    long minIterations = benchmarkLongArgument(argc, argv, "--min-iterations", (long) config->minIterations);
+    long maxIterations = benchmarkLongArgument(argc, argv, "--max-iterations", (long) config->maxIterations);
+    double minTime = benchmarkDoubleArgument(argc, argv, "--min-time", config->minTime);
+    if(warmup < 0 || minIterations < 1 || maxIterations < minIterations || minTime < 0) return -1;
+
+    config->warmup = warmup;
+    config->minIterations = minIterations;
+    config->maxIterations = maxIterations;
+    config->minTime = minTime;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--counters")) config->counters = 1;
+    }
+
+    const char* format = findArgument(argc, argv, "--format");
+    if(!format) return 0;
+    if(!strcmp(format, "text")) config->format = BENCHMARK_TEXT;
+    else if(!strcmp(format, "csv")) config->format = BENCHMARK_CSV;
+    else if(!strcmp(format, "json")) config->format = BENCHMARK_JSON;
+    else return -1;
+
+    return 0;
+}
+
+uint64_t monotonicNanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+#ifdef BENCHMARK_HAVE_PERF
+static int openCounter(unsigned long long event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = event;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void openCounters(Counters* counters) {
+    counters->cycles = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+    counters->cacheMisses = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+}
+
+static void toggleCounters(const Counters* counters, int enable) {
+    unsigned long request = enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE;
+    if(counters->cycles >= 0) ioctl(counters->cycles, request, 0);
+    if(counters->cacheMisses >= 0) ioctl(counters->cacheMisses, request, 0);
+}
+
+// Total count divided by the iterations, -1 when the counter could not be opened
+static double readCounter(int fd, size_t iterations) {
+    uint64_t value;
+    if(fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return (double) value / (double) iterations;
+}
+
+static void closeCounters(Counters* counters, BenchmarkResult* result) {
+    result->cycles = readCounter(counters->cycles, result->iterations);
+    result->cacheMisses = readCounter(counters->cacheMisses, result->iterations);
+    if(counters->cycles >= 0) close(counters->cycles);
+    if(counters->cacheMisses >= 0) close(counters->cacheMisses);
+}
+#else
+static void openCounters(Counters* counters) {
+    counters->cycles = -1;
+    counters->cacheMisses = -1;
+}
+
+static void toggleCounters(const Counters* counters, int enable) {
+    (void) counters;
+    (void) enable;
+}
+
+static void closeCounters(Counters* counters, BenchmarkResult* result) {
+    (void) counters;
+    result->cycles = -1;
+    result->cacheMisses = -1;
+}
+#endif
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank on sorted samples
+static double percentile(const double* sorted, size_t n, double p) {
+    size_t rank = (size_t) ceil(p * (double) n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void summarize(double* samples, size_t n, BenchmarkResult* result) {
+    double total = 0;
+    for(size_t i = 0; i < n; i++) {
+        total += samples[i];
+    }
+    result->mean = total / (double) n;
+
+    double squares = 0;
+    for(size_t i = 0; i < n; i++) {
+        squares += (samples[i] - result->mean) * (samples[i] - result->mean);
+    }
+    result->stddev = n > 1 ? sqrt(squares / (double) (n - 1)) : 0;
+
+    qsort(samples, n, sizeof(double), compareDoubles);
+    result->median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    result->p99 = percentile(samples, n, 0.99);
+    result->min = samples[0];
+    result->max = samples[n - 1];
+}
+
+int runBenchmark(const BenchmarkConfig* config, const char* name, const char* parameters, void (*setup)(void*),
+    void (*run)(void*), void (*teardown)(void*), void* data, BenchmarkResult* result) {
+    if(!config || !name || !run || !result || config->minIterations == 0) return -1;
+
+    memset(result, 0, sizeof(BenchmarkResult));
+    result->score = NAN;
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    snprintf(result->parameters, sizeof(result->parameters), "%s", parameters ? parameters : "");
+
+    for(size_t i = 0; i < config->warmup; i++) {
+        if(setup) setup(data);
+        run(data);
+        if(teardown) teardown(data);
+    }
+
+    size_t capacity = BENCHMARK_INITIAL_SAMPLES;
+    double* samples = malloc(capacity * sizeof(double));
+    if(!samples) return -1;
+
+    Counters counters = { -1, -1 };
+    if(config->counters) openCounters(&counters);
+
+    // Iterations are added until both the count and the time are reached, the time is what calibrates fast runs
+    double measured = 0;
+    size_t n = 0;
+    while(n < config->maxIterations && (n < config->minIterations || measured < config->minTime * 1e9)) {
+        if(n == capacity) {
+            double* grown = realloc(samples, 2 * capacity * sizeof(double));
+            if(!grown) break;
+            samples = grown;
+            capacity *= 2;
+        }
+
+        if(setup) setup(data);
+        toggleCounters(&counters, 1);
+        uint64_t begin = monotonicNanoseconds();
+        run(data);
+        uint64_t end = monotonicNanoseconds();
+        toggleCounters(&counters, 0);
+        if(teardown) teardown(data);
+
+        samples[n++] = (double) (end - begin);
+        measured += (double) (end - begin);
+    }
+
+    result->iterations = n;
+    if(config->counters) {
+        closeCounters(&counters, result);
+    }
+    else {
+        result->cycles = -1;
+        result->cacheMisses = -1;
+    }
+
+    if(n == 0) {
+        free(samples);
+        return -1;
+    }
+    summarize(samples, n, result);
+    free(samples);
+
+    return 0;
+}
+
+void printBenchmarkHeader(const BenchmarkConfig* config) {
+    if(config->format != BENCHMARK_CSV) return;
+    printf("name,parameters,iterations,mean_ns,median_ns,p99_ns,stddev_ns,min_ns,max_ns,cycles,cache_misses,score\n");
+}
+
+void printBenchmarkResult(const BenchmarkConfig* config, const BenchmarkResult* result) {
+    switch(config->format) {
+        case BENCHMARK_CSV:
+            // Unavailable counters and missing scores are left empty
+            printf("%s,\"%s\",%zu,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,", result->name, result->parameters, result->iterations,
+                result->mean, result->median, result->p99, result->stddev, result->min, result->max);
+            if(result->cycles >= 0) printf("%.0f", result->cycles);
+            printf(",");
+            if(result->cacheMisses >= 0) printf("%.0f", result->cacheMisses);
+            printf(",");
+            if(!isnan(result->score)) printf("%g", result->score);
+            printf("\n");
+            break;
+        case BENCHMARK_JSON:
+            printf("{\"name\": \"%s\", \"parameters\": \"%s\", \"iterations\": %zu, \"mean_ns\": %.0f, \"median_ns\": %.0f, "
+                "\"p99_ns\": %.0f, \"stddev_ns\": %.0f, \"min_ns\": %.0f, \"max_ns\": %.0f", result->name, result->parameters,
+                result->iterations, result->mean, result->median, result->p99, result->stddev, result->min, result->max);
+            if(result->cycles >= 0) printf(", \"cycles\": %.0f", result->cycles);
+            if(result->cacheMisses >= 0) printf(", \"cache_misses\": %.0f", result->cacheMisses);
+            if(!isnan(result->score)) printf(", \"score\": %g", result->score);
+            printf("}\n");
+            break;
+        default:
+            printf("%s: %.0f ns median (mean %.0f, p99 %.0f, stddev %.0f, %zu iterations", result->name, result->median,
+                result->mean, result->p99, result->stddev, result->iterations);
+            if(result->cycles >= 0) printf(", %.0f cycles", result->cycles);
+            if(result->cacheMisses >= 0) printf(", %.0f cache misses", result->cacheMisses);
+            printf(")");
+            if(!isnan(result->score)) printf(", score %f", result->score);
+            printf("\n");
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Benchmark harness shared by the simulations. Every iteration is timed on the monotonic clock, the iteration count
+ * grows until both a minimum number of iterations and a minimum measured time are reached, and the samples are
+ * summarized by their median, p99 and standard deviation. Results are printed as text, CSV or JSON Lines, one line
+ * per benchmark, e.g. for pandas.read_csv or pandas.read_json(lines=True) in benchmarking-results.ipynb.
+ */
+
+typedef enum {
+    BENCHMARK_TEXT,
+    BENCHMARK_CSV,
+    BENCHMARK_JSON
+} BenchmarkFormat;
+
+typedef struct {
+    // Untimed runs before the measured ones
+    size_t warmup;
+    size_t minIterations;
+    size_t maxIterations;
+    // Seconds of measured time to reach before stopping, once minIterations are done
+    double minTime;
+    // Cycles and cache misses through perf_event_open, ignored where it is not available
+    int counters;
+    BenchmarkFormat format;
+} BenchmarkConfig;
+
+typedef struct {
+    char name[32];
+    // Free form description of the scenario, e.g. "users=1000000"
+    char parameters[192];
+    size_t iterations;
+    // Nanoseconds per iteration
+    double mean;
+    double median;
+    double p99;
+    double stddev;
+    double min;
+    double max;
+    // Per iteration, negative when the counters are disabled or unavailable
+    double cycles;
+    double cacheMisses;
+    // Set by the caller after the run, e.g. the accuracy of a trained network, NAN when there is none
+    double score;
+} BenchmarkResult;
+
+/**
+ * @brief warmup 1, 10 to 100000 iterations, 0.2 s, no counters, text output
+ *
+ * @return BenchmarkConfig
+ */
+BenchmarkConfig defaultBenchmarkConfig(void);
+
+/**
+ * @brief Reads --warmup N, --min-iterations N, --max-iterations N, --min-time SECONDS, --counters and
+ * --format text|csv|json, the values of the caller's own options are left to it
+ *
+ * Any other argument, --help included, is reported on the standard error and fails, for the caller to print its usage.
+ *
+ * @param argc
+ * @param argv
+ * @param options NULL terminated names of the caller's options followed by a value, may be NULL
+ * @param flags NULL terminated names of the caller's options without a value, may be NULL
+ * @param config Receives the values given, keeps the others
+ *
+ * @return 0 on success, -1 on an invalid value or an unknown argument
+ */
+int parseBenchmarkArguments(int argc, char** argv, const char* const* options, const char* const* flags,
+    BenchmarkConfig* config);
+
+/**
+ * @brief Value of the argument following name, fallback when name is absent or the value invalid
+ */
+const char* benchmarkStringArgument(int argc, char** argv, const char* name, const char* fallback);
+long benchmarkLongArgument(int argc, char** argv, const char* name, long fallback);
+double benchmarkDoubleArgument(int argc, char** argv, const char* name, double fallback);
+
+/**
+ * @brief Nanoseconds on the monotonic clock, seconds included
+ *
+ * @return uint64_t
+ */
+uint64_t monotonicNanoseconds(void);
+
+/**
+ * @brief Times run(data) until the config is satisfied
+ *
+ * setup and teardown run around every iteration, warmup included, outside of the timed region. Either may be NULL.
+ *
+ * @param config
+ * @param name
+ * @param parameters May be NULL
+ * @param setup
+ * @param run
+ * @param teardown
+ * @param data Passed to the three functions
+ * @param result
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int runBenchmark(const BenchmarkConfig* config, const char* name, const char* parameters, void (*setup)(void*),
+    void (*run)(void*), void (*teardown)(void*), void* data, BenchmarkResult* result);
+
+/**
+ * @brief Prints the CSV header, nothing for the other formats
+ *
+ * @param config
+ */
+void printBenchmarkHeader(const BenchmarkConfig* config);
+
+/**
+ * @brief Prints one result to the standard output in the format of the config
+ *
+ * @param config
+ * @param result
+ */
+void printBenchmarkResult(const BenchmarkConfig* config, const BenchmarkResult* result);
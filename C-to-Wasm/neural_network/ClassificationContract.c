@@ -1,9 +1,61 @@
 #include <gsl/gsl_matrix.h>
 #include "MatrixNNUtils.h"
+#include "FixedNNUtils.h"
+#include "FloatNNUtils.h"
+#include "Evaluation.h"
+#include "ModelCheckpoint.h"
+#include "Normalizer.h"
+#include "Optimizer.h"
 #include "ClassificationContract.h"
 
+// Number of rows going through the network at once during inference
+#define INFERENCE_BLOCK 64
+
+// Grows the workspace once, smaller batches reuse it
+static int reserveWorkspace(ClassificationContract* contract, size_t batchSize) {
+    if(contract->workspace->batchSize >= batchSize) return 0;
+
+    // The sparse input setting carries over to the larger workspace
+    gsl_nn_workspace* ws = constructWorkspace(contract->dimensions, contract->nbDimensions, batchSize);
+    if(!ws || setWorkspaceSparseInput(ws, contract->workspace->maxDensity)) {
+        destroyWorkspace(ws);
+        return -1;
+    }
+    destroyWorkspace(contract->workspace);
+    contract->workspace = ws;
+
+    return 0;
+}
+
+// Same for the float workspace, the mixed setting carries over as well
+static int reserveFloatWorkspace(ClassificationContract* contract, size_t batchSize) {
+    if(contract->floatWorkspace->batchSize >= batchSize) return 0;
+
+    gsl_nn_workspace_float* ws = constructWorkspaceFloat(contract->dimensions, contract->nbDimensions, batchSize);
+    if(!ws || setWorkspaceSparseInputFloat(ws, contract->floatWorkspace->maxDensity)
+        || setWorkspaceMixed(ws, contract->floatWorkspace->mixed)) {
+        destroyWorkspaceFloat(ws);
+        return -1;
+    }
+    destroyWorkspaceFloat(contract->floatWorkspace);
+    contract->floatWorkspace = ws;
+
+    return 0;
+}
+
+// Runs every row of X through the network, INFERENCE_BLOCK rows at a time
+static int predictBlocks(ClassificationContract* contract, const gsl_matrix* X, size_t* labels) {
+    for(size_t r = 0; r < X->size1; r += INFERENCE_BLOCK) {
+        size_t b = X->size1 - r < INFERENCE_BLOCK ? X->size1 - r : INFERENCE_BLOCK;
+        gsl_matrix_const_view block = gsl_matrix_const_submatrix(X, r, 0, b, X->size2);
+        if(predictInWorkspace(contract->workspace, &block.matrix, (const gsl_matrix**) contract->allW, labels + r)) return -1;
+    }
+
+    return 0;
+}
+
 static gsl_matrix* fromArray(double* data, size_t rows, size_t cols) {
-    gsl_matrix* matrix = gsl_matrix_calloc(rows, cols);
+    gsl_matrix* matrix = nnMatrixCalloc(rows, cols);
     if(!matrix) return NULL;
 
     for(size_t i = 0; i < rows; i++) {
@@ -15,15 +67,108 @@ static gsl_matrix* fromArray(double* data, size_t rows, size_t cols) {
     return matrix;
 }
 
+// Network dimensions and workspace, the data must already be in the contract
+static int setupNetwork(ClassificationContract* contract, int* hiddenLayers, size_t nbLayers, size_t M, size_t C) {
+    contract->dimensions = nnCalloc(nbLayers + 2, sizeof(int));
+    if(!contract->dimensions) return -1;
+
+    contract->dimensions[0] = M;
+    for(size_t i = 0; i < nbLayers; i++) {
+        contract->dimensions[i + 1] = hiddenLayers[i];
+    }
+    contract->dimensions[nbLayers + 1] = C;
+
+    contract->nbDimensions = nbLayers + 2;
+
+    contract->allW = NULL;
+    contract->fixedW = NULL;
+    contract->floatW = NULL;
+    contract->floatWorkspace = NULL;
+    contract->floatBlock = NULL;
+    contract->fixedBlock = NULL;
+    contract->fixedTrainInput = NULL;
+    contract->fixedTrainOutput = NULL;
+    contract->floatTrainInput = NULL;
+    contract->floatTrainOutput = NULL;
+    contract->optimizer = NULL;
+    contract->normalizer = NULL;
+    contract->streamedNormalizer = NULL;
+    contract->normalizedBlock = NULL;
+
+    contract->workspace = constructWorkspace(contract->dimensions, contract->nbDimensions, INFERENCE_BLOCK);
+    if(!contract->workspace) {
+        free(contract->dimensions);
+        return -1;
+    }
+
+    if(contract->arithmetic == NN_ARITHMETIC_FLOAT || contract->arithmetic == NN_ARITHMETIC_MIXED) {
+        contract->floatWorkspace = constructWorkspaceFloat(contract->dimensions, contract->nbDimensions, INFERENCE_BLOCK);
+        contract->floatBlock = gsl_matrix_float_alloc(INFERENCE_BLOCK, M);
+        if(!contract->floatWorkspace || !contract->floatBlock
+            || setWorkspaceMixed(contract->floatWorkspace, contract->arithmetic == NN_ARITHMETIC_MIXED)) {
+            destroyWorkspaceFloat(contract->floatWorkspace);
+            if(contract->floatBlock) gsl_matrix_float_free(contract->floatBlock);
+            destroyWorkspace(contract->workspace);
+            free(contract->dimensions);
+            return -1;
+        }
+    }
+
+    if(contract->arithmetic == NN_ARITHMETIC_FIXED) {
+        contract->fixedBlock = gsl_matrix_int_alloc(INFERENCE_BLOCK, M);
+        if(!contract->fixedBlock) {
+            destroyWorkspace(contract->workspace);
+            free(contract->dimensions);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Replaces the converted training inputs, the previous ones are stale once the inputs are normalized
+static int convertTrainInput(ClassificationContract* contract) {
+    if(contract->fixedTrainInput) gsl_matrix_int_free(contract->fixedTrainInput);
+    if(contract->floatTrainInput) gsl_matrix_float_free(contract->floatTrainInput);
+    contract->fixedTrainInput = NULL;
+    contract->floatTrainInput = NULL;
+    if(contract->arithmetic == NN_ARITHMETIC_DOUBLE || !contract->trainInput) return 0;
+
+    if(contract->arithmetic == NN_ARITHMETIC_FIXED) {
+        contract->fixedTrainInput = toFixedMatrix(contract->trainInput);
+        return contract->fixedTrainInput ? 0 : -1;
+    }
+    contract->floatTrainInput = toFloatMatrix(contract->trainInput);
+    return contract->floatTrainInput ? 0 : -1;
+}
+
+// The fixed, float and mixed networks train on a copy of the training set converted once here
+static int convertTrainingSet(ClassificationContract* contract) {
+    if(contract->arithmetic == NN_ARITHMETIC_DOUBLE || !contract->trainInput) return 0;
+    if(convertTrainInput(contract)) return -1;
+
+    if(contract->arithmetic == NN_ARITHMETIC_FIXED) {
+        contract->fixedTrainOutput = toFixedMatrix(contract->trainOutput);
+        return contract->fixedTrainOutput ? 0 : -1;
+    }
+    contract->floatTrainOutput = toFloatMatrix(contract->trainOutput);
+    return contract->floatTrainOutput ? 0 : -1;
+}
+
 ClassificationContract* constructContract(double* X, double* Y, double* tX, double* tY, int* hiddenLayers, 
     size_t N, size_t M, size_t C, size_t T, size_t nbLayers) {
+        return constructContractWithArithmetic(X, Y, tX, tY, hiddenLayers, N, M, C, T, nbLayers, NN_ARITHMETIC_DOUBLE);
+    }
+
+ClassificationContract* constructContractWithArithmetic(double* X, double* Y, double* tX, double* tY, int* hiddenLayers, 
+    size_t N, size_t M, size_t C, size_t T, size_t nbLayers, NNArithmetic arithmetic) {
         REQUIRE_NON_NULL(X);
         REQUIRE_NON_NULL(Y);
         REQUIRE_NON_NULL(tX);
         REQUIRE_NON_NULL(tY);
         REQUIRE_NON_NULL(hiddenLayers);
 
-        ClassificationContract* contract = calloc(1, sizeof(ClassificationContract));
+        ClassificationContract* contract = nnCalloc(1, sizeof(ClassificationContract));
         if(!contract) return NULL;
 
         gsl_matrix* mX = fromArray(X, N, M);
@@ -44,9 +189,11 @@ ClassificationContract* constructContract(double* X, double* Y, double* tX, doub
         contract->trainOutput = mY;
         contract->testInput = mtX;
         contract->testOutput = mtY;
+        contract->ownsInputs = 1;
+        contract->ownsOutputs = 1;
+        contract->arithmetic = arithmetic;
 
-        contract->dimensions = calloc(nbLayers + 2, sizeof(int));
-        if(!contract->dimensions) {
+        if(setupNetwork(contract, hiddenLayers, nbLayers, M, C)) {
             gsl_matrix_free(mX);
             gsl_matrix_free(mY);
             gsl_matrix_free(mtX);
@@ -54,16 +201,49 @@ ClassificationContract* constructContract(double* X, double* Y, double* tX, doub
             free(contract);
             return NULL;
         }
-        
-        contract->dimensions[0] = M;
-        for(size_t i = 0; i < nbLayers; i++) {
-            contract->dimensions[i + 1] = hiddenLayers[i];
+
+        if(convertTrainingSet(contract)) {
+            destroyContract(contract);
+            return NULL;
         }
-        contract->dimensions[nbLayers + 1] = C;
 
-        contract->nbDimensions = nbLayers + 2;
+        return contract;
+    }
+
+ClassificationContract* constructContractFromViews(const gsl_matrix* X, const gsl_matrix* Y, const gsl_matrix* tX, 
+    const gsl_matrix* tY, int* hiddenLayers, size_t nbLayers) {
+        return constructContractFromViewsWithArithmetic(X, Y, tX, tY, hiddenLayers, nbLayers, NN_ARITHMETIC_DOUBLE);
+    }
+
+ClassificationContract* constructContractFromViewsWithArithmetic(const gsl_matrix* X, const gsl_matrix* Y, 
+    const gsl_matrix* tX, const gsl_matrix* tY, int* hiddenLayers, size_t nbLayers, NNArithmetic arithmetic) {
+        REQUIRE_NON_NULL(tX);
+        REQUIRE_NON_NULL(tY);
+        REQUIRE_NON_NULL(hiddenLayers);
+        if(!X != !Y || tX->size1 != tY->size1) return NULL;
+        if(X && (X->size1 != Y->size1 || X->size2 != tX->size2 || Y->size2 != tY->size2)) return NULL;
+
+        ClassificationContract* contract = nnCalloc(1, sizeof(ClassificationContract));
+        if(!contract) return NULL;
 
-        contract->allW = NULL;
+        // Borrowed, the contract only reads them
+        contract->trainInput = (gsl_matrix*) X;
+        contract->trainOutput = (gsl_matrix*) Y;
+        contract->testInput = (gsl_matrix*) tX;
+        contract->testOutput = (gsl_matrix*) tY;
+        contract->ownsInputs = 0;
+        contract->ownsOutputs = 0;
+        contract->arithmetic = arithmetic;
+
+        if(setupNetwork(contract, hiddenLayers, nbLayers, tX->size2, tY->size2)) {
+            free(contract);
+            return NULL;
+        }
+
+        if(convertTrainingSet(contract)) {
+            destroyContract(contract);
+            return NULL;
+        }
 
         return contract;
     }
@@ -72,70 +252,396 @@ void destroyContract(ClassificationContract* contract) {
     if(!contract) return;
 
     destroyMatricesArray(contract->allW, contract->nbDimensions - 1);
+    unmapModel(contract->modelMapping, contract->modelMappingSize);
+    destroyWorkspace(contract->workspace);
+    destroyFixedMatricesArray(contract->fixedW, contract->nbDimensions - 1);
+    destroyMatricesArrayFloat(contract->floatW, contract->nbDimensions - 1);
+    destroyWorkspaceFloat(contract->floatWorkspace);
+    if(contract->floatBlock) gsl_matrix_float_free(contract->floatBlock);
+    if(contract->fixedBlock) gsl_matrix_int_free(contract->fixedBlock);
+    if(contract->fixedTrainInput) gsl_matrix_int_free(contract->fixedTrainInput);
+    if(contract->fixedTrainOutput) gsl_matrix_int_free(contract->fixedTrainOutput);
+    if(contract->floatTrainInput) gsl_matrix_float_free(contract->floatTrainInput);
+    if(contract->floatTrainOutput) gsl_matrix_float_free(contract->floatTrainOutput);
+    destroyOptimizer(contract->optimizer);
+    destroyNormalizer(contract->normalizer);
+    destroyNormalizer(contract->streamedNormalizer);
+    if(contract->normalizedBlock) gsl_matrix_free(contract->normalizedBlock);
     
-    gsl_matrix_free(contract->trainInput);
-    gsl_matrix_free(contract->trainOutput);
-    gsl_matrix_free(contract->testInput);
-    gsl_matrix_free(contract->testOutput);
+    if(contract->ownsInputs) {
+        gsl_matrix_free(contract->trainInput);
+        gsl_matrix_free(contract->testInput);
+    }
+    if(contract->ownsOutputs) {
+        gsl_matrix_free(contract->trainOutput);
+        gsl_matrix_free(contract->testOutput);
+    }
 
     free(contract->dimensions);
     
     free(contract);
 }
 
+static gsl_matrix* copyMatrix(const gsl_matrix* m) {
+    gsl_matrix* out = nnMatrixAlloc(m->size1, m->size2);
+    if(out) gsl_matrix_memcpy(out, m);
+    return out;
+}
+
+int normalizeContractWithThreads(ClassificationContract* contract, size_t threads) {
+    if(!contract) return -1;
+
+    // Already normalized, the statistics of the raw inputs are kept
+    if(contract->normalizer) return 0;
+
+    // The statistics come from the training data only, the test inputs would leak into the model
+    NNNormalizer* normalizer;
+    if(contract->trainInput) {
+        normalizer = constructNormalizer(contract->trainInput->size2);
+        if(normalizer && fitNormalizer(normalizer, contract->trainInput, threads)) {
+            destroyNormalizer(normalizer);
+            return -1;
+        }
+    }
+    else {
+        if(!contract->streamedNormalizer || contract->streamedNormalizer->count == 0) return -1;
+        normalizer = contract->streamedNormalizer;
+        finishNormalizer(normalizer);
+    }
+    if(!normalizer) return -1;
+
+    gsl_matrix* block = nnMatrixAlloc(INFERENCE_BLOCK, normalizer->nbFeatures);
+    if(!block) {
+        if(normalizer != contract->streamedNormalizer) destroyNormalizer(normalizer);
+        return -1;
+    }
+
+    // Borrowed inputs are copied once, the contract then normalizes its own copies in place
+    if(!contract->ownsInputs) {
+        gsl_matrix* X = contract->trainInput ? copyMatrix(contract->trainInput) : NULL;
+        gsl_matrix* tX = copyMatrix(contract->testInput);
+        if((contract->trainInput && !X) || !tX) {
+            if(X) gsl_matrix_free(X);
+            if(tX) gsl_matrix_free(tX);
+            if(normalizer != contract->streamedNormalizer) destroyNormalizer(normalizer);
+            gsl_matrix_free(block);
+            return -1;
+        }
+        contract->trainInput = X;
+        contract->testInput = tX;
+        contract->ownsInputs = 1;
+    }
+
+    if(contract->trainInput) applyNormalizer(normalizer, contract->trainInput);
+    applyNormalizer(normalizer, contract->testInput);
+
+    contract->normalizer = normalizer;
+    contract->streamedNormalizer = NULL;
+    contract->normalizedBlock = block;
+    return convertTrainInput(contract);
+}
+
 void normalizeContract(ClassificationContract* contract) {
-    if(!contract) return;
+    normalizeContractWithThreads(contract, 1);
+}
 
-    gsl_matrix* normX = normalize(contract->trainInput);
-    gsl_matrix* normtX = normalize(contract->testInput);
+int accumulateContractNormalizer(ClassificationContract* contract, const gsl_matrix* X) {
+    if(!contract || !X || contract->normalizer || contract->trainInput) return -1;
+    if(X->size2 != (size_t) contract->dimensions[0]) return -1;
 
-    gsl_matrix_free(contract->trainInput);
-    gsl_matrix_free(contract->testInput);
+    if(!contract->streamedNormalizer) {
+        contract->streamedNormalizer = constructNormalizer(X->size2);
+        if(!contract->streamedNormalizer) return -1;
+    }
+    return accumulateNormalizer(contract->streamedNormalizer, X);
+}
+
+int setContractOptimizer(ClassificationContract* contract, const NNOptimizerConfig* config) {
+    if(!contract || contract->arithmetic != NN_ARITHMETIC_DOUBLE) return -1;
+
+    NNOptimizer* optimizer = NULL;
+    if(config) {
+        optimizer = constructOptimizer(contract->dimensions, contract->nbDimensions, config);
+        if(!optimizer) return -1;
+    }
+
+    destroyOptimizer(contract->optimizer);
+    contract->optimizer = optimizer;
+    return 0;
+}
 
-    contract->trainInput = normX;
-    contract->testInput = normtX;
+int setContractSparseInput(ClassificationContract* contract, double maxDensity) {
+    if(!contract || contract->arithmetic == NN_ARITHMETIC_FIXED) return -1;
+    if(contract->floatWorkspace) return setWorkspaceSparseInputFloat(contract->floatWorkspace, maxDensity);
+    return setWorkspaceSparseInput(contract->workspace, maxDensity);
+}
+
+static void trainContractFixed(ClassificationContract* contract, int numEpoch, double learningRate) {
+    destroyFixedMatricesArray(contract->fixedW, contract->nbDimensions - 1);
+    contract->fixedW = NULL;
+    if(contract->fixedTrainInput && contract->fixedTrainOutput) {
+        contract->fixedW = trainFixed(contract->fixedTrainInput, contract->fixedTrainOutput, contract->dimensions, 
+                                contract->nbDimensions, numEpoch, learningRate);
+    }
+}
+
+static void trainContractFloat(ClassificationContract* contract, int numEpoch, double learningRate, size_t batchSize) {
+    destroyMatricesArrayFloat(contract->floatW, contract->nbDimensions - 1);
+    contract->floatW = NULL;
+    if(reserveFloatWorkspace(contract, batchSize)) return;
+
+    if(contract->floatTrainInput && contract->floatTrainOutput) {
+        contract->floatW = trainBatchedFloat(contract->floatWorkspace, contract->floatTrainInput, 
+                                contract->floatTrainOutput, numEpoch, learningRate, batchSize);
+    }
+}
+
+static int isFloatArithmetic(const ClassificationContract* contract) {
+    return contract->arithmetic == NN_ARITHMETIC_FLOAT || contract->arithmetic == NN_ARITHMETIC_MIXED;
 }
 
 void trainContract(ClassificationContract* contract, int numEpoch, double learningRate) {
-    if(!contract) return;
+    if(!contract || !contract->trainInput) return;
+
+    if(contract->arithmetic == NN_ARITHMETIC_FIXED) {
+        trainContractFixed(contract, numEpoch, learningRate);
+        return;
+    }
+
+    // Sample by sample like train()
+    if(isFloatArithmetic(contract)) {
+        trainContractFloat(contract, numEpoch, learningRate, 1);
+        return;
+    }
+
+    if(contract->optimizer) {
+        destroyMatricesArray(contract->allW, contract->nbDimensions - 1);
+        contract->allW = trainOptimized(contract->workspace, contract->optimizer, contract->trainInput, 
+                                contract->trainOutput, numEpoch, learningRate, 1);
+        return;
+    }
+
+    destroyMatricesArray(contract->allW, contract->nbDimensions - 1);
+    contract->allW = train(contract->workspace, contract->trainInput, contract->trainOutput, numEpoch, learningRate);
+}
+
+void trainContractBatched(ClassificationContract* contract, int numEpoch, double learningRate, size_t batchSize) {
+    if(!contract || !contract->trainInput || contract->arithmetic == NN_ARITHMETIC_FIXED) return;
+
+    if(batchSize > contract->trainInput->size1) batchSize = contract->trainInput->size1;
+    if(batchSize == 0) return;
+
+    if(isFloatArithmetic(contract)) {
+        trainContractFloat(contract, numEpoch, learningRate, batchSize);
+        return;
+    }
+
+    if(reserveWorkspace(contract, batchSize)) return;
+
+    destroyMatricesArray(contract->allW, contract->nbDimensions - 1);
+    if(contract->optimizer) {
+        contract->allW = trainOptimized(contract->workspace, contract->optimizer, contract->trainInput, 
+                                contract->trainOutput, numEpoch, learningRate, batchSize);
+        return;
+    }
+    contract->allW = trainBatched(contract->workspace, contract->trainInput, contract->trainOutput, 
+                            numEpoch, learningRate, batchSize);
+}
+
+void trainContractParallel(ClassificationContract* contract, int numEpoch, double learningRate, size_t threads, 
+    NNParallelMode mode) {
+    if(!contract || !contract->trainInput || contract->arithmetic != NN_ARITHMETIC_DOUBLE) return;
+
+    destroyMatricesArray(contract->allW, contract->nbDimensions - 1);
+    contract->allW = trainParallel(contract->dimensions, contract->nbDimensions, contract->trainInput, 
+                            contract->trainOutput, numEpoch, learningRate, threads, mode);
+}
+
+// Standardizes a copy of the batch in normalizedBlock, grown to the largest batch seen
+static int normalizeBatch(ClassificationContract* contract, const gsl_matrix* X, gsl_matrix_view* batch) {
+    if(contract->normalizedBlock->size1 < X->size1) {
+        gsl_matrix* block = nnMatrixAlloc(X->size1, X->size2);
+        if(!block) return -1;
+        gsl_matrix_free(contract->normalizedBlock);
+        contract->normalizedBlock = block;
+    }
+
+    *batch = gsl_matrix_submatrix(contract->normalizedBlock, 0, 0, X->size1, X->size2);
+    if(gsl_matrix_memcpy(&batch->matrix, X)) return -1;
+    return applyNormalizer(contract->normalizer, &batch->matrix);
+}
+
+int trainContractOnBatch(ClassificationContract* contract, const gsl_matrix* X, const gsl_matrix* Y, double learningRate) {
+    if(!contract || !X || !Y || contract->arithmetic != NN_ARITHMETIC_DOUBLE) return -1;
+    if(X->size2 != (size_t) contract->dimensions[0] || Y->size2 != (size_t) contract->dimensions[contract->nbDimensions - 1]) return -1;
+
+    if(reserveWorkspace(contract, X->size1)) return -1;
+
+    if(!contract->allW) {
+        contract->allW = initNetwork(contract->dimensions, contract->nbDimensions);
+        if(!contract->allW) return -1;
+    }
+
+    gsl_matrix_view batch;
+    if(contract->normalizer) {
+        if(normalizeBatch(contract, X, &batch)) return -1;
+        X = &batch.matrix;
+    }
+
+    if(contract->optimizer) return optimizerStep(contract->workspace, contract->optimizer, X, Y, contract->allW, learningRate);
+    return trainStep(contract->workspace, X, Y, contract->allW, learningRate);
+}
+
+int saveContractModel(const ClassificationContract* contract, const char* path) {
+    if(!contract || !contract->allW || contract->arithmetic != NN_ARITHMETIC_DOUBLE) return -1;
 
-    contract->allW = train(contract->trainInput, contract->trainOutput, contract->dimensions, 
-                            contract->nbDimensions, numEpoch, learningRate);
+    return writeModel(path, (const gsl_matrix**) contract->allW, contract->dimensions, contract->nbDimensions);
+}
+
+int loadContractModel(ClassificationContract* contract, const char* path) {
+    if(!contract || contract->arithmetic != NN_ARITHMETIC_DOUBLE) return -1;
+
+    void* mapping;
+    size_t mappingSize;
+    gsl_matrix** allW = mapModel(path, contract->dimensions, contract->nbDimensions, &mapping, &mappingSize);
+    if(!allW) return -1;
+
+    // The previous weights may live in the previous mapping
+    destroyMatricesArray(contract->allW, contract->nbDimensions - 1);
+    unmapModel(contract->modelMapping, contract->modelMappingSize);
+
+    contract->allW = allW;
+    contract->modelMapping = mapping;
+    contract->modelMappingSize = mappingSize;
 
+    return 0;
+}
+
+// Each block of X is converted into contract->fixedBlock like predictFloatMatrix
+static int predictFixedMatrix(ClassificationContract* contract, const gsl_matrix* X, size_t* labels) {
+    for(size_t r = 0; r < X->size1; r += INFERENCE_BLOCK) {
+        size_t b = X->size1 - r < INFERENCE_BLOCK ? X->size1 - r : INFERENCE_BLOCK;
+        gsl_matrix_int_view block = gsl_matrix_int_submatrix(contract->fixedBlock, 0, 0, b, X->size2);
+        for(size_t i = 0; i < b; i++) {
+            const double* in = gsl_matrix_const_ptr(X, r + i, 0);
+            int* row = gsl_matrix_int_ptr(&block.matrix, i, 0);
+            for(size_t j = 0; j < X->size2; j++) {
+                row[j] = toFixed(in[j]);
+            }
+        }
+        if(predictFixed(&block.matrix, (const gsl_matrix_int**) contract->fixedW, contract->nbDimensions - 1, 
+                labels + r)) return -1;
+    }
+
+    return 0;
+}
+
+// Each block of X is converted into contract->floatBlock, nothing is allocated
+static int predictFloatMatrix(ClassificationContract* contract, const gsl_matrix* X, size_t* labels) {
+    for(size_t r = 0; r < X->size1; r += INFERENCE_BLOCK) {
+        size_t b = X->size1 - r < INFERENCE_BLOCK ? X->size1 - r : INFERENCE_BLOCK;
+        gsl_matrix_float_view block = gsl_matrix_float_submatrix(contract->floatBlock, 0, 0, b, X->size2);
+        for(size_t i = 0; i < b; i++) {
+            const double* in = gsl_matrix_const_ptr(X, r + i, 0);
+            float* row = gsl_matrix_float_ptr(&block.matrix, i, 0);
+            for(size_t j = 0; j < X->size2; j++) {
+                row[j] = (float) in[j];
+            }
+        }
+        if(predictInWorkspaceFloat(contract->floatWorkspace, &block.matrix, (const gsl_matrix_float**) contract->floatW, 
+                labels + r)) return -1;
+    }
+
+    return 0;
+}
+
+// Fixed and float networks run on X converted one block at a time
+static int predictConverted(ClassificationContract* contract, const gsl_matrix* X, size_t* labels) {
+    if(contract->arithmetic == NN_ARITHMETIC_FIXED) return predictFixedMatrix(contract, X, labels);
+    return predictFloatMatrix(contract, X, labels);
+}
+
+static int isTrained(const ClassificationContract* contract) {
+    if(contract->arithmetic == NN_ARITHMETIC_FIXED) return contract->fixedW != NULL;
+    if(isFloatArithmetic(contract)) return contract->floatW != NULL;
+    return contract->allW != NULL;
+}
+
+static int predictRows(ClassificationContract* contract, const gsl_matrix* X, size_t* labels) {
+    if(contract->arithmetic != NN_ARITHMETIC_DOUBLE) return predictConverted(contract, X, labels);
+    return predictBlocks(contract, X, labels);
+}
+
+static double testContractConverted(ClassificationContract* contract) {
+    size_t totalSamples = contract->testInput->size1;
+    size_t* labels = nnCalloc(totalSamples, sizeof(size_t));
+    if(!labels || predictConverted(contract, contract->testInput, labels)) {
+        free(labels);
+        return -1;
+    }
+
+    int nbSame = 0;
+    for(size_t i = 0; i < totalSamples; i++) {
+        gsl_vector_const_view vAct = gsl_matrix_const_row(contract->testOutput, i);
+        if(labels[i] == gsl_vector_max_index(&vAct.vector)) nbSame++;
+    }
+
+    free(labels);
+    return (double) nbSame / (double) totalSamples;
 }
 
 double testContract(ClassificationContract* contract) {
     // Check if the model has been trained
-    if(!contract || !contract->allW) return -1;
+    if(!contract || !isTrained(contract)) return -1;
+
+    if(contract->arithmetic != NN_ARITHMETIC_DOUBLE) return testContractConverted(contract);
     
     int nbSame = 0;
-    int totalSamples = contract->testInput->size1;
-    for(int i = 0; i < totalSamples; i++) {
-        gsl_matrix inRow = gsl_matrix_const_submatrix(contract->testInput, i, 0, 1, contract->testInput->size2).matrix;
-        gsl_matrix* tInRow = gsl_matrix_calloc(inRow.size2, inRow.size1);
+    size_t totalSamples = contract->testInput->size1;
+    size_t labels[INFERENCE_BLOCK];
+    for(size_t r = 0; r < totalSamples; r += INFERENCE_BLOCK) {
+        size_t b = totalSamples - r < INFERENCE_BLOCK ? totalSamples - r : INFERENCE_BLOCK;
+        gsl_matrix_const_view block = gsl_matrix_const_submatrix(contract->testInput, r, 0, b, contract->testInput->size2);
+        if(predictInWorkspace(contract->workspace, &block.matrix, (const gsl_matrix**) contract->allW, labels)) return -1;
 
-        if(!tInRow || gsl_matrix_transpose_memcpy(tInRow, &inRow)) {
-            if(tInRow) gsl_matrix_free(tInRow);
-            return -1;
-        }
+        for(size_t i = 0; i < b; i++) {
+            gsl_vector_const_view vAct = gsl_matrix_const_row(contract->testOutput, r + i);
+            size_t expected = gsl_vector_max_index(&vAct.vector);
 
-        gsl_matrix* result = nn(tInRow, (const gsl_matrix**) contract->allW, contract->nbDimensions - 1);
-        if(!result) {
-            gsl_matrix_free(tInRow);
-            return -1;
+            if(labels[i] == expected) nbSame++;
         }
+    }
+
+    return (double) nbSame / (double) totalSamples;
+}
 
-        gsl_vector_const_view vPred = result->size1 == 1 ? gsl_matrix_const_row(result, 0) : gsl_matrix_const_column(result, 0);
-        size_t prediction = gsl_vector_max_index(&vPred.vector);
+NNEvaluation* evaluateContract(ClassificationContract* contract, size_t topK, size_t threads) {
+    if(!contract || !contract->allW || contract->arithmetic != NN_ARITHMETIC_DOUBLE) return NULL;
 
-        gsl_matrix outRow = gsl_matrix_const_submatrix(contract->testOutput, i, 0, 1, contract->testOutput->size2).matrix;
-        gsl_vector_const_view vAct = outRow.size1 == 1 ? gsl_matrix_const_row(&outRow, 0) : gsl_matrix_const_column(&outRow, 0);
-        size_t expected = gsl_vector_max_index(&vAct.vector);
+    return evaluateNetwork((const gsl_matrix**) contract->allW, contract->dimensions, contract->nbDimensions, 
+                contract->testInput, contract->testOutput, topK, threads);
+}
 
-        if(prediction == expected) nbSame++;
-        gsl_matrix_free(tInRow);
-        gsl_matrix_free(result);
+int predictContract(ClassificationContract* contract, const double* X, size_t rows, size_t* outLabels) {
+    if(!contract || !X || !outLabels) return -1;
+    
+    // Check if the model has been trained
+    if(!isTrained(contract)) return -1;
+    if(rows == 0) return 0;
+
+    gsl_matrix_const_view mX = gsl_matrix_const_view_array(X, rows, contract->dimensions[0]);
+    if(!contract->normalizer) {
+        if(predictRows(contract, &mX.matrix, outLabels)) return -1;
+    } else {
+        // Raw rows get the transform of the training inputs, one block at a time
+        for(size_t r = 0; r < rows; r += INFERENCE_BLOCK) {
+            size_t b = rows - r < INFERENCE_BLOCK ? rows - r : INFERENCE_BLOCK;
+            gsl_matrix_const_view raw = gsl_matrix_const_submatrix(&mX.matrix, r, 0, b, mX.matrix.size2);
+            gsl_matrix_view block = gsl_matrix_submatrix(contract->normalizedBlock, 0, 0, b, mX.matrix.size2);
+            if(gsl_matrix_memcpy(&block.matrix, &raw.matrix) || applyNormalizer(contract->normalizer, &block.matrix)
+                || predictRows(contract, &block.matrix, outLabels + r)) return -1;
+        }
     }
 
-    return (double) nbSame / (double) totalSamples;
-}
\ No newline at end of file
+    return 0;
+}
@@ -1,6 +1,28 @@
 #pragma once
 
 #include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_float.h>
+#include <gsl/gsl_matrix_int.h>
+#include "Evaluation.h"
+#include "NNWorkspace.h"
+#include "Normalizer.h"
+#include "Optimizer.h"
+#include "ParallelTrainer.h"
+
+/*
+ * Every arithmetic trains with trainContract and predicts with testContract and predictContract, the float and
+ * mixed ones also train with trainContractBatched. Optimizers, streamed batches, parallel training, checkpoints
+ * and evaluateContract only exist for NN_ARITHMETIC_DOUBLE, they fail (or do nothing) with the other ones.
+ */
+typedef enum {
+    NN_ARITHMETIC_DOUBLE,
+    // Deterministic Q16.16 integer arithmetic, see FixedNNUtils.h
+    NN_ARITHMETIC_FIXED,
+    // Single precision weights and activations, see FloatNNUtils.h
+    NN_ARITHMETIC_FLOAT,
+    // Single precision storage with products accumulated in double
+    NN_ARITHMETIC_MIXED
+} NNArithmetic;
 
 typedef struct {
     gsl_matrix* trainInput;
@@ -10,6 +32,34 @@ typedef struct {
     int* dimensions;
     size_t nbDimensions;
     gsl_matrix** allW;
+    gsl_nn_workspace* workspace;
+    NNArithmetic arithmetic;
+    gsl_matrix_int** fixedW;
+    gsl_matrix_float** floatW;
+    // Buffers of the float and mixed networks, and INFERENCE_BLOCK rows converted to float by predictContract
+    gsl_nn_workspace_float* floatWorkspace;
+    gsl_matrix_float* floatBlock;
+    // INFERENCE_BLOCK rows converted to Q16.16 by predictContract and testContract
+    gsl_matrix_int* fixedBlock;
+    // Training set of the fixed, float or mixed network, converted at construction and after normalizeContract
+    gsl_matrix_int* fixedTrainInput;
+    gsl_matrix_int* fixedTrainOutput;
+    gsl_matrix_float* floatTrainInput;
+    gsl_matrix_float* floatTrainOutput;
+    // NULL for plain gradient descent, see setContractOptimizer
+    NNOptimizer* optimizer;
+    // Statistics of the training inputs, set by normalizeContract and reused by predictContract
+    NNNormalizer* normalizer;
+    // Statistics of the streamed training batches until normalizeContract, see accumulateContractNormalizer
+    NNNormalizer* streamedNormalizer;
+    // Rows normalized by predictContract and trainContractOnBatch, INFERENCE_BLOCK or the largest batch
+    gsl_matrix* normalizedBlock;
+    // 0 when the matrices belong to the caller, see constructContractFromViews
+    int ownsInputs;
+    int ownsOutputs;
+    // Checkpoint mapped by loadContractModel, released with the contract
+    void* modelMapping;
+    size_t modelMappingSize;
 } ClassificationContract;
 
 /**
@@ -31,6 +81,48 @@ typedef struct {
 ClassificationContract* constructContract(double* X, double* Y, double* tX, double* tY, int* hiddenLayers, 
     size_t N, size_t M, size_t C, size_t T, size_t nbLayers);
 
+/**
+ * @brief Constructs a classification contract whose network is trained and run with the given arithmetic
+ * 
+ * @param arithmetic NN_ARITHMETIC_FIXED gives results that are identical on every host, NN_ARITHMETIC_FLOAT and
+ * NN_ARITHMETIC_MIXED halve the size of the weights and activations. The contract keeps a converted copy of the
+ * training set, see NNArithmetic for the available operations
+ * 
+ * See constructContract for the other parameters
+ * 
+ * @return ClassificationContract*
+ */
+ClassificationContract* constructContractWithArithmetic(double* X, double* Y, double* tX, double* tY, int* hiddenLayers, 
+    size_t N, size_t M, size_t C, size_t T, size_t nbLayers, NNArithmetic arithmetic);
+
+/**
+ * @brief Constructs a classification contract on matrices owned by the caller, nothing is copied
+ * 
+ * The matrices (or the views they come from) must outlive the contract, normalizeContract replaces the
+ * inputs by normalized copies owned by the contract
+ * 
+ * @param X The N samples of M dimensions matrix (N x M), may be NULL with Y when training with trainContractOnBatch
+ * @param Y The N classification encoded as a probability between the C classes (N x C)
+ * @param tX The T samples of M dimensions matrix (T x M)
+ * @param tY The T classification encoded as a probability between the C classes (T x C)
+ * @param hiddenLayers The dimensions (and number) of hidden layers
+ * @param nbLayers See above
+ * 
+ * @return ClassificationContract*
+ */
+ClassificationContract* constructContractFromViews(const gsl_matrix* X, const gsl_matrix* Y, const gsl_matrix* tX, 
+    const gsl_matrix* tY, int* hiddenLayers, size_t nbLayers);
+
+/**
+ * @brief Constructs a classification contract on matrices owned by the caller, with the given arithmetic
+ * 
+ * See constructContractFromViews and constructContractWithArithmetic
+ * 
+ * @return ClassificationContract*
+ */
+ClassificationContract* constructContractFromViewsWithArithmetic(const gsl_matrix* X, const gsl_matrix* Y, 
+    const gsl_matrix* tX, const gsl_matrix* tY, int* hiddenLayers, size_t nbLayers, NNArithmetic arithmetic);
+
 /**
  * @brief Destroys a classification contract
  * 
@@ -41,13 +133,81 @@ void destroyContract(ClassificationContract* contract);
 /**
  * @brief Normalizes the data in the contract
  * 
+ * Every feature is standardized with the mean and standard deviation of the training inputs, or of the batches
+ * given to accumulateContractNormalizer when the contract has none, the test inputs get the same transform. The
+ * inputs are normalized in place once owned by the contract, predictContract and trainContractOnBatch apply the
+ * transform to the rows they are given.
+ * 
+ * Does nothing without training statistics, the test inputs never provide them
+ * 
  * @param contract 
  */
 void normalizeContract(ClassificationContract* contract);
 
+/**
+ * @brief Same as normalizeContract, the statistics are gathered on several threads
+ * 
+ * @param contract 
+ * @param threads Number of threads, the calling one included
+ * 
+ * @return 0 on success, -1 otherwise (e.g. without training statistics)
+ */
+int normalizeContractWithThreads(ClassificationContract* contract, size_t threads);
+
+/**
+ * @brief Adds a batch of training inputs to the statistics of normalizeContract, for contracts without training
+ * inputs that are trained with trainContractOnBatch
+ * 
+ * The batches are streamed once before training (e.g. a first pass over an MNISTStream), their statistics are
+ * merged as if they were one matrix
+ * 
+ * @param contract 
+ * @param X The batch samples (B x M)
+ * 
+ * @return 0 on success, -1 otherwise (e.g. once normalized or when the contract has training inputs)
+ */
+int accumulateContractNormalizer(ClassificationContract* contract, const gsl_matrix* X);
+
+/**
+ * @brief Sets the optimizer used by trainContract, trainContractBatched and trainContractOnBatch
+ * 
+ * Its state is allocated here once. trainContract and trainContractBatched start from a cleared state, 
+ * trainContractOnBatch carries it from one batch to the next. Parallel training keeps plain gradient descent.
+ * 
+ * @param contract 
+ * @param config NULL goes back to plain gradient descent
+ * 
+ * Only available with NN_ARITHMETIC_DOUBLE, see NNArithmetic
+ * 
+ * @return 0 on success, -1 otherwise
+ */
+int setContractOptimizer(ClassificationContract* contract, const NNOptimizerConfig* config);
+
+/**
+ * @brief Runs the first layer on the nonzero inputs only when a batch is sparse enough
+ * 
+ * Inputs mostly made of zeros, such as unnormalized images, go through a CSR copy of the batch: the first layer
+ * product and weight gradient then cost the number of nonzero inputs instead of the number of inputs, and the
+ * gradient only touches the weight columns of the nonzero inputs. Applies to trainContractBatched, 
+ * trainContractOnBatch, predictContract and testContract. trainContract in double precision without an optimizer
+ * keeps the dense products, its gradients stay bit-identical to backpropagation(). Normalized inputs are rarely
+ * sparse.
+ * 
+ * Not available with NN_ARITHMETIC_FIXED
+ * 
+ * @param contract 
+ * @param maxDensity Highest fraction of nonzero inputs in a batch for the sparse path, 1 for every batch 
+ * and 0 to disable it
+ * 
+ * @return 0 on success, -1 otherwise
+ */
+int setContractSparseInput(ClassificationContract* contract, double maxDensity);
+
 /**
  * @brief Trains the data with a given number of epochs and learning rate
  * 
+ * With an optimizer the samples go through it one at a time
+ * 
  * @param numEpoch
  * @param learningRate
  * 
@@ -55,6 +215,79 @@ void normalizeContract(ClassificationContract* contract);
  */
 void trainContract(ClassificationContract* contract, int numEpoch, double learningRate);
 
+/**
+ * @brief Trains the data with mini-batch gradient descent, each batch goes through a layer as one matrix product
+ * 
+ * @param numEpoch
+ * @param learningRate Applied to the gradient averaged over the batch
+ * @param batchSize Number of training rows per batch (the last batch may be smaller)
+ * 
+ * Not available with NN_ARITHMETIC_FIXED, does nothing then
+ * 
+ * @param contract 
+ */
+void trainContractBatched(ClassificationContract* contract, int numEpoch, double learningRate, size_t batchSize);
+
+/**
+ * @brief Trains the data with mini-batch gradient descent on several threads, see trainParallel
+ * 
+ * @param numEpoch
+ * @param learningRate Applied to the gradient averaged over each batch
+ * @param threads Number of threads, the calling one included
+ * @param mode NN_PARALLEL_SYNCHRONOUS gives the same weights for any number of threads, NN_PARALLEL_HOGWILD
+ * does not synchronize the updates
+ * 
+ * Only available with NN_ARITHMETIC_DOUBLE, does nothing otherwise, see NNArithmetic
+ * 
+ * @param contract 
+ */
+void trainContractParallel(ClassificationContract* contract, int numEpoch, double learningRate, size_t threads, 
+    NNParallelMode mode);
+
+/**
+ * @brief Applies one mini-batch gradient step to the network, which is initialized by the first call
+ * 
+ * Lets the training data be streamed in batches (e.g. from an MNISTStream) instead of being held by the contract.
+ * A normalized contract standardizes a copy of the batch first.
+ * 
+ * @param contract 
+ * @param X The raw batch samples (B x M)
+ * @param Y The batch classifications (B x C)
+ * @param learningRate Applied to the gradient averaged over the batch
+ * 
+ * Only available with NN_ARITHMETIC_DOUBLE, see NNArithmetic
+ * 
+ * @return 0 on success, -1 otherwise
+ */
+int trainContractOnBatch(ClassificationContract* contract, const gsl_matrix* X, const gsl_matrix* Y, double learningRate);
+
+/**
+ * @brief Writes the trained weights to a versioned checkpoint, see ModelCheckpoint.h for the layout
+ * 
+ * @param contract 
+ * @param path 
+ * 
+ * Only available with NN_ARITHMETIC_DOUBLE, see NNArithmetic
+ * 
+ * @return 0 on success, -1 otherwise
+ */
+int saveContractModel(const ClassificationContract* contract, const char* path);
+
+/**
+ * @brief Replaces the weights by the ones of a checkpoint, the file is mapped and used in place
+ * 
+ * The checkpoint must have been saved from a network of the same dimensions, the contract can then be tested or
+ * run without training
+ * 
+ * @param contract 
+ * @param path 
+ * 
+ * Only available with NN_ARITHMETIC_DOUBLE, see NNArithmetic
+ * 
+ * @return 0 on success, -1 otherwise
+ */
+int loadContractModel(ClassificationContract* contract, const char* path);
+
 /**
  * @brief Tests the contract after training and returns the accuracy
  * 
@@ -62,4 +295,34 @@ void trainContract(ClassificationContract* contract, int numEpoch, double learni
  * 
  * @return accuracy
  */
-double testContract(ClassificationContract* contract);
\ No newline at end of file
+double testContract(ClassificationContract* contract);
+
+/**
+ * @brief Evaluates the trained network on the test data, see evaluateNetwork
+ * 
+ * Unlike testContract, which stays in the contract workspace, every thread gets its own workspace for the call
+ * 
+ * @param contract 
+ * @param topK Top-k accuracy is topKCorrect / nbSamples
+ * @param threads Number of threads, the calling one included, the result is the same for any number
+ * 
+ * Only available with NN_ARITHMETIC_DOUBLE, see NNArithmetic
+ * 
+ * @return NNEvaluation*, to be destroyed with destroyEvaluation, NULL on failure
+ */
+NNEvaluation* evaluateContract(ClassificationContract* contract, size_t topK, size_t threads);
+
+/**
+ * @brief Predicts the class of every row of X with the trained network, rows go through the layers in blocks
+ * 
+ * @param contract 
+ * @param X The raw R samples of M dimensions matrix (R x M), normalized like the training inputs when the contract
+ * was normalized
+ * @param rows R
+ * @param outLabels Receives the R predicted classes
+ * 
+ * See evaluateContract for the accuracy on the test data
+ * 
+ * @return 0 on success, -1 otherwise
+ */
+int predictContract(ClassificationContract* contract, const double* X, size_t rows, size_t* outLabels);
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <gsl/gsl_matrix.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "Sharding.h"
+#include "Evaluation.h"
+
+typedef struct {
+    const gsl_matrix** allW;
+    const gsl_matrix* X;
+    const gsl_matrix* Y;
+    size_t begin;
+    size_t end;
+    size_t topK;
+    gsl_nn_workspace* ws;
+    // Counts of the shard, nbClasses x nbClasses
+    size_t* confusion;
+    size_t topKCorrect;
+    int failed;
+} EvaluationShard;
+
+static size_t firstMaxIndex(const double* values, size_t n) {
+    size_t best = 0;
+    for(size_t j = 1; j < n; j++) {
+        if(values[j] > values[best]) best = j;
+    }
+    return best;
+}
+
+// Number of outputs ranked before the expected class, ties broken by index like firstMaxIndex
+static size_t rankOf(const double* outputs, size_t n, size_t expected) {
+    size_t rank = 0;
+    for(size_t j = 0; j < n; j++) {
+        rank += outputs[j] > outputs[expected] || (outputs[j] == outputs[expected] && j < expected);
+    }
+    return rank;
+}
+
+static void* evaluateShard(void* data) {
+    EvaluationShard* shard = data;
+    size_t nbClasses = shard->Y->size2;
+
+    for(size_t r = shard->begin; r < shard->end; r += EVALUATION_BLOCK) {
+        size_t b = shard->end - r < EVALUATION_BLOCK ? shard->end - r : EVALUATION_BLOCK;
+        gsl_matrix_const_view block = gsl_matrix_const_submatrix(shard->X, r, 0, b, shard->X->size2);
+        const gsl_matrix* out = nnInWorkspace(shard->ws, &block.matrix, shard->allW);
+        if(!out) {
+            shard->failed = 1;
+            return NULL;
+        }
+
+        for(size_t i = 0; i < b; i++) {
+            const double* outputs = gsl_matrix_const_ptr(out, i, 0);
+            size_t expected = firstMaxIndex(gsl_matrix_const_ptr(shard->Y, r + i, 0), nbClasses);
+            size_t rank = rankOf(outputs, nbClasses, expected);
+            shard->confusion[expected * nbClasses + firstMaxIndex(outputs, nbClasses)]++;
+            shard->topKCorrect += rank < shard->topK;
+        }
+    }
+
+    return NULL;
+}
+
+void destroyEvaluation(NNEvaluation* evaluation) {
+    if(!evaluation) return;
+    free(evaluation->confusion);
+    free(evaluation->precision);
+    free(evaluation);
+}
+
+static NNEvaluation* constructEvaluation(size_t nbClasses, size_t nbSamples, size_t topK) {
+    NNEvaluation* evaluation = nnCalloc(1, sizeof(NNEvaluation));
+    REQUIRE_NON_NULL(evaluation);
+
+    evaluation->nbClasses = nbClasses;
+    evaluation->nbSamples = nbSamples;
+    evaluation->topK = topK;
+    evaluation->confusion = nnCalloc(nbClasses * nbClasses, sizeof(size_t));
+    evaluation->precision = nnCalloc(2 * nbClasses, sizeof(double));
+    if(!evaluation->confusion || !evaluation->precision) {
+        destroyEvaluation(evaluation);
+        return NULL;
+    }
+    evaluation->recall = evaluation->precision + nbClasses;
+
+    return evaluation;
+}
+
+// Everything else follows from the confusion matrix
+static void summarize(NNEvaluation* evaluation) {
+    size_t n = evaluation->nbClasses;
+    for(size_t c = 0; c < n; c++) {
+        size_t predicted = 0;
+        size_t expected = 0;
+        for(size_t k = 0; k < n; k++) {
+            predicted += evaluation->confusion[k * n + c];
+            expected += evaluation->confusion[c * n + k];
+        }
+        size_t hits = evaluation->confusion[c * n + c];
+        evaluation->correct += hits;
+        evaluation->precision[c] = predicted ? (double) hits / (double) predicted : 0.0;
+        evaluation->recall[c] = expected ? (double) hits / (double) expected : 0.0;
+    }
+}
+
+static void destroyShards(EvaluationShard* shards, size_t nbShards) {
+    if(!shards) return;
+    for(size_t t = 0; t < nbShards; t++) {
+        destroyWorkspace(shards[t].ws);
+        free(shards[t].confusion);
+    }
+    free(shards);
+}
+
+NNEvaluation* evaluateNetwork(const gsl_matrix** allW, const int* dimensions, size_t nbDimensions, const gsl_matrix* X,
+    const gsl_matrix* Y, size_t topK, size_t nbThreads) {
+    REQUIRE_NON_NULL(allW);
+    REQUIRE_NON_NULL(dimensions);
+    REQUIRE_NON_NULL(X);
+    REQUIRE_NON_NULL(Y);
+    if(nbDimensions < 2 || topK == 0 || nbThreads == 0 || X->size1 != Y->size1) return NULL;
+    if(X->size2 != (size_t) dimensions[0] || Y->size2 != (size_t) dimensions[nbDimensions - 1]) return NULL;
+
+    size_t nbClasses = Y->size2;
+    // No shard smaller than a block
+    size_t maxThreads = (X->size1 + EVALUATION_BLOCK - 1) / EVALUATION_BLOCK;
+    if(nbThreads > maxThreads) nbThreads = maxThreads ? maxThreads : 1;
+
+    NNEvaluation* evaluation = constructEvaluation(nbClasses, X->size1, topK);
+    EvaluationShard* shards = nnCalloc(nbThreads, sizeof(EvaluationShard));
+    int failed = !evaluation || !shards;
+    for(size_t t = 0; !failed && t < nbThreads; t++) {
+        shards[t].allW = allW;
+        shards[t].X = X;
+        shards[t].Y = Y;
+        shards[t].begin = X->size1 * t / nbThreads;
+        shards[t].end = X->size1 * (t + 1) / nbThreads;
+        shards[t].topK = topK;
+        shards[t].ws = constructWorkspace(dimensions, nbDimensions, EVALUATION_BLOCK);
+        shards[t].confusion = nnCalloc(nbClasses * nbClasses, sizeof(size_t));
+        failed = !shards[t].ws || !shards[t].confusion;
+    }
+
+    if(!failed) runSharded(nbThreads, evaluateShard, shards, sizeof(EvaluationShard));
+
+    // Integer counts, the sum is the same in any order
+    for(size_t t = 0; !failed && t < nbThreads; t++) {
+        failed = shards[t].failed;
+        for(size_t k = 0; k < nbClasses * nbClasses; k++) {
+            evaluation->confusion[k] += shards[t].confusion[k];
+        }
+        evaluation->topKCorrect += shards[t].topKCorrect;
+    }
+
+    destroyShards(shards, nbThreads);
+    if(failed) {
+        destroyEvaluation(evaluation);
+        return NULL;
+    }
+
+    summarize(evaluation);
+    return evaluation;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <gsl/gsl_matrix.h>
+
+// Rows going through the network at once in every shard
+#define EVALUATION_BLOCK 64
+
+typedef struct {
+    size_t nbClasses;
+    size_t nbSamples;
+    size_t topK;
+    // Samples whose expected class is the prediction, and is among the topK highest outputs
+    size_t correct;
+    size_t topKCorrect;
+    // confusion[expected * nbClasses + predicted]
+    size_t* confusion;
+    // Per class, 0 for a class that is never predicted (precision) or never expected (recall)
+    double* precision;
+    double* recall;
+} NNEvaluation;
+
+/**
+ * @brief Runs every row of X through the network and compares the predictions with Y in a single pass
+ *
+ * The rows are split in one contiguous shard per thread, each thread counts into its own confusion matrix with its
+ * own workspace and the counts are summed afterwards: the result does not depend on the number of threads.
+ * The predicted class is the first highest output, like predictInWorkspace, and the expected one the first highest
+ * value of the row of Y. Ties are ranked by index for top-k. See runSharded.
+ *
+ * @param allW
+ * @param dimensions The dimensions of every layer, input and output included
+ * @param nbDimensions See above
+ * @param X The samples (N x M)
+ * @param Y The expected classifications (N x C)
+ * @param topK At least 1
+ * @param nbThreads
+ *
+ * @return NNEvaluation*, NULL on failure
+ */
+NNEvaluation* evaluateNetwork(const gsl_matrix** allW, const int* dimensions, size_t nbDimensions, const gsl_matrix* X,
+    const gsl_matrix* Y, size_t topK, size_t nbThreads);
+
+/**
+ * @brief Destroys an evaluation
+ *
+ * @param evaluation
+ */
+void destroyEvaluation(NNEvaluation* evaluation);
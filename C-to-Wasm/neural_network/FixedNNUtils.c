@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_int.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "FixedNNUtils.h"
+
+static fixed saturate(int64_t value) {
+    if(value > INT32_MAX) return INT32_MAX;
+    if(value < INT32_MIN) return INT32_MIN;
+    return (fixed) value;
+}
+
+// Rounds a Q32.32 accumulator back to Q16.16, floor plus the first dropped bit so the rounding cannot overflow
+static fixed narrow(int64_t acc) {
+    return saturate((acc >> FIXED_FRACTION_BITS) + ((acc >> (FIXED_FRACTION_BITS - 1)) & 1));
+}
+
+// Sum of 32 x 32 -> 64 bits products kept as the products' high halves apart from their low 32 bits,
+// neither part can overflow below 2^30 terms
+typedef struct {
+    int64_t high;
+    uint64_t low;
+} WideSum;
+
+static void wideAdd(WideSum* sum, int64_t value) {
+    sum->high += value >> 32;
+    sum->low += (uint64_t) value & UINT32_MAX;
+}
+
+// The exact sum, clamped to 64 bits
+static int64_t wideValue(const WideSum* sum) {
+    int64_t high = sum->high + (int64_t) (sum->low >> 32);
+    if(high > INT32_MAX) return INT64_MAX;
+    if(high < INT32_MIN) return INT64_MIN;
+    return high * ((int64_t) 1 << 32) + (int64_t) (sum->low & UINT32_MAX);
+}
+
+// bias + a.b clamped to 64 bits, the loop only uses 32 x 32 -> 64 bits multiplications
+static int64_t dot(const fixed* a, const fixed* b, size_t n, int64_t bias) {
+    WideSum sum = { 0, 0 };
+    wideAdd(&sum, bias);
+    for(size_t j = 0; j < n; j++) {
+        wideAdd(&sum, (int64_t) a[j] * (int64_t) b[j]);
+    }
+    return wideValue(&sum);
+}
+
+fixed toFixed(double value) {
+    double scaled = value * FIXED_ONE;
+    if(isnan(scaled)) return 0;
+    if(scaled >= INT32_MAX) return INT32_MAX;
+    if(scaled <= INT32_MIN) return INT32_MIN;
+    return (fixed) lround(scaled);
+}
+
+double fromFixed(fixed value) {
+    return (double) value / FIXED_ONE;
+}
+
+fixed fixedMul(fixed a, fixed b) {
+    return narrow((int64_t) a * (int64_t) b);
+}
+
+gsl_matrix_int* toFixedMatrix(const gsl_matrix* m) {
+    REQUIRE_NON_NULL(m);
+
+    gsl_matrix_int* out = gsl_matrix_int_alloc(m->size1, m->size2);
+    if(!out) return NULL;
+
+    for(size_t i = 0; i < m->size1; i++) {
+        for(size_t j = 0; j < m->size2; j++) {
+            gsl_matrix_int_set(out, i, j, toFixed(gsl_matrix_get(m, i, j)));
+        }
+    }
+
+    return out;
+}
+
+void destroyFixedMatricesArray(gsl_matrix_int** array, size_t nbElements) {
+    if(!array) return;
+    for(size_t i = 0; i < nbElements; i++) {
+        if(array[i]) gsl_matrix_int_free(array[i]);
+    }
+    free(array);
+}
+
+// Same starting point as the double network
+static gsl_matrix_int** initFixedNetwork(const int* dimensions, size_t nbDimensions) {
+    gsl_matrix** allW = initNetwork(dimensions, nbDimensions);
+    REQUIRE_NON_NULL(allW);
+
+    size_t nbLayers = nbDimensions - 1;
+    gsl_matrix_int** out = nnCalloc(nbLayers, sizeof(gsl_matrix_int*));
+    for(size_t i = 0; out && i < nbLayers; i++) {
+        out[i] = toFixedMatrix(allW[i]);
+        if(!out[i]) {
+            destroyFixedMatricesArray(out, nbLayers);
+            out = NULL;
+        }
+    }
+
+    destroyMatricesArray(allW, nbLayers);
+    return out;
+}
+
+int fixedAffine(const gsl_matrix_int* x, const gsl_matrix_int* W, gsl_matrix_int* out) {
+    size_t nbInputs = W->size2 - 1;
+    if(!x || !W || !out || x->size2 != nbInputs || out->size1 != x->size1 || out->size2 != W->size1) return -1;
+
+    for(size_t r = 0; r < x->size1; r++) {
+        const fixed* in = (const fixed*) gsl_matrix_int_const_ptr(x, r, 0);
+        for(size_t i = 0; i < W->size1; i++) {
+            const fixed* row = (const fixed*) gsl_matrix_int_const_ptr(W, i, 0);
+            int64_t bias = (int64_t) row[nbInputs] * FIXED_ONE;
+            gsl_matrix_int_set(out, r, i, narrow(dot(row, in, nbInputs, bias)));
+        }
+    }
+
+    return 0;
+}
+
+void fixedRelu(gsl_matrix_int* m) {
+    for(size_t i = 0; i < m->size1; i++) {
+        fixed* row = (fixed*) gsl_matrix_int_ptr(m, i, 0);
+        for(size_t j = 0; j < m->size2; j++) {
+            row[j] = row[j] > 0 ? row[j] : 0;
+        }
+    }
+}
+
+gsl_matrix_int* nnFixed(const gsl_matrix_int* x, const gsl_matrix_int** allW, size_t nbW) {
+    REQUIRE_NON_NULL(x);
+    REQUIRE_NON_NULL(allW);
+
+    gsl_matrix_int* out = NULL;
+    for(size_t i = 0; i < nbW; i++) {
+        gsl_matrix_int* next = gsl_matrix_int_alloc(x->size1, allW[i]->size1);
+        if(!next || fixedAffine(out ? out : x, allW[i], next)) {
+            if(next) gsl_matrix_int_free(next);
+            if(out) gsl_matrix_int_free(out);
+            return NULL;
+        }
+        // Same activations as nn()
+        fixedRelu(next);
+
+        if(out) gsl_matrix_int_free(out);
+        out = next;
+    }
+
+    return out;
+}
+
+int predictFixed(const gsl_matrix_int* x, const gsl_matrix_int** allW, size_t nbW, size_t* labels) {
+    if(!labels) return -1;
+
+    gsl_matrix_int* out = nnFixed(x, allW, nbW);
+    if(!out) return -1;
+
+    for(size_t r = 0; r < out->size1; r++) {
+        gsl_vector_int_const_view row = gsl_matrix_int_const_row(out, r);
+        labels[r] = gsl_vector_int_max_index(&row.vector);
+    }
+
+    gsl_matrix_int_free(out);
+    return 0;
+}
+
+gsl_matrix_int** trainFixed(const gsl_matrix_int* trainInput, const gsl_matrix_int* trainOutput, const int* dimensions,
+    size_t nbDimensions, int numEpoch, double learningRate) {
+    REQUIRE_NON_NULL(trainInput);
+    REQUIRE_NON_NULL(trainOutput);
+    REQUIRE_NON_NULL(dimensions);
+
+    gsl_matrix_int** allW = initFixedNetwork(dimensions, nbDimensions);
+    REQUIRE_NON_NULL(allW);
+
+    size_t nbLayers = nbDimensions - 1;
+    size_t nbSamples = trainInput->size1;
+    fixed lr = toFixed(learningRate);
+
+    // Pre-activations and activations of every layer followed by two error buffers, allocated once
+    size_t maxDim = 0;
+    size_t total = 0;
+    for(size_t i = 0; i < nbDimensions; i++) {
+        if((size_t) dimensions[i] > maxDim) maxDim = dimensions[i];
+        if(i > 0) total += 2 * dimensions[i];
+    }
+    fixed* buffer = nnCalloc(total + 2 * maxDim, sizeof(fixed));
+    fixed** combs = nnCalloc(2 * nbLayers, sizeof(fixed*));
+    WideSum* accs = nnCalloc(maxDim, sizeof(WideSum));
+    if(!buffer || !combs || !accs) {
+        free(buffer);
+        free(combs);
+        free(accs);
+        destroyFixedMatricesArray(allW, nbLayers);
+        return NULL;
+    }
+    fixed** acts = combs + nbLayers;
+    fixed* offset = buffer;
+    for(size_t i = 0; i < nbLayers; i++) {
+        combs[i] = offset;
+        acts[i] = offset + dimensions[i + 1];
+        offset += 2 * dimensions[i + 1];
+    }
+    fixed* deltas[2] = { offset, offset + maxDim };
+
+    for(int e = 0; e < numEpoch; e++) {
+        for(size_t r = 0; r < nbSamples; r++) {
+            const fixed* x = (const fixed*) gsl_matrix_int_const_ptr(trainInput, r, 0);
+            const fixed* y = (const fixed*) gsl_matrix_int_const_ptr(trainOutput, r, 0);
+
+            // Forward propagation, identity on the output layer like backpropagation()
+            const fixed* in = x;
+            for(size_t i = 0; i < nbLayers; i++) {
+                const gsl_matrix_int* W = allW[i];
+                size_t nbInputs = W->size2 - 1;
+                for(size_t k = 0; k < W->size1; k++) {
+                    const fixed* row = (const fixed*) gsl_matrix_int_const_ptr(W, k, 0);
+                    fixed comb = narrow(dot(row, in, nbInputs, (int64_t) row[nbInputs] * FIXED_ONE));
+                    combs[i][k] = comb;
+                    acts[i][k] = i == nbLayers - 1 || comb > 0 ? comb : 0;
+                }
+                in = acts[i];
+            }
+
+            // dL2/dx
+            size_t current = 0;
+            fixed* delta = deltas[current];
+            for(size_t k = 0; k < (size_t) dimensions[nbLayers]; k++) {
+                delta[k] = saturate(2 * ((int64_t) acts[nbLayers - 1][k] - y[k]));
+            }
+
+            // Backpropagation with the same activation choice as backpropagation(), each layer is updated
+            // as soon as its error has been propagated to the previous one
+            for(size_t k = 0; k < nbLayers; k++) {
+                size_t i = nbLayers - 1 - k;
+                gsl_matrix_int* W = allW[i];
+                size_t nbInputs = W->size2 - 1;
+                const fixed* input = i == 0 ? x : acts[i - 1];
+
+                if(nbLayers == 1) {
+                    for(size_t j = 0; j < W->size1; j++) {
+                        if(combs[i][j] <= 0) delta[j] = 0;
+                    }
+                }
+
+                if(i > 0) {
+                    // Row by row so the inner loop stays contiguous
+                    fixed* prev = deltas[1 - current];
+                    for(size_t j = 0; j < nbInputs; j++) {
+                        accs[j] = (WideSum) { 0, 0 };
+                    }
+                    for(size_t s = 0; s < W->size1; s++) {
+                        const fixed* row = (const fixed*) gsl_matrix_int_const_ptr(W, s, 0);
+                        int64_t d = delta[s];
+                        for(size_t j = 0; j < nbInputs; j++) {
+                            wideAdd(&accs[j], (int64_t) row[j] * d);
+                        }
+                    }
+                    for(size_t j = 0; j < nbInputs; j++) {
+                        prev[j] = narrow(wideValue(&accs[j]));
+                    }
+                }
+
+                for(size_t s = 0; s < W->size1; s++) {
+                    fixed step = fixedMul(lr, delta[s]);
+                    fixed* row = (fixed*) gsl_matrix_int_ptr(W, s, 0);
+                    for(size_t j = 0; j < nbInputs; j++) {
+                        row[j] = saturate((int64_t) row[j] - fixedMul(step, input[j]));
+                    }
+                    row[nbInputs] = saturate((int64_t) row[nbInputs] - step);
+                }
+
+                if(i > 0) {
+                    current = 1 - current;
+                    delta = deltas[current];
+                }
+            }
+        }
+    }
+
+    free(buffer);
+    free(combs);
+    free(accs);
+    return allW;
+}
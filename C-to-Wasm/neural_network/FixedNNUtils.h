@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_int.h>
+
+// Q16.16 values stored in 32 bits, products are accumulated exactly as Q32.32 in 64 bits
+#define FIXED_FRACTION_BITS 16
+#define FIXED_ONE (1 << FIXED_FRACTION_BITS)
+
+typedef int32_t fixed;
+
+fixed toFixed(double value);
+double fromFixed(fixed value);
+fixed fixedMul(fixed a, fixed b);
+
+gsl_matrix_int* toFixedMatrix(const gsl_matrix* m);
+void destroyFixedMatricesArray(gsl_matrix_int** array, size_t nbElements);
+
+int fixedAffine(const gsl_matrix_int* x, const gsl_matrix_int* W, gsl_matrix_int* out);
+void fixedRelu(gsl_matrix_int* m);
+gsl_matrix_int* nnFixed(const gsl_matrix_int* x, const gsl_matrix_int** allW, size_t nbW);
+int predictFixed(const gsl_matrix_int* x, const gsl_matrix_int** allW, size_t nbW, size_t* labels);
+gsl_matrix_int** trainFixed(const gsl_matrix_int* trainInput, const gsl_matrix_int* trainOutput, const int* dimensions,
+    size_t nbDimensions, int numEpoch, double learningRate);
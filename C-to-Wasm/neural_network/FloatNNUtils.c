@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_blas.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_float.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "FloatNNUtils.h"
+
+// Columns of C accumulated at once by mixedGemm
+#define MIXED_BLOCK 64
+
+gsl_matrix_float* toFloatMatrix(const gsl_matrix* m) {
+    REQUIRE_NON_NULL(m);
+
+    gsl_matrix_float* out = gsl_matrix_float_alloc(m->size1, m->size2);
+    if(!out) return NULL;
+
+    for(size_t i = 0; i < m->size1; i++) {
+        const double* in = gsl_matrix_const_ptr(m, i, 0);
+        float* row = gsl_matrix_float_ptr(out, i, 0);
+        for(size_t j = 0; j < m->size2; j++) {
+            row[j] = (float) in[j];
+        }
+    }
+
+    return out;
+}
+
+// Same starting point as the double network
+gsl_matrix_float** initNetworkFloat(const int* dimensions, size_t nbDimensions) {
+    gsl_matrix** initW = initNetwork(dimensions, nbDimensions);
+    REQUIRE_NON_NULL(initW);
+
+    size_t nbLayers = nbDimensions - 1;
+    gsl_matrix_float** allW = nnCalloc(nbLayers, sizeof(gsl_matrix_float*));
+    for(size_t i = 0; allW && i < nbLayers; i++) {
+        allW[i] = toFloatMatrix(initW[i]);
+        if(!allW[i]) {
+            destroyMatricesArrayFloat(allW, nbLayers);
+            allW = NULL;
+        }
+    }
+    destroyMatricesArray(initW, nbLayers);
+
+    return allW;
+}
+
+void destroyMatricesArrayFloat(gsl_matrix_float** array, size_t nbElements) {
+    if(!array) return;
+    for(size_t i = 0; i < nbElements; i++) {
+        if(array[i]) gsl_matrix_float_free(array[i]);
+    }
+    free(array);
+}
+
+int setWorkspaceMixed(gsl_nn_workspace_float* ws, int mixed) {
+    if(!ws) return -1;
+    ws->mixed = mixed != 0;
+    return 0;
+}
+
+// C = alpha * op(A) * op(B) + beta * C, the products are summed in double and rounded once into C
+static int mixedGemm(CBLAS_TRANSPOSE_t TransA, CBLAS_TRANSPOSE_t TransB, double alpha, const gsl_matrix_float* A,
+    const gsl_matrix_float* B, double beta, gsl_matrix_float* C) {
+    size_t M = TransA == CblasNoTrans ? A->size1 : A->size2;
+    size_t K = TransA == CblasNoTrans ? A->size2 : A->size1;
+    size_t N = TransB == CblasNoTrans ? B->size2 : B->size1;
+    if((TransB == CblasNoTrans ? B->size1 : B->size2) != K || C->size1 != M || C->size2 != N) return GSL_EBADLEN;
+
+    // Strides of op(A) and op(B) between rows and between columns
+    size_t aRow = TransA == CblasNoTrans ? A->tda : 1;
+    size_t aColumn = TransA == CblasNoTrans ? 1 : A->tda;
+    size_t bRow = TransB == CblasNoTrans ? B->tda : 1;
+    size_t bColumn = TransB == CblasNoTrans ? 1 : B->tda;
+
+    double acc[MIXED_BLOCK];
+    for(size_t i = 0; i < M; i++) {
+        const float* a = A->data + i * aRow;
+        float* c = gsl_matrix_float_ptr(C, i, 0);
+        for(size_t j0 = 0; j0 < N; j0 += MIXED_BLOCK) {
+            size_t width = N - j0 < MIXED_BLOCK ? N - j0 : MIXED_BLOCK;
+            for(size_t j = 0; j < width; j++) acc[j] = 0.0;
+            for(size_t l = 0; l < K; l++) {
+                double value = a[l * aColumn];
+                const float* b = B->data + l * bRow + j0 * bColumn;
+                for(size_t j = 0; j < width; j++) acc[j] += value * b[j * bColumn];
+            }
+            // beta == 0 never reads C, like BLAS
+            for(size_t j = 0; j < width; j++) {
+                double previous = beta == 0.0 ? 0.0 : beta * c[j0 + j];
+                c[j0 + j] = (float) (alpha * acc[j] + previous);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Without a workspace, or a workspace that is not mixed, the products run in single precision
+static int layerGemm(const gsl_nn_workspace_float* ws, CBLAS_TRANSPOSE_t TransA, CBLAS_TRANSPOSE_t TransB, double alpha,
+    const gsl_matrix_float* A, const gsl_matrix_float* B, double beta, gsl_matrix_float* C) {
+    if(ws && ws->mixed) return mixedGemm(TransA, TransB, alpha, A, B, beta, C);
+    return gsl_blas_sgemm(TransA, TransB, (float) alpha, A, B, (float) beta, C);
+}
+
+#define BASE_FLOAT
+#include "NNTemplatesOn.h"
+#include "LayerSource.h"
+#include "NNTemplatesOff.h"
+#undef BASE_FLOAT
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_float.h>
+#include "NNWorkspace.h"
+
+/*
+ * Single precision network, the layer primitives of MatrixNNUtils.c instantiated for float (see LayerSource.h).
+ * Weights and activations are stored as float and every product runs through sgemm, unless the workspace is mixed:
+ * the products and gradient sums are then accumulated in double and rounded once.
+ */
+
+gsl_matrix_float* toFloatMatrix(const gsl_matrix* m);
+gsl_matrix_float** initNetworkFloat(const int* dimensions, size_t nbDimensions);
+void destroyMatricesArrayFloat(gsl_matrix_float** array, size_t nbElements);
+int setWorkspaceMixed(gsl_nn_workspace_float* ws, int mixed);
+
+int affineLayerFloat(const gsl_matrix_float* in, const gsl_matrix_float* W, gsl_matrix_float* comb, gsl_matrix_float* act,
+    int applyRelu);
+const gsl_matrix_float* nnInWorkspaceFloat(gsl_nn_workspace_float* ws, const gsl_matrix_float* x,
+    const gsl_matrix_float** allW);
+int predictInWorkspaceFloat(gsl_nn_workspace_float* ws, const gsl_matrix_float* x, const gsl_matrix_float** allW,
+    size_t* labels);
+int trainStepFloat(gsl_nn_workspace_float* ws, const gsl_matrix_float* X, const gsl_matrix_float* Y,
+    gsl_matrix_float** allW, double learningRate);
+gsl_matrix_float** trainBatchedFloat(gsl_nn_workspace_float* ws, const gsl_matrix_float* trainInput,
+    const gsl_matrix_float* trainOutput, int numEpoch, double learningRate, size_t batchSize);
@@ -0,0 +1,317 @@
+// Layer primitives, forward pass and mini-batch step, included once per translation unit and element type, see
+// NNTemplatesOn.h. The including file defines layerGemm(ws, TransA, TransB, alpha, A, B, beta, C), ws may be NULL
+
+static int layerProduct(const TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* in, const TYPE(gsl_matrix)* W,
+    TYPE(gsl_matrix)* out) {
+    // The bias column is skipped, x never has to be extended with a 1
+    VIEW(gsl_matrix, const_view) Wx = FUNCTION(gsl_matrix, const_submatrix)(W, 0, 0, W->size1, W->size2 - 1);
+    return layerGemm(ws, CblasNoTrans, CblasTrans, 1.0, in, &Wx.matrix, 0.0, out);
+}
+
+// Same product with a CSR input, four rows of W at a time: the nonzero inputs of a sample are read once for four
+// independent sums, the weights of the zero inputs are never read
+static void sparseLayerProduct(const TYPE(gsl_spmatrix)* in, const TYPE(gsl_matrix)* W, TYPE(gsl_matrix)* out) {
+    const int* restrict rows = in->p;
+    const int* restrict columns = in->i;
+    const BASE* restrict values = in->data;
+    size_t tda = W->tda;
+
+    size_t j = 0;
+    for(; j + 4 <= W->size1; j += 4) {
+        const BASE* restrict w = FUNCTION(gsl_matrix, const_ptr)(W, j, 0);
+        for(size_t r = 0; r < in->size1; r++) {
+            BASE s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+            for(int k = rows[r]; k < rows[r + 1]; k++) {
+                const BASE* column = w + columns[k];
+                BASE value = values[k];
+                s0 += value * column[0];
+                s1 += value * column[tda];
+                s2 += value * column[2 * tda];
+                s3 += value * column[3 * tda];
+            }
+            BASE* o = FUNCTION(gsl_matrix, ptr)(out, r, j);
+            o[0] = s0;
+            o[1] = s1;
+            o[2] = s2;
+            o[3] = s3;
+        }
+    }
+    for(; j < W->size1; j++) {
+        const BASE* restrict w = FUNCTION(gsl_matrix, const_ptr)(W, j, 0);
+        for(size_t r = 0; r < in->size1; r++) {
+            BASE total = 0.0;
+            for(int k = rows[r]; k < rows[r + 1]; k++) {
+                total += values[k] * w[columns[k]];
+            }
+            FUNCTION(gsl_matrix, set)(out, r, j, total);
+        }
+    }
+}
+
+// Bias and activation in a single pass over the product
+static void layerEpilogue(const TYPE(gsl_matrix)* W, TYPE(gsl_matrix)* comb, TYPE(gsl_matrix)* act, int applyRelu) {
+    size_t nbInputs = W->size2 - 1;
+    for(size_t r = 0; r < comb->size1; r++) {
+        BASE* combRow = FUNCTION(gsl_matrix, ptr)(comb, r, 0);
+        BASE* actRow = FUNCTION(gsl_matrix, ptr)(act, r, 0);
+        for(size_t j = 0; j < comb->size2; j++) {
+            BASE value = combRow[j] + FUNCTION(gsl_matrix, get)(W, j, nbInputs);
+            combRow[j] = value;
+            actRow[j] = applyRelu ? fmax(value, 0) : value;
+        }
+    }
+}
+
+static int validLayer(size_t nbSamples, size_t nbInputs, const TYPE(gsl_matrix)* W, const TYPE(gsl_matrix)* comb,
+    const TYPE(gsl_matrix)* act) {
+    if(!W || !comb || !act || nbInputs + 1 != W->size2 || comb->size2 != W->size1) return 0;
+    return comb->size1 == nbSamples && act->size1 == comb->size1 && act->size2 == comb->size2;
+}
+
+static int workspaceLayer(const TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* in, const TYPE(gsl_matrix)* W,
+    TYPE(gsl_matrix)* comb, TYPE(gsl_matrix)* act, int applyRelu) {
+    if(!in || !validLayer(in->size1, in->size2, W, comb, act) || layerProduct(ws, in, W, comb)) return -1;
+    layerEpilogue(W, comb, act, applyRelu);
+    return 0;
+}
+
+// Rows of in are samples, comb and act may be the same matrix, the activation is then applied in place
+int NN_FUNCTION(affineLayer)(const TYPE(gsl_matrix)* in, const TYPE(gsl_matrix)* W, TYPE(gsl_matrix)* comb,
+    TYPE(gsl_matrix)* act, int applyRelu) {
+    return workspaceLayer(NULL, in, W, comb, act, applyRelu);
+}
+
+static int sparseAffineLayer(const TYPE(gsl_spmatrix)* in, const TYPE(gsl_matrix)* W, TYPE(gsl_matrix)* comb,
+    TYPE(gsl_matrix)* act, int applyRelu) {
+    if(!validLayer(in->size1, in->size2, W, comb, act)) return -1;
+    sparseLayerProduct(in, W, comb);
+    layerEpilogue(W, comb, act, applyRelu);
+    return 0;
+}
+
+// CSR copy of X in the workspace, NULL when the sparse path is disabled or X has too many nonzero inputs
+static const TYPE(gsl_spmatrix)* sparseRows(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* X) {
+    TYPE(gsl_spmatrix)* S = ws->sparseInput;
+    if(!S || X->size2 != S->size2 || X->size1 > ws->batchSize) return NULL;
+
+    size_t limit = (size_t) (ws->maxDensity * (double) (X->size1 * X->size2));
+    size_t nz = 0;
+    for(size_t r = 0; r < X->size1; r++) {
+        const BASE* row = FUNCTION(gsl_matrix, const_ptr)(X, r, 0);
+        S->p[r] = nz;
+        for(size_t j = 0; j < X->size2; j++) {
+            if(row[j] == 0) continue;
+            if(nz == limit) return NULL;
+            S->i[nz] = j;
+            S->data[nz++] = row[j];
+        }
+    }
+    // The buffer holds batchSize rows, a smaller batch only uses the first ones
+    S->size1 = X->size1;
+    S->p[X->size1] = nz;
+    S->nz = nz;
+
+    return S;
+}
+
+// Gx += alpha * delta^T * in, scattered into four rows of Gx at a time. Only the columns of the inputs set in the
+// batch are touched
+static void sparseWeightProduct(BASE alpha, const TYPE(gsl_spmatrix)* in, const TYPE(gsl_matrix)* delta,
+    TYPE(gsl_matrix)* Gx) {
+    const int* restrict rows = in->p;
+    const int* restrict columns = in->i;
+    const BASE* restrict values = in->data;
+    size_t tda = Gx->tda;
+
+    size_t j = 0;
+    for(; j + 4 <= Gx->size1; j += 4) {
+        BASE* restrict g = FUNCTION(gsl_matrix, ptr)(Gx, j, 0);
+        for(size_t r = 0; r < in->size1; r++) {
+            const BASE* d = FUNCTION(gsl_matrix, const_ptr)(delta, r, j);
+            BASE d0 = alpha * d[0], d1 = alpha * d[1], d2 = alpha * d[2], d3 = alpha * d[3];
+            for(int k = rows[r]; k < rows[r + 1]; k++) {
+                BASE* column = g + columns[k];
+                BASE value = values[k];
+                column[0] += d0 * value;
+                column[tda] += d1 * value;
+                column[2 * tda] += d2 * value;
+                column[3 * tda] += d3 * value;
+            }
+        }
+    }
+    for(; j < Gx->size1; j++) {
+        BASE* restrict g = FUNCTION(gsl_matrix, ptr)(Gx, j, 0);
+        for(size_t r = 0; r < in->size1; r++) {
+            BASE d = alpha * FUNCTION(gsl_matrix, get)(delta, r, j);
+            for(int k = rows[r]; k < rows[r + 1]; k++) {
+                g[columns[k]] += d * values[k];
+            }
+        }
+    }
+}
+
+// First layer on the CSR copy of in when it is sparse enough, sparse receives it or NULL. A NULL sparse keeps the
+// dense product, whose sums are in the order of the reference
+static int firstLayer(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* in, const TYPE(gsl_matrix)* W,
+    TYPE(gsl_matrix)* comb, TYPE(gsl_matrix)* act, int applyRelu, const TYPE(gsl_spmatrix)** sparse) {
+    const TYPE(gsl_spmatrix)* samples = sparse ? sparseRows(ws, in) : NULL;
+    if(sparse) *sparse = samples;
+    if(samples) return sparseAffineLayer(samples, W, comb, act, applyRelu);
+    return workspaceLayer(ws, in, W, comb, act, applyRelu);
+}
+
+// Each row of in is a sample, the outputs end up in ws->activations[ws->nbLayers - 1]
+static int forwardInWorkspace(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* in, const TYPE(gsl_matrix)** allW,
+    int reluOnOutput, const TYPE(gsl_spmatrix)** sparse) {
+    if(NN_FUNCTION(setWorkspaceRows)(ws, in->size1)) return -1;
+
+    for(size_t i = 0; i < ws->nbLayers; i++) {
+        int applyRelu = i != ws->nbLayers - 1 || reluOnOutput;
+        TYPE(gsl_matrix)* comb = &ws->combinations[i].matrix;
+        TYPE(gsl_matrix)* act = &ws->activations[i].matrix;
+        if(i == 0 ? firstLayer(ws, in, allW[i], comb, act, applyRelu, sparse)
+                    : workspaceLayer(ws, in, allW[i], comb, act, applyRelu)) return -1;
+        in = act;
+    }
+
+    return 0;
+}
+
+const TYPE(gsl_matrix)* NN_FUNCTION(nnInWorkspace)(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* x,
+    const TYPE(gsl_matrix)** allW) {
+    REQUIRE_NON_NULL(ws);
+    REQUIRE_NON_NULL(x);
+    REQUIRE_NON_NULL(allW);
+
+    // Same activations as nn()
+    const TYPE(gsl_spmatrix)* sparse;
+    if(forwardInWorkspace(ws, x, allW, 1, &sparse)) return NULL;
+
+    return &ws->activations[ws->nbLayers - 1].matrix;
+}
+
+int NN_FUNCTION(predictInWorkspace)(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* x, const TYPE(gsl_matrix)** allW,
+    size_t* labels) {
+    if(!ws || !x || !allW || !labels || NN_FUNCTION(setWorkspaceRows)(ws, x->size1)) return -1;
+
+    // Hidden layers, pre-activations are not kept
+    size_t last = ws->nbLayers - 1;
+    const TYPE(gsl_spmatrix)* sparse;
+    for(size_t i = 0; i < last; i++) {
+        TYPE(gsl_matrix)* act = &ws->activations[i].matrix;
+        if(i == 0 ? firstLayer(ws, x, allW[i], act, act, 1, &sparse) : workspaceLayer(ws, x, allW[i], act, act, 1)) return -1;
+        x = act;
+    }
+
+    // Output layer, the epilogue adds the bias, applies ReLU like nn() and only keeps the argmax of each row
+    const TYPE(gsl_matrix)* W = allW[last];
+    size_t nbInputs = W->size2 - 1;
+    TYPE(gsl_matrix)* out = &ws->activations[last].matrix;
+    // A single layer reads the samples, which may be sparse
+    const TYPE(gsl_spmatrix)* samples = last == 0 ? sparseRows(ws, x) : NULL;
+    if(samples) sparseLayerProduct(samples, W, out);
+    else if(layerProduct(ws, x, W, out)) return -1;
+
+    for(size_t r = 0; r < out->size1; r++) {
+        const BASE* row = FUNCTION(gsl_matrix, const_ptr)(out, r, 0);
+        size_t best = 0;
+        BASE max = fmax(row[0] + FUNCTION(gsl_matrix, get)(W, 0, nbInputs), 0);
+        for(size_t j = 1; j < out->size2; j++) {
+            BASE value = fmax(row[j] + FUNCTION(gsl_matrix, get)(W, j, nbInputs), 0);
+            if(value > max) {
+                max = value;
+                best = j;
+            }
+        }
+        labels[r] = best;
+    }
+
+    return 0;
+}
+
+int NN_FUNCTION(trainStep)(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* X, const TYPE(gsl_matrix)* Y,
+    TYPE(gsl_matrix)** allW, double learningRate) {
+    if(!ws || !X || !Y || !allW || X->size1 == 0 || X->size1 > ws->batchSize || Y->size1 != X->size1) return -1;
+
+    size_t b = X->size1;
+    size_t nbLayers = ws->nbLayers;
+
+    // Forward propagation, one matrix-matrix product per layer
+    const TYPE(gsl_spmatrix)* sparse;
+    if(forwardInWorkspace(ws, X, (const TYPE(gsl_matrix)**) allW, 0, &sparse)) return -1;
+
+    // dL2/dx averaged over the batch
+    size_t current = 0;
+    VIEW(gsl_matrix, view) delta = FUNCTION(gsl_matrix, submatrix)(&ws->deltas[current].matrix, 0, 0, b, ws->dimensions[nbLayers]);
+    if(FUNCTION(gsl_matrix, memcpy)(&delta.matrix, &ws->activations[nbLayers - 1].matrix)
+        || FUNCTION(gsl_matrix, sub)(&delta.matrix, Y)) return -1;
+    FUNCTION(gsl_matrix, scale)(&delta.matrix, 2.0);
+
+    // Backpropagation, the weights are updated in place once the error has gone through them
+    double step = learningRate / (double) b;
+    for(size_t k = 0; k < nbLayers; k++) {
+        size_t i = nbLayers - 1 - k;
+        TYPE(gsl_matrix)* W = allW[i];
+        size_t nbInputs = W->size2 - 1;
+        const TYPE(gsl_matrix)* layerIn = i == 0 ? X : &ws->activations[i - 1].matrix;
+        VIEW(gsl_matrix, view) Wx = FUNCTION(gsl_matrix, submatrix)(W, 0, 0, W->size1, nbInputs);
+
+        VIEW(gsl_matrix, view) prev;
+        if(i > 0) {
+            prev = FUNCTION(gsl_matrix, submatrix)(&ws->deltas[1 - current].matrix, 0, 0, b, nbInputs);
+            if(layerGemm(ws, CblasNoTrans, CblasNoTrans, 1.0, &delta.matrix, &Wx.matrix, 0.0, &prev.matrix)) return -1;
+            // ReLU mask of the previous layer, its output is positive exactly where its input was
+            for(size_t s = 0; s < b; s++) {
+                BASE* row = FUNCTION(gsl_matrix, ptr)(&prev.matrix, s, 0);
+                const BASE* act = FUNCTION(gsl_matrix, const_ptr)(layerIn, s, 0);
+                for(size_t j = 0; j < nbInputs; j++) {
+                    if(!(act[j] > 0)) row[j] = 0.0;
+                }
+            }
+        }
+
+        if(i == 0 && sparse) sparseWeightProduct(-step, sparse, &delta.matrix, &Wx.matrix);
+        else if(layerGemm(ws, CblasTrans, CblasNoTrans, -step, &delta.matrix, layerIn, 1.0, &Wx.matrix)) return -1;
+        for(size_t s = 0; s < b; s++) {
+            const BASE* row = FUNCTION(gsl_matrix, const_ptr)(&delta.matrix, s, 0);
+            for(size_t j = 0; j < W->size1; j++) {
+                *FUNCTION(gsl_matrix, ptr)(W, j, nbInputs) -= step * row[j];
+            }
+        }
+
+        if(i > 0) {
+            current = 1 - current;
+            delta = prev;
+        }
+    }
+
+    return 0;
+}
+
+TYPE(gsl_matrix)** NN_FUNCTION(trainBatched)(TYPE(gsl_nn_workspace)* ws, const TYPE(gsl_matrix)* trainInput,
+    const TYPE(gsl_matrix)* trainOutput, int numEpoch, double learningRate, size_t batchSize) {
+    REQUIRE_NON_NULL(ws);
+    REQUIRE_NON_NULL(trainInput);
+    REQUIRE_NON_NULL(trainOutput);
+    if(batchSize == 0 || batchSize > ws->batchSize) return NULL;
+
+    TYPE(gsl_matrix)** allW = NN_FUNCTION(initNetwork)(ws->dimensions, ws->nbLayers + 1);
+    REQUIRE_NON_NULL(allW);
+
+    size_t nbSamples = trainInput->size1;
+
+    for(int e = 0; e < numEpoch; e++) {
+        for(size_t r = 0; r < nbSamples; r += batchSize) {
+            size_t b = nbSamples - r < batchSize ? nbSamples - r : batchSize;
+            VIEW(gsl_matrix, const_view) X = FUNCTION(gsl_matrix, const_submatrix)(trainInput, r, 0, b, trainInput->size2);
+            VIEW(gsl_matrix, const_view) Y = FUNCTION(gsl_matrix, const_submatrix)(trainOutput, r, 0, b, trainOutput->size2);
+
+            if(NN_FUNCTION(trainStep)(ws, &X.matrix, &Y.matrix, allW, learningRate)) {
+                NN_FUNCTION(destroyMatricesArray)(allW, ws->nbLayers);
+                return NULL;
+            }
+        }
+    }
+
+    return allW;
+}
@@ -0,0 +1,166 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gsl/gsl_matrix.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "MNISTLoader.h"
+
+// IDX magic number: two zero bytes, the element type and the number of dimensions
+#define IDX_UNSIGNED_BYTE 0x08
+
+// Pixels converted per iteration, the inner loop compiles to SIMD conversions
+#define PIXEL_CHUNK 16
+
+static uint32_t readBigEndian(const uint8_t* bytes) {
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+}
+
+IdxFile* openIdx(const char* path) {
+    REQUIRE_NON_NULL(path);
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat info;
+    if(fstat(fd, &info) || info.st_size < 4) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t mappingSize = info.st_size;
+    void* mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive
+    close(fd);
+    if(mapping == MAP_FAILED) return NULL;
+
+    const uint8_t* bytes = mapping;
+    size_t nbDimensions = bytes[3];
+    size_t headerSize = 4 + 4 * nbDimensions;
+    if(bytes[0] || bytes[1] || bytes[2] != IDX_UNSIGNED_BYTE || nbDimensions == 0 || mappingSize < headerSize) {
+        munmap(mapping, mappingSize);
+        return NULL;
+    }
+
+    size_t nbItems = readBigEndian(bytes + 4);
+    size_t itemSize = 1;
+    for(size_t i = 1; i < nbDimensions; i++) {
+        itemSize *= readBigEndian(bytes + 4 + 4 * i);
+    }
+    if(itemSize == 0 || (mappingSize - headerSize) / itemSize < nbItems) {
+        munmap(mapping, mappingSize);
+        return NULL;
+    }
+
+    IdxFile* file = nnCalloc(1, sizeof(IdxFile));
+    if(!file) {
+        munmap(mapping, mappingSize);
+        return NULL;
+    }
+
+    // Samples are read once, front to back
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+    file->mapping = mapping;
+    file->mappingSize = mappingSize;
+    file->data = bytes + headerSize;
+    file->nbItems = nbItems;
+    file->itemSize = itemSize;
+
+    return file;
+}
+
+void closeIdx(IdxFile* file) {
+    if(!file) return;
+
+    munmap(file->mapping, file->mappingSize);
+    free(file);
+}
+
+MNISTStream* openMNIST(const char* imagesPath, const char* labelsPath, size_t batchSize, double scale) {
+    IdxFile* images = openIdx(imagesPath);
+    IdxFile* labels = openIdx(labelsPath);
+    MNISTStream* stream = nnCalloc(1, sizeof(MNISTStream));
+    if(!images || !labels || !stream || labels->itemSize != 1 || labels->nbItems != images->nbItems || images->nbItems == 0) {
+        closeIdx(images);
+        closeIdx(labels);
+        free(stream);
+        return NULL;
+    }
+
+    if(batchSize == 0 || batchSize > images->nbItems) batchSize = images->nbItems;
+    stream->buffer = nnCalloc(batchSize * (images->itemSize + MNIST_NB_CLASSES), sizeof(double));
+    if(!stream->buffer) {
+        closeIdx(images);
+        closeIdx(labels);
+        free(stream);
+        return NULL;
+    }
+
+    stream->images = images;
+    stream->labels = labels;
+    stream->scale = scale;
+    stream->batchSize = batchSize;
+    stream->next = 0;
+
+    return stream;
+}
+
+void closeMNIST(MNISTStream* stream) {
+    if(!stream) return;
+
+    closeIdx(stream->images);
+    closeIdx(stream->labels);
+    free(stream->buffer);
+    free(stream);
+}
+
+size_t mnistSize(const MNISTStream* stream) {
+    return stream ? stream->images->nbItems : 0;
+}
+
+static void convertPixels(const uint8_t* restrict in, double* restrict out, size_t n, double scale) {
+    size_t i = 0;
+    for(; i + PIXEL_CHUNK <= n; i += PIXEL_CHUNK) {
+        for(size_t j = 0; j < PIXEL_CHUNK; j++) {
+            out[i + j] = scale * in[i + j];
+        }
+    }
+    for(; i < n; i++) {
+        out[i] = scale * in[i];
+    }
+}
+
+size_t nextMNISTBatch(MNISTStream* stream, gsl_matrix_view* X, gsl_matrix_view* Y) {
+    if(!stream || !X || !Y) return 0;
+
+    size_t remaining = stream->images->nbItems - stream->next;
+    size_t rows = remaining < stream->batchSize ? remaining : stream->batchSize;
+    if(rows == 0) return 0;
+
+    size_t nbFeatures = stream->images->itemSize;
+    double* pixels = stream->buffer;
+    double* oneHot = stream->buffer + stream->batchSize * nbFeatures;
+
+    // Rows are contiguous in the file, the whole batch is one run
+    convertPixels(stream->images->data + stream->next * nbFeatures, pixels, rows * nbFeatures, stream->scale);
+
+    memset(oneHot, 0, rows * MNIST_NB_CLASSES * sizeof(double));
+    const uint8_t* labels = stream->labels->data + stream->next;
+    for(size_t r = 0; r < rows; r++) {
+        if(labels[r] < MNIST_NB_CLASSES) oneHot[r * MNIST_NB_CLASSES + labels[r]] = 1.0;
+    }
+
+    *X = gsl_matrix_view_array(pixels, rows, nbFeatures);
+    *Y = gsl_matrix_view_array(oneHot, rows, MNIST_NB_CLASSES);
+    stream->next += rows;
+
+    return rows;
+}
+
+void rewindMNIST(MNISTStream* stream) {
+    if(stream) stream->next = 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gsl/gsl_matrix.h>
+
+#define MNIST_NB_CLASSES 10
+
+// Read-only mapping of an IDX file of unsigned bytes, items are the slices along the first dimension
+typedef struct {
+    void* mapping;
+    size_t mappingSize;
+    const uint8_t* data;
+    size_t nbItems;
+    size_t itemSize;
+} IdxFile;
+
+typedef struct {
+    IdxFile* images;
+    IdxFile* labels;
+    double scale;
+    size_t batchSize;
+    size_t next;
+    // batchSize rows of pixels followed by batchSize rows of one-hot labels
+    double* buffer;
+} MNISTStream;
+
+/**
+ * @brief Maps an IDX file whose elements are unsigned bytes
+ *
+ * @param path
+ *
+ * @return IdxFile*, NULL if the file cannot be mapped or is not an unsigned byte IDX file
+ */
+IdxFile* openIdx(const char* path);
+
+/**
+ * @brief Unmaps an IDX file
+ *
+ * @param file
+ */
+void closeIdx(IdxFile* file);
+
+/**
+ * @brief Opens an MNIST images and labels pair, samples are then read in batches without loading the files
+ *
+ * @param imagesPath e.g. train-images.idx3-ubyte
+ * @param labelsPath e.g. train-labels.idx1-ubyte
+ * @param batchSize Maximum number of rows returned by nextMNISTBatch, 0 for the whole file in one batch
+ * @param scale Applied to every pixel, 1.0 keeps the raw 0-255 values like the Java loader
+ *
+ * @return MNISTStream*
+ */
+MNISTStream* openMNIST(const char* imagesPath, const char* labelsPath, size_t batchSize, double scale);
+
+/**
+ * @brief Closes the stream and unmaps its files
+ *
+ * @param stream
+ */
+void closeMNIST(MNISTStream* stream);
+
+/**
+ * @brief Number of samples in the stream
+ *
+ * @param stream
+ *
+ * @return size_t
+ */
+size_t mnistSize(const MNISTStream* stream);
+
+/**
+ * @brief Converts the next batch of samples and views it
+ *
+ * The views point in the stream buffer and stay valid until the next call
+ *
+ * @param stream
+ * @param X Receives a view of the pixels (rows x 784)
+ * @param Y Receives a view of the one-hot labels (rows x MNIST_NB_CLASSES)
+ *
+ * @return The number of rows, 0 once every sample has been read
+ */
+size_t nextMNISTBatch(MNISTStream* stream, gsl_matrix_view* X, gsl_matrix_view* Y);
+
+/**
+ * @brief Starts the stream over from the first sample
+ *
+ * @param stream
+ */
+void rewindMNIST(MNISTStream* stream);
@@ -3,12 +3,13 @@
 #include <math.h>
 #include "Random.h"
 #include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
 
 gsl_matrix* relu(const gsl_matrix* m) {
     REQUIRE_NON_NULL(m);
     IS_VECTOR(m);
 
-    gsl_matrix* out = gsl_matrix_calloc(m->size1, m->size2);
+    gsl_matrix* out = nnMatrixCalloc(m->size1, m->size2);
     if(!out) return NULL;
 
     for(size_t i = 0; i < m->size1; i++) {
@@ -25,7 +26,7 @@ gsl_matrix* identity(const gsl_matrix* m) {
     REQUIRE_NON_NULL(m);
     IS_VECTOR(m);
 
-    gsl_matrix* out = gsl_matrix_calloc(m->size1, m->size2);
+    gsl_matrix* out = nnMatrixCalloc(m->size1, m->size2);
     if(!out) return NULL;
 
     if(gsl_matrix_memcpy(out, m)) {
@@ -41,7 +42,7 @@ gsl_matrix* dIdentityDx(const gsl_matrix* x) {
     IS_VECTOR(x);
 
     size_t nbElements = x->size1 * x->size2;
-    gsl_matrix* out = gsl_matrix_calloc(nbElements, nbElements);
+    gsl_matrix* out = nnMatrixCalloc(nbElements, nbElements);
     if(!out) return NULL;
 
     gsl_matrix_set_identity(out);
@@ -53,7 +54,7 @@ gsl_matrix* reshape(const gsl_matrix* m, size_t rows, size_t cols) {
     REQUIRE_NON_NULL(m);
     if(rows * cols != m->size1 * m->size2) return NULL;
 
-    gsl_matrix* out = gsl_matrix_calloc(rows, cols);
+    gsl_matrix* out = nnMatrixCalloc(rows, cols);
     if(!out) return NULL;
 
 
@@ -75,7 +76,7 @@ gsl_matrix* dL2Dx(const gsl_matrix* x, const gsl_matrix* y) {
     IS_VECTOR(x);
     IS_VECTOR(y);
 
-    gsl_matrix* out = gsl_matrix_calloc(x->size1, x->size2);
+    gsl_matrix* out = nnMatrixCalloc(x->size1, x->size2);
     if(!out) return NULL;
 
     if(gsl_matrix_memcpy(out, x)) {
@@ -100,7 +101,7 @@ gsl_matrix* affine(const gsl_matrix* x, const gsl_matrix* W) {
     IS_VECTOR(x);
 
     size_t nbElements = x->size1 * x->size2;
-    gsl_matrix* extendedX = gsl_matrix_calloc(nbElements + 1, 1);
+    gsl_matrix* extendedX = nnMatrixCalloc(nbElements + 1, 1);
     if(!extendedX) return NULL;
 
     for(size_t i = 0; i < nbElements; i++) {
@@ -112,7 +113,7 @@ gsl_matrix* affine(const gsl_matrix* x, const gsl_matrix* W) {
     }
     gsl_matrix_set(extendedX, nbElements, 0, 1.0);
     
-    gsl_matrix* out = gsl_matrix_calloc(W->size1, extendedX->size2);
+    gsl_matrix* out = nnMatrixCalloc(W->size1, extendedX->size2);
     if(!out) {
         gsl_matrix_free(extendedX);
         return NULL;
@@ -128,14 +129,32 @@ gsl_matrix* affine(const gsl_matrix* x, const gsl_matrix* W) {
     return out;
 }
 
+static int layerGemm(const gsl_nn_workspace* ws, CBLAS_TRANSPOSE_t TransA, CBLAS_TRANSPOSE_t TransB, double alpha,
+    const gsl_matrix* A, const gsl_matrix* B, double beta, gsl_matrix* C) {
+    // Only the float instantiation reads the workspace, for its mixed setting
+    (void) ws;
+    return gsl_blas_dgemm(TransA, TransB, alpha, A, B, beta, C);
+}
+
+#define BASE_DOUBLE
+#include "NNTemplatesOn.h"
+#include "LayerSource.h"
+#include "NNTemplatesOff.h"
+#undef BASE_DOUBLE
+
+// A vector with contiguous storage, either orientation, seen as a single sample
+static gsl_matrix_view sampleRow(gsl_matrix* v) {
+    return gsl_matrix_view_array(v->data, 1, v->size1 * v->size2);
+}
+
 gsl_matrix* initMatrix(size_t rows, size_t cols) {
-    gsl_matrix* out = gsl_matrix_calloc(rows, cols + 1);
+    gsl_matrix* out = nnMatrixCalloc(rows, cols + 1);
     if(!out) return NULL;
 
     Random r = initSeed(0);
     double l = sqrt(3.0 / (double) cols);
 
-    gsl_vector* zeros = gsl_vector_calloc(rows);
+    gsl_vector* zeros = nnVectorCalloc(rows);
     if(!zeros) {
         gsl_vector_free(zeros);
         return NULL;
@@ -161,7 +180,7 @@ gsl_matrix** initNetwork(const int* dimensions, size_t nbDimensions) {
     REQUIRE_NON_NULL(dimensions);
     if(nbDimensions <= 1) return NULL;
 
-    gsl_matrix** out = calloc(nbDimensions - 1, sizeof(gsl_matrix*));
+    gsl_matrix** out = nnCalloc(nbDimensions - 1, sizeof(gsl_matrix*));
     for(size_t i = 0; i < nbDimensions - 1; i++) {
         int Wi = dimensions[i];
         int Wip1 = dimensions[i + 1];
@@ -193,7 +212,7 @@ gsl_matrix* dReluDx(const gsl_matrix* x) {
     IS_VECTOR(x);
 
     size_t nbElements = x->size1 * x->size2;
-    gsl_matrix* out = gsl_matrix_calloc(nbElements, nbElements);
+    gsl_matrix* out = nnMatrixCalloc(nbElements, nbElements);
     if(!out) return NULL;
 
     for(size_t i = 0; i < nbElements; i++) {
@@ -212,7 +231,7 @@ gsl_matrix* dReluDx(const gsl_matrix* x) {
 gsl_matrix* dAffineDx(const gsl_matrix* W) {
     REQUIRE_NON_NULL(W);
 
-    gsl_matrix* out = gsl_matrix_calloc(W->size1, W->size2 - 1);
+    gsl_matrix* out = nnMatrixCalloc(W->size1, W->size2 - 1);
     gsl_matrix_const_view subMatrix = gsl_matrix_const_submatrix(W, 0, 0, W->size1, W->size2 - 1);
     if(gsl_matrix_memcpy(out, &subMatrix.matrix)) {
         gsl_matrix_free(out);
@@ -228,7 +247,7 @@ gsl_matrix* dAffineDw(const gsl_matrix* x, const gsl_matrix* W) {
     IS_VECTOR(x);
 
     size_t nbElements = x->size1 * x->size2;
-    gsl_matrix* out = gsl_matrix_calloc(W->size1, W->size1 * (nbElements + 1));
+    gsl_matrix* out = nnMatrixCalloc(W->size1, W->size1 * (nbElements + 1));
     if(!out) return NULL;
 
     for(size_t i = 0; i < W->size1; i++) {
@@ -254,9 +273,9 @@ gsl_matrix** backpropagation(gsl_matrix* x, gsl_matrix* y, gsl_matrix** allW, si
     IS_VECTOR(x);
     IS_VECTOR(y);
 
-    gsl_matrix** inputs = calloc(nbLayers, sizeof(gsl_matrix*));
-    gsl_matrix** combinations = calloc(nbLayers, sizeof(gsl_matrix*));
-    gsl_matrix* temp = gsl_matrix_calloc(x->size1, x->size2);
+    gsl_matrix** inputs = nnCalloc(nbLayers, sizeof(gsl_matrix*));
+    gsl_matrix** combinations = nnCalloc(nbLayers, sizeof(gsl_matrix*));
+    gsl_matrix* temp = nnMatrixCalloc(x->size1, x->size2);
     if(!inputs || !combinations || !temp || gsl_matrix_memcpy(temp, x)) {
         free(inputs);
         free(combinations);
@@ -264,19 +283,34 @@ gsl_matrix** backpropagation(gsl_matrix* x, gsl_matrix* y, gsl_matrix** allW, si
         return NULL;
     }
 
-    // Forward propagation 
+    // Forward propagation, every layer writes its combination and output as columns
     x = temp;
     for(size_t i = 0; i < nbLayers; i++) {
         inputs[i] = x;
-        gsl_matrix* comb = affine(x, allW[i]);
-        combinations[i] = comb;
-        x = i == nbLayers - 1 ? identity(comb) : relu(comb);
+        combinations[i] = nnMatrixAlloc(allW[i]->size1, 1);
+        x = nnMatrixAlloc(allW[i]->size1, 1);
+        if(!combinations[i] || !x) {
+            if(x) gsl_matrix_free(x);
+            destroyMatricesArray(inputs, nbLayers);
+            destroyMatricesArray(combinations, nbLayers);
+            return NULL;
+        }
+
+        gsl_matrix_view in = sampleRow(inputs[i]);
+        gsl_matrix_view comb = sampleRow(combinations[i]);
+        gsl_matrix_view act = sampleRow(x);
+        if(affineLayer(&in.matrix, allW[i], &comb.matrix, &act.matrix, i != nbLayers - 1)) {
+            gsl_matrix_free(x);
+            destroyMatricesArray(inputs, nbLayers);
+            destroyMatricesArray(combinations, nbLayers);
+            return NULL;
+        }
     }
     gsl_matrix* currJac = dL2Dx(x, y);
     gsl_matrix_free(x);
 
     // Backpropagation
-    gsl_matrix** out = calloc(nbLayers, sizeof(gsl_matrix*));
+    gsl_matrix** out = nnCalloc(nbLayers, sizeof(gsl_matrix*));
     if(!out) {
         destroyMatricesArray(inputs, nbLayers);
         destroyMatricesArray(combinations, nbLayers);
@@ -289,7 +323,7 @@ gsl_matrix** backpropagation(gsl_matrix* x, gsl_matrix* y, gsl_matrix** allW, si
         gsl_matrix* W = allW[i];
 
         gsl_matrix* multiplier = nbLayers - 1 ? dIdentityDx(comb) : dReluDx(comb);
-        gsl_matrix* newJac = gsl_matrix_calloc(currJac->size1, multiplier->size2);
+        gsl_matrix* newJac = nnMatrixCalloc(currJac->size1, multiplier->size2);
 
         if(gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, currJac, multiplier, 0.0, newJac)) {
             gsl_matrix_free(multiplier);
@@ -305,7 +339,7 @@ gsl_matrix** backpropagation(gsl_matrix* x, gsl_matrix* y, gsl_matrix** allW, si
         currJac = newJac;
 
         multiplier = dAffineDw(inputs[i], W);
-        gsl_matrix* Jw = gsl_matrix_calloc(currJac->size1, multiplier->size2);
+        gsl_matrix* Jw = nnMatrixCalloc(currJac->size1, multiplier->size2);
         if(gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, currJac, multiplier, 0.0, Jw)) {
             gsl_matrix_free(multiplier);
             gsl_matrix_free(Jw);
@@ -327,7 +361,7 @@ gsl_matrix** backpropagation(gsl_matrix* x, gsl_matrix* y, gsl_matrix** allW, si
         out[i] = reshaped;
 
         multiplier = dAffineDx(W);
-        newJac = gsl_matrix_calloc(currJac->size1, multiplier->size2);
+        newJac = nnMatrixCalloc(currJac->size1, multiplier->size2);
         if(gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, currJac, multiplier, 0.0, newJac)) {
             gsl_matrix_free(multiplier);
             gsl_matrix_free(newJac);
@@ -348,114 +382,161 @@ gsl_matrix** backpropagation(gsl_matrix* x, gsl_matrix* y, gsl_matrix** allW, si
     return out;
 }
 
-gsl_matrix** train(gsl_matrix* trainInput, gsl_matrix* trainOutput, int* dimensions, size_t nbDimensions, int numEpoch, double learningRate) {
+static void reluMask(gsl_vector* delta, const gsl_matrix* comb) {
+    gsl_vector_const_view vComb = gsl_matrix_const_row(comb, 0);
+    for(size_t k = 0; k < delta->size; k++) {
+        if(!(gsl_vector_get(&vComb.vector, k) > 0)) gsl_vector_set(delta, k, 0.0);
+    }
+}
+
+// Gradients of one sample, x and y single rows, left in ws->gradients
+static int backpropagationVJP(gsl_nn_workspace* ws, const gsl_matrix* x, const gsl_matrix* y, const gsl_matrix** allW) {
+    if(!ws || !x || !y || !allW || x->size1 != 1 || y->size1 != 1) return -1;
+
+    // Forward propagation, identical to backpropagation(): the sparse path, which sums in another order, is not taken
+    if(forwardInWorkspace(ws, x, allW, 0, NULL)) return -1;
+
+    // dL2/dx kept as a vector instead of a 1 x n Jacobian
+    size_t nbLayers = ws->nbLayers;
+    const gsl_matrix* out = &ws->activations[nbLayers - 1].matrix;
+    size_t current = 0;
+    gsl_vector_view delta = gsl_matrix_subrow(&ws->deltas[current].matrix, 0, 0, out->size2);
+    for(size_t k = 0; k < out->size2; k++) {
+        gsl_vector_set(&delta.vector, k, (gsl_matrix_get(out, 0, k) - gsl_matrix_get(y, 0, k)) * 2.0);
+    }
+
+    // Backpropagation, the diagonal and block Jacobians of backpropagation() are never built:
+    // the activation becomes an elementwise mask, dW an outer product and dx a transposed product
+    for(size_t r = 0; r < nbLayers; r++) {
+        // Go in reverse order
+        size_t i = nbLayers - 1 - r;
+
+        const gsl_matrix* W = allW[i];
+        size_t nbInputs = W->size2 - 1;
+
+        // Same activation choice as backpropagation() so that gradients stay bit-identical
+        if(nbLayers == 1) reluMask(&delta.vector, &ws->combinations[i].matrix);
+
+        gsl_matrix* Jw = &ws->gradients[i].matrix;
+        const double* input = gsl_matrix_const_ptr(i == 0 ? x : &ws->activations[i - 1].matrix, 0, 0);
+        for(size_t k = 0; k < W->size1; k++) {
+            double d = gsl_vector_get(&delta.vector, k);
+            double* row = gsl_matrix_ptr(Jw, k, 0);
+            for(size_t j = 0; j < nbInputs; j++) {
+                row[j] = input[j] * d;
+            }
+            row[nbInputs] = d;
+        }
+
+        // The input Jacobian of the first layer is never used
+        if(i == 0) break;
+
+        current = 1 - current;
+        gsl_vector_view newDelta = gsl_matrix_subrow(&ws->deltas[current].matrix, 0, 0, nbInputs);
+        gsl_matrix_const_view Wx = gsl_matrix_const_submatrix(W, 0, 0, W->size1, nbInputs);
+        if(gsl_blas_dgemv(CblasTrans, 1.0, &Wx.matrix, &delta.vector, 0.0, &newDelta.vector)) return -1;
+        delta = newDelta;
+    }
+
+    return 0;
+}
+
+gsl_matrix** train(gsl_nn_workspace* ws, const gsl_matrix* trainInput, const gsl_matrix* trainOutput, int numEpoch, double learningRate) {
+    REQUIRE_NON_NULL(ws);
     REQUIRE_NON_NULL(trainInput);
     REQUIRE_NON_NULL(trainOutput);
-    REQUIRE_NON_NULL(dimensions);
     
-    gsl_matrix** allW = initNetwork(dimensions, nbDimensions);
+    gsl_matrix** allW = initNetwork(ws->dimensions, ws->nbLayers + 1);
+    REQUIRE_NON_NULL(allW);
+
     size_t nbSamples = trainInput->size1;
-    size_t nbLayers = nbDimensions - 1;
+    size_t nbLayers = ws->nbLayers;
     // Loop over all epochs
     for(size_t i = 0; i < numEpoch; i++) {
         // Loop over all samples
         for(size_t r = 0; r < nbSamples; r++) {
-            gsl_matrix inRow = gsl_matrix_const_submatrix(trainInput, r, 0, 1, trainInput->size2).matrix;
-            gsl_matrix outRow = gsl_matrix_const_submatrix(trainOutput, r, 0, 1, trainOutput->size2).matrix;
-            
-            gsl_matrix* tInRow = gsl_matrix_calloc(inRow.size2, inRow.size1);
-            gsl_matrix* tOutRow = gsl_matrix_calloc(outRow.size2, outRow.size1);
-            if(!tInRow || !tOutRow || gsl_matrix_transpose_memcpy(tInRow, &inRow) || gsl_matrix_transpose_memcpy(tOutRow, &outRow)) {
-                if(tInRow) gsl_matrix_free(tInRow);
-                if(tOutRow) gsl_matrix_free(tOutRow);
+            gsl_matrix_const_view inRow = gsl_matrix_const_submatrix(trainInput, r, 0, 1, trainInput->size2);
+            gsl_matrix_const_view outRow = gsl_matrix_const_submatrix(trainOutput, r, 0, 1, trainOutput->size2);
+
+            if(backpropagationVJP(ws, &inRow.matrix, &outRow.matrix, (const gsl_matrix**) allW)) {
                 destroyMatricesArray(allW, nbLayers);
                 return NULL;
             }
-            
-            gsl_matrix** jacs = backpropagation(tInRow, tOutRow, allW, nbLayers);
-            gsl_matrix_free(tInRow);
-            gsl_matrix_free(tOutRow);
 
-            // Update weights
+            // Update weights, w -= lr * jac in a single pass
             for(size_t j = 0; j < nbLayers; j++) {
-                gsl_matrix* jac = jacs[j];
-
-                if(gsl_matrix_scale(jac, learningRate) || gsl_matrix_sub(allW[j], jac)) {
-                    destroyMatricesArray(allW, nbLayers);
-                    destroyMatricesArray(jacs, nbLayers);
-                    return NULL;
+                const gsl_matrix* jac = &ws->gradients[j].matrix;
+                for(size_t k = 0; k < jac->size1; k++) {
+                    double* w = gsl_matrix_ptr(allW[j], k, 0);
+                    const double* g = gsl_matrix_const_ptr(jac, k, 0);
+                    for(size_t l = 0; l < jac->size2; l++) {
+                        w[l] -= learningRate * g[l];
+                    }
                 }
             }
-            destroyMatricesArray(jacs, nbLayers);
         }
     }
 
     return allW;
 }
 
-double sum(const gsl_matrix* m) {
-    double total = 0.0;
-
-    for(size_t i = 0; i < m->size1; i++) {
-        for(size_t j = 0; j < m->size2; j++) {
-            total += gsl_matrix_get(m, i, j);
+int batchGradient(gsl_nn_workspace* ws, const gsl_matrix* X, const gsl_matrix* Y, const gsl_matrix** allW, gsl_matrix** gradients) {
+    if(!ws || !X || !Y || !allW || !gradients || X->size1 == 0 || X->size1 > ws->batchSize || Y->size1 != X->size1) return -1;
+
+    size_t b = X->size1;
+    size_t nbLayers = ws->nbLayers;
+
+    // Same forward pass and error as trainStep()
+    const gsl_spmatrix* sparse;
+    if(forwardInWorkspace(ws, X, allW, 0, &sparse)) return -1;
+
+    size_t current = 0;
+    gsl_matrix_view delta = gsl_matrix_submatrix(&ws->deltas[current].matrix, 0, 0, b, ws->dimensions[nbLayers]);
+    if(gsl_matrix_memcpy(&delta.matrix, &ws->activations[nbLayers - 1].matrix) || gsl_matrix_sub(&delta.matrix, Y)) return -1;
+    gsl_matrix_scale(&delta.matrix, 2.0);
+
+    for(size_t k = 0; k < nbLayers; k++) {
+        size_t i = nbLayers - 1 - k;
+        const gsl_matrix* W = allW[i];
+        gsl_matrix* G = gradients[i];
+        size_t nbInputs = W->size2 - 1;
+        const gsl_matrix* layerIn = i == 0 ? X : &ws->activations[i - 1].matrix;
+        gsl_matrix_const_view Wx = gsl_matrix_const_submatrix(W, 0, 0, W->size1, nbInputs);
+        gsl_matrix_view Gx = gsl_matrix_submatrix(G, 0, 0, G->size1, nbInputs);
+
+        gsl_matrix_view prev;
+        if(i > 0) {
+            prev = gsl_matrix_submatrix(&ws->deltas[1 - current].matrix, 0, 0, b, nbInputs);
+            if(gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &delta.matrix, &Wx.matrix, 0.0, &prev.matrix)) return -1;
+            for(size_t s = 0; s < b; s++) {
+                double* row = gsl_matrix_ptr(&prev.matrix, s, 0);
+                const double* act = gsl_matrix_const_ptr(layerIn, s, 0);
+                for(size_t j = 0; j < nbInputs; j++) {
+                    if(!(act[j] > 0)) row[j] = 0.0;
+                }
+            }
         }
-    }
-
-    return total;
-}
 
-void elementPowerTwo(gsl_matrix* m) {
-    for(size_t i = 0; i < m->size1; i++) {
-        for(size_t j = 0; j < m->size2; j++) {
-            double old = gsl_matrix_get(m, i, j);
-            gsl_matrix_set(m, i, j, old * old);
+        if(i == 0 && sparse) {
+            gsl_matrix_set_zero(&Gx.matrix);
+            sparseWeightProduct(1.0, sparse, &delta.matrix, &Gx.matrix);
+        }
+        else if(gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &delta.matrix, layerIn, 0.0, &Gx.matrix)) return -1;
+        for(size_t j = 0; j < G->size1; j++) {
+            double bias = 0.0;
+            for(size_t s = 0; s < b; s++) {
+                bias += gsl_matrix_get(&delta.matrix, s, j);
+            }
+            gsl_matrix_set(G, j, nbInputs, bias);
         }
-    }
-}
-
-gsl_matrix* normalize(const gsl_matrix* m) {
-    REQUIRE_NON_NULL(m);
-
-    gsl_matrix* out = gsl_matrix_calloc(m->size1, m->size2);
-    if(!out) return NULL;
-
-    if(gsl_matrix_memcpy(out, m)) {
-        gsl_matrix_free(out);
-        return NULL;
-    }
-
-    size_t nbElements = m->size1 * m->size2;
-    double totalMean = sum(m) / nbElements;
-
-    if(gsl_matrix_add_constant(out, -totalMean)) {
-        gsl_matrix_free(out);
-        return NULL;
-    }
-
-    elementPowerTwo(out);
-    double totalStd = sqrt(sum(out) / nbElements);
-
-    if(gsl_matrix_memcpy(out, m)) {
-        gsl_matrix_free(out);
-        return NULL;
-    }
-
-    if(gsl_matrix_add_constant(out, -totalMean)) {
-        gsl_matrix_free(out);
-        return NULL;
-    }
-
-    if(totalStd == 0) {
-        return out;
-    }
 
-    if(gsl_matrix_scale(out, 1.0 / totalStd)) {
-        gsl_matrix_free(out);
-        return NULL;
+        if(i > 0) {
+            current = 1 - current;
+            delta = prev;
+        }
     }
 
-    return out;
+    return 0;
 }
 
 gsl_matrix* nn(const gsl_matrix* x, const gsl_matrix** allW, size_t nbW) {
@@ -463,27 +544,40 @@ gsl_matrix* nn(const gsl_matrix* x, const gsl_matrix** allW, size_t nbW) {
     REQUIRE_NON_NULL(allW);
     IS_VECTOR(x);
     
-    gsl_matrix* out = gsl_matrix_calloc(x->size1, x->size2);
-    if(!out) return NULL;
+    if(nbW == 0) return NULL;
 
-    if(gsl_matrix_memcpy(out, x)) {
-        gsl_matrix_free(out);
-        return NULL;
-    }
-    
+    size_t nbInputs = x->size1 * x->size2;
+    size_t maxDimension = nbInputs;
     for(size_t i = 0; i < nbW; i++) {
-        gsl_matrix* affined = affine(out, allW[i]);
-        gsl_matrix* next = relu(affined);
+        if(allW[i]->size1 > maxDimension) maxDimension = allW[i]->size1;
+    }
 
-        gsl_matrix_free(out);
-        gsl_matrix_free(affined);
+    // Two ping-pong rows for the layers, the last one writes straight into out
+    double* buffer = nnCalloc(2 * maxDimension, sizeof(double));
+    if(!buffer) return NULL;
+    size_t outputs = allW[nbW - 1]->size1;
+    gsl_matrix* out = x->size1 == 1 ? nnMatrixAlloc(1, outputs) : nnMatrixAlloc(outputs, 1);
+    if(!out) {
+        free(buffer);
+        return NULL;
+    }
 
-        out = next;
+    gsl_matrix_view in = gsl_matrix_view_array(buffer, 1, nbInputs);
+    for(size_t k = 0; k < nbInputs; k++) {
+        buffer[k] = x->size1 == 1 ? gsl_matrix_get(x, 0, k) : gsl_matrix_get(x, k, 0);
     }
 
-    gsl_matrix* identitied = identity(out);
-    gsl_matrix_free(out);
-    out = identitied;
+    for(size_t i = 0; i < nbW; i++) {
+        gsl_matrix_view next = i == nbW - 1 ? sampleRow(out) 
+                                : gsl_matrix_view_array(buffer + (i % 2 == 0) * maxDimension, 1, allW[i]->size1);
+        if(affineLayer(&in.matrix, allW[i], &next.matrix, &next.matrix, 1)) {
+            free(buffer);
+            gsl_matrix_free(out);
+            return NULL;
+        }
+        in = next;
+    }
 
+    free(buffer);
     return out;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <gsl/gsl_matrix.h>
+#include "NNWorkspace.h"
 
 #define IS_VECTOR(m) \
     if((m)->size1 != 1 && (m)->size2 != 1) \
@@ -10,7 +11,14 @@
     if(e == NULL) \
         return NULL \
 
-gsl_matrix* normalize(const gsl_matrix* m);
+int affineLayer(const gsl_matrix* in, const gsl_matrix* W, gsl_matrix* comb, gsl_matrix* act, int applyRelu);
+gsl_matrix** initNetwork(const int* dimensions, size_t nbDimensions);
 void destroyMatricesArray(gsl_matrix** array, size_t nbElements);
 gsl_matrix* nn(const gsl_matrix* x, const gsl_matrix** allW, size_t nbW);
-gsl_matrix** train(gsl_matrix* trainInput, gsl_matrix* trainOutput, int* dimensions, size_t nbDimensions, int numEpoch, double learningRate);
\ No newline at end of file
+const gsl_matrix* nnInWorkspace(gsl_nn_workspace* ws, const gsl_matrix* x, const gsl_matrix** allW);
+int predictInWorkspace(gsl_nn_workspace* ws, const gsl_matrix* x, const gsl_matrix** allW, size_t* labels);
+gsl_matrix** train(gsl_nn_workspace* ws, const gsl_matrix* trainInput, const gsl_matrix* trainOutput, int numEpoch, double learningRate);
+int trainStep(gsl_nn_workspace* ws, const gsl_matrix* X, const gsl_matrix* Y, gsl_matrix** allW, double learningRate);
+int batchGradient(gsl_nn_workspace* ws, const gsl_matrix* X, const gsl_matrix* Y, const gsl_matrix** allW, gsl_matrix** gradients);
+gsl_matrix** trainBatched(gsl_nn_workspace* ws, const gsl_matrix* trainInput, const gsl_matrix* trainOutput, 
+    int numEpoch, double learningRate, size_t batchSize);
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gsl/gsl_matrix.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "ModelCheckpoint.h"
+
+static size_t alignModel(size_t offset) {
+    return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
+
+// Fills offsets with the start of every weight block and returns the size of the file
+static size_t modelLayout(const int* dimensions, size_t nbDimensions, size_t* offsets) {
+    size_t offset = alignModel(sizeof(ModelHeader) + nbDimensions * sizeof(uint32_t));
+    for(size_t i = 0; i + 1 < nbDimensions; i++) {
+        offsets[i] = offset;
+        offset = alignModel(offset + (size_t) dimensions[i + 1] * (dimensions[i] + 1) * sizeof(double));
+    }
+    return offset;
+}
+
+static int writePadding(FILE* file, size_t count) {
+    static const char zeros[MODEL_ALIGNMENT] = { 0 };
+    return count && fwrite(zeros, 1, count, file) != count ? -1 : 0;
+}
+
+int writeModel(const char* path, const gsl_matrix** allW, const int* dimensions, size_t nbDimensions) {
+    if(!path || !allW || !dimensions || nbDimensions < 2) return -1;
+
+    size_t nbLayers = nbDimensions - 1;
+    for(size_t i = 0; i < nbLayers; i++) {
+        if(!allW[i] || allW[i]->size1 != (size_t) dimensions[i + 1] || allW[i]->size2 != (size_t) dimensions[i] + 1) return -1;
+    }
+
+    size_t* offsets = nnCalloc(nbLayers, sizeof(size_t));
+    if(!offsets) return -1;
+    size_t fileSize = modelLayout(dimensions, nbDimensions, offsets);
+
+    // Written beside path and renamed over it, a mapping of the previous checkpoint keeps reading the old file
+    char* temporary = nnCalloc(strlen(path) + sizeof(".tmp"), 1);
+    FILE* file = temporary ? fopen(strcat(strcpy(temporary, path), ".tmp"), "wb") : NULL;
+    if(!file) {
+        free(temporary);
+        free(offsets);
+        return -1;
+    }
+
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.byteOrder = MODEL_BYTE_ORDER;
+    header.nbDimensions = nbDimensions;
+    header.elementSize = sizeof(double);
+    header.fileSize = fileSize;
+
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    size_t written = sizeof(header);
+    for(size_t i = 0; !failed && i < nbDimensions; i++) {
+        uint32_t dimension = dimensions[i];
+        failed = fwrite(&dimension, sizeof(dimension), 1, file) != 1;
+        written += sizeof(dimension);
+    }
+
+    for(size_t i = 0; !failed && i < nbLayers; i++) {
+        failed = writePadding(file, offsets[i] - written);
+        written = offsets[i];
+        // Row by row, the matrix may be a view with a larger stride
+        for(size_t r = 0; !failed && r < allW[i]->size1; r++) {
+            failed = fwrite(gsl_matrix_const_ptr(allW[i], r, 0), sizeof(double), allW[i]->size2, file) != allW[i]->size2;
+            written += allW[i]->size2 * sizeof(double);
+        }
+    }
+    if(!failed) failed = writePadding(file, fileSize - written);
+
+    failed |= fclose(file) != 0;
+    failed = failed || rename(temporary, path) != 0;
+    if(failed) remove(temporary);
+    free(temporary);
+    free(offsets);
+
+    return failed ? -1 : 0;
+}
+
+gsl_matrix** mapModel(const char* path, const int* dimensions, size_t nbDimensions, void** mapping, size_t* mappingSize) {
+    REQUIRE_NON_NULL(path);
+    REQUIRE_NON_NULL(dimensions);
+    REQUIRE_NON_NULL(mapping);
+    REQUIRE_NON_NULL(mappingSize);
+    if(nbDimensions < 2) return NULL;
+
+    size_t nbLayers = nbDimensions - 1;
+    size_t* offsets = nnCalloc(nbLayers, sizeof(size_t));
+    REQUIRE_NON_NULL(offsets);
+    size_t fileSize = modelLayout(dimensions, nbDimensions, offsets);
+
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) || (size_t) info.st_size != fileSize) {
+        if(fd >= 0) close(fd);
+        free(offsets);
+        return NULL;
+    }
+
+    // Private and writable so that training can go on from the loaded weights without touching the file
+    void* data = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        free(offsets);
+        return NULL;
+    }
+
+    const ModelHeader* header = data;
+    const uint32_t* fileDimensions = (const uint32_t*) (header + 1);
+    int valid = !memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) && header->version == MODEL_VERSION
+        && header->byteOrder == MODEL_BYTE_ORDER && header->elementSize == sizeof(double)
+        && header->nbDimensions == nbDimensions && header->fileSize == fileSize;
+    for(size_t i = 0; valid && i < nbDimensions; i++) {
+        valid = fileDimensions[i] == (uint32_t) dimensions[i];
+    }
+
+    gsl_matrix** allW = valid ? nnCalloc(nbLayers, sizeof(gsl_matrix*)) : NULL;
+    for(size_t i = 0; allW && i < nbLayers; i++) {
+        // A bare matrix struct without a block, gsl_matrix_free only releases the struct
+        allW[i] = nnCalloc(1, sizeof(gsl_matrix));
+        if(!allW[i]) {
+            destroyMatricesArray(allW, nbLayers);
+            allW = NULL;
+            break;
+        }
+        allW[i]->size1 = dimensions[i + 1];
+        allW[i]->size2 = dimensions[i] + 1;
+        allW[i]->tda = allW[i]->size2;
+        allW[i]->data = (double*) ((char*) data + offsets[i]);
+        allW[i]->block = NULL;
+        allW[i]->owner = 0;
+    }
+
+    free(offsets);
+    if(!allW) {
+        munmap(data, fileSize);
+        return NULL;
+    }
+
+    *mapping = data;
+    *mappingSize = fileSize;
+    return allW;
+}
+
+void unmapModel(void* mapping, size_t mappingSize) {
+    if(mapping) munmap(mapping, mappingSize);
+}
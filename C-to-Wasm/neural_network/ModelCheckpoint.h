@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <gsl/gsl_matrix.h>
+
+/*
+ * Checkpoint layout, in host byte order:
+ *   ModelHeader
+ *   uint32_t dimensions[nbDimensions]
+ *   one block per layer, each starting on a MODEL_ALIGNMENT boundary, holding the rows of W (dimensions[i + 1] x
+ *   dimensions[i] + 1, bias last) one after the other
+ */
+#define MODEL_MAGIC "GSLNNMDL"
+#define MODEL_VERSION 1
+#define MODEL_ALIGNMENT 64
+// Written as is, reads back differently on a host of the other endianness
+#define MODEL_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nbDimensions;
+    uint32_t elementSize;
+    uint64_t fileSize;
+} ModelHeader;
+
+/**
+ * @brief Writes the weights of a network to a checkpoint file
+ *
+ * The file is replaced at once, a mapping of the previous one made by mapModel stays valid
+ *
+ * @param path
+ * @param allW The nbDimensions - 1 weight matrices
+ * @param dimensions The dimensions of every layer, input and output included
+ * @param nbDimensions See above
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int writeModel(const char* path, const gsl_matrix** allW, const int* dimensions, size_t nbDimensions);
+
+/**
+ * @brief Maps a checkpoint file and views its weights, nothing is copied
+ *
+ * The mapping is private, writing to the weights does not change the file
+ *
+ * @param path
+ * @param dimensions The expected dimensions, the file is rejected if they differ
+ * @param nbDimensions See above
+ * @param mapping Receives the mapping, to be released with unmapModel once the matrices are destroyed
+ * @param mappingSize Receives the size of the mapping
+ *
+ * @return The nbDimensions - 1 weight matrices, they do not own their data and can be destroyed with
+ * destroyMatricesArray, NULL on failure
+ */
+gsl_matrix** mapModel(const char* path, const int* dimensions, size_t nbDimensions, void** mapping, size_t* mappingSize);
+
+/**
+ * @brief Releases a mapping made by mapModel
+ *
+ * @param mapping
+ * @param mappingSize
+ */
+void unmapModel(void* mapping, size_t mappingSize);
@@ -0,0 +1,5 @@
+#undef BASE
+#undef FUNCTION
+#undef TYPE
+#undef VIEW
+#undef NN_FUNCTION
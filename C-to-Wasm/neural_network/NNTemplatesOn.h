@@ -0,0 +1,23 @@
+/*
+ * Element type of the sources included after this header, in the manner of GSL's templates_on.h: define BASE_DOUBLE
+ * or BASE_FLOAT, include this header then the source, then NNTemplatesOff.h
+ *
+ * TYPE(gsl_matrix) and FUNCTION(gsl_matrix, ptr) name the GSL type and function of that element type, NN_FUNCTION(name)
+ * names the network functions, unchanged for double and suffixed with Float otherwise
+ */
+
+#if defined(BASE_DOUBLE)
+#define BASE double
+#define FUNCTION(dir, name) dir ## _ ## name
+#define TYPE(dir) dir
+#define VIEW(dir, name) dir ## _ ## name
+#define NN_FUNCTION(name) name
+#elif defined(BASE_FLOAT)
+#define BASE float
+#define FUNCTION(dir, name) dir ## _float_ ## name
+#define TYPE(dir) dir ## _float
+#define VIEW(dir, name) dir ## _float_ ## name
+#define NN_FUNCTION(name) name ## Float
+#else
+#error unknown BASE_ directive in NNTemplatesOn.h
+#endif
@@ -0,0 +1,47 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_float.h>
+#include "NNWorkspace.h"
+
+// Blocks start on a 64 bytes boundary relative to the arena
+#define BLOCK_ALIGNMENT 64
+
+// Trainers and evaluators allocate from several threads
+static atomic_size_t allocations = 0;
+
+void* nnCalloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return calloc(count, size);
+}
+
+gsl_matrix* nnMatrixAlloc(size_t rows, size_t cols) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return gsl_matrix_alloc(rows, cols);
+}
+
+gsl_matrix* nnMatrixCalloc(size_t rows, size_t cols) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return gsl_matrix_calloc(rows, cols);
+}
+
+gsl_vector* nnVectorCalloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return gsl_vector_calloc(size);
+}
+
+size_t nnAllocationCount(void) {
+    return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
+
+#define BASE_DOUBLE
+#include "NNTemplatesOn.h"
+#include "WorkspaceSource.h"
+#include "NNTemplatesOff.h"
+#undef BASE_DOUBLE
+
+#define BASE_FLOAT
+#include "NNTemplatesOn.h"
+#include "WorkspaceSource.h"
+#include "NNTemplatesOff.h"
+#undef BASE_FLOAT
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_matrix_float.h>
+#include <gsl/gsl_spmatrix.h>
+#include <gsl/gsl_spmatrix_float.h>
+
+typedef struct {
+    size_t nbLayers;
+    size_t batchSize;
+    size_t maxDimension;
+    int* dimensions;
+    double* arena;
+    gsl_matrix_view* combinations;
+    gsl_matrix_view* activations;
+    gsl_matrix_view* gradients;
+    gsl_matrix_view deltas[2];
+    // CSR copy of the first layer input, NULL unless enabled by setWorkspaceSparseInput
+    gsl_spmatrix* sparseInput;
+    double maxDensity;
+} gsl_nn_workspace;
+
+// Same buffers in single precision, see FloatNNUtils.h
+typedef struct {
+    size_t nbLayers;
+    size_t batchSize;
+    size_t maxDimension;
+    int* dimensions;
+    float* arena;
+    gsl_matrix_float_view* combinations;
+    gsl_matrix_float_view* activations;
+    gsl_matrix_float_view* gradients;
+    gsl_matrix_float_view deltas[2];
+    gsl_spmatrix_float* sparseInput;
+    double maxDensity;
+    // Non-zero when the products are accumulated in double, see setWorkspaceMixed
+    int mixed;
+} gsl_nn_workspace_float;
+
+/**
+ * @brief Constructs the buffers needed to train and run a network, all carved out of one contiguous arena
+ *
+ * combinations[i] and activations[i] are the pre-activation and output of layer i (batchSize x dimensions[i + 1]),
+ * gradients[i] has the shape of allW[i] and deltas are two batchSize x maxDimension error buffers
+ *
+ * @param dimensions The dimensions of every layer, input and output included
+ * @param nbDimensions See above
+ * @param batchSize The maximum number of samples going through the network at once
+ *
+ * @return gsl_nn_workspace*
+ */
+gsl_nn_workspace* constructWorkspace(const int* dimensions, size_t nbDimensions, size_t batchSize);
+gsl_nn_workspace_float* constructWorkspaceFloat(const int* dimensions, size_t nbDimensions, size_t batchSize);
+
+/**
+ * @brief Destroys a workspace
+ *
+ * @param ws The workspace to be destroyed
+ */
+void destroyWorkspace(gsl_nn_workspace* ws);
+void destroyWorkspaceFloat(gsl_nn_workspace_float* ws);
+
+/**
+ * @brief Heap allocations of the neural network code go through these wrappers
+ */
+void* nnCalloc(size_t count, size_t size);
+gsl_matrix* nnMatrixAlloc(size_t rows, size_t cols);
+gsl_matrix* nnMatrixCalloc(size_t rows, size_t cols);
+gsl_vector* nnVectorCalloc(size_t size);
+
+/**
+ * @brief Number of heap allocations made through the wrappers above since the start of the program, by every
+ * thread, benchmarks can compare it before and after a run to check the steady state does not allocate
+ * 
+ * Allocations made by GSL itself, such as the CSR buffer of the workspace or the temporaries of the blas
+ * thread pool, are not counted
+ *
+ * @return size_t
+ */
+size_t nnAllocationCount(void);
+
+/**
+ * @brief Restricts the combination, activation and delta views to their first nbRows rows
+ *
+ * @param ws
+ * @param nbRows At most the batch size of the workspace
+ *
+ * @return 0 on success
+ */
+int setWorkspaceRows(gsl_nn_workspace* ws, size_t nbRows);
+int setWorkspaceRowsFloat(gsl_nn_workspace_float* ws, size_t nbRows);
+
+/**
+ * @brief Lets the first layer run on a CSR copy of its input batches
+ *
+ * Batches with at most maxDensity * rows * columns nonzero inputs are copied to ws->sparseInput before the forward
+ * pass, the first layer product and weight gradient then only go through the nonzero inputs. Denser batches keep
+ * the dense products.
+ *
+ * @param ws
+ * @param maxDensity Between 0 and 1, 0 disables the sparse path and releases its buffer
+ *
+ * @return 0 on success
+ */
+int setWorkspaceSparseInput(gsl_nn_workspace* ws, double maxDensity);
+int setWorkspaceSparseInputFloat(gsl_nn_workspace_float* ws, double maxDensity);
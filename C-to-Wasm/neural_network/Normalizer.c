@@ -0,0 +1,150 @@
+#include <math.h>
+#include <stdlib.h>
+#include <gsl/gsl_matrix.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "Sharding.h"
+#include "Normalizer.h"
+
+// Below this number of rows per thread the shards are not worth a thread
+#define NORMALIZER_MIN_SHARD 1024
+
+typedef struct {
+    NNNormalizer* partial;
+    const gsl_matrix* X;
+    size_t begin;
+    size_t end;
+    int failed;
+} NormalizerShard;
+
+NNNormalizer* constructNormalizer(size_t nbFeatures) {
+    if(nbFeatures == 0) return NULL;
+
+    NNNormalizer* normalizer = nnCalloc(1, sizeof(NNNormalizer));
+    REQUIRE_NON_NULL(normalizer);
+
+    // mean, m2 and scale one after the other
+    normalizer->nbFeatures = nbFeatures;
+    normalizer->mean = nnCalloc(3 * nbFeatures, sizeof(double));
+    if(!normalizer->mean) {
+        free(normalizer);
+        return NULL;
+    }
+    normalizer->m2 = normalizer->mean + nbFeatures;
+    normalizer->scale = normalizer->m2 + nbFeatures;
+    for(size_t j = 0; j < nbFeatures; j++) {
+        normalizer->scale[j] = 1.0;
+    }
+
+    return normalizer;
+}
+
+void destroyNormalizer(NNNormalizer* normalizer) {
+    if(!normalizer) return;
+    free(normalizer->mean);
+    free(normalizer);
+}
+
+int accumulateNormalizer(NNNormalizer* normalizer, const gsl_matrix* X) {
+    if(!normalizer || !X || X->size2 != normalizer->nbFeatures) return -1;
+
+    double* restrict mean = normalizer->mean;
+    double* restrict m2 = normalizer->m2;
+    for(size_t r = 0; r < X->size1; r++) {
+        const double* restrict x = gsl_matrix_const_ptr(X, r, 0);
+        // Same count for every feature, the division is hoisted out of the feature loop
+        double inverse = 1.0 / (double) ++normalizer->count;
+        for(size_t j = 0; j < normalizer->nbFeatures; j++) {
+            double delta = x[j] - mean[j];
+            mean[j] += delta * inverse;
+            m2[j] += delta * (x[j] - mean[j]);
+        }
+    }
+
+    return 0;
+}
+
+int mergeNormalizer(NNNormalizer* normalizer, const NNNormalizer* other) {
+    if(!normalizer || !other || other->nbFeatures != normalizer->nbFeatures) return -1;
+    if(other->count == 0) return 0;
+
+    double n = (double) normalizer->count;
+    double m = (double) other->count;
+    double total = n + m;
+    for(size_t j = 0; j < normalizer->nbFeatures; j++) {
+        double delta = other->mean[j] - normalizer->mean[j];
+        normalizer->mean[j] += delta * m / total;
+        normalizer->m2[j] += other->m2[j] + delta * delta * n * m / total;
+    }
+    normalizer->count += other->count;
+
+    return 0;
+}
+
+void finishNormalizer(NNNormalizer* normalizer) {
+    if(!normalizer || normalizer->count == 0) return;
+
+    // Population standard deviation
+    for(size_t j = 0; j < normalizer->nbFeatures; j++) {
+        double std = sqrt(normalizer->m2[j] / (double) normalizer->count);
+        normalizer->scale[j] = std > 0 ? 1.0 / std : 1.0;
+    }
+}
+
+static void* accumulateShard(void* data) {
+    NormalizerShard* shard = data;
+    gsl_matrix_const_view rows = gsl_matrix_const_submatrix(shard->X, shard->begin, 0, shard->end - shard->begin, shard->X->size2);
+    shard->failed = accumulateNormalizer(shard->partial, &rows.matrix);
+    return NULL;
+}
+
+int fitNormalizer(NNNormalizer* normalizer, const gsl_matrix* X, size_t nbThreads) {
+    if(!normalizer || !X || X->size2 != normalizer->nbFeatures || nbThreads == 0) return -1;
+
+    size_t maxThreads = X->size1 / NORMALIZER_MIN_SHARD;
+    if(nbThreads > maxThreads) nbThreads = maxThreads;
+    if(nbThreads <= 1) {
+        if(accumulateNormalizer(normalizer, X)) return -1;
+        finishNormalizer(normalizer);
+        return 0;
+    }
+
+    NormalizerShard* shards = nnCalloc(nbThreads, sizeof(NormalizerShard));
+    int failed = !shards;
+    for(size_t t = 0; !failed && t < nbThreads; t++) {
+        shards[t].partial = constructNormalizer(X->size2);
+        shards[t].X = X;
+        shards[t].begin = X->size1 * t / nbThreads;
+        shards[t].end = X->size1 * (t + 1) / nbThreads;
+        failed = !shards[t].partial;
+    }
+
+    if(!failed) runSharded(nbThreads, accumulateShard, shards, sizeof(NormalizerShard));
+
+    for(size_t t = 0; !failed && t < nbThreads; t++) {
+        failed = shards[t].failed || mergeNormalizer(normalizer, shards[t].partial);
+    }
+    for(size_t t = 0; shards && t < nbThreads; t++) {
+        destroyNormalizer(shards[t].partial);
+    }
+    free(shards);
+    if(failed) return -1;
+
+    finishNormalizer(normalizer);
+    return 0;
+}
+
+int applyNormalizer(const NNNormalizer* normalizer, gsl_matrix* X) {
+    if(!normalizer || !X || X->size2 != normalizer->nbFeatures) return -1;
+
+    const double* restrict mean = normalizer->mean;
+    const double* restrict scale = normalizer->scale;
+    for(size_t r = 0; r < X->size1; r++) {
+        double* restrict x = gsl_matrix_ptr(X, r, 0);
+        for(size_t j = 0; j < normalizer->nbFeatures; j++) {
+            x[j] = (x[j] - mean[j]) * scale[j];
+        }
+    }
+
+    return 0;
+}
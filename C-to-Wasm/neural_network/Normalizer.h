@@ -0,0 +1,83 @@
+#pragma once
+
+#include <gsl/gsl_matrix.h>
+
+/*
+ * Per-feature standardization, x' = (x - mean) / std with the statistics of the training set. The statistics are
+ * accumulated with Welford's method so that any number of batches can be streamed through in a single pass.
+ */
+typedef struct {
+    size_t nbFeatures;
+    // Rows accumulated so far
+    size_t count;
+    double* mean;
+    // Sum of the squared deviations from the mean
+    double* m2;
+    // 1 / std once finished, 1 for constant features which are only centered
+    double* scale;
+} NNNormalizer;
+
+/**
+ * @brief Constructs an empty normalizer
+ *
+ * @param nbFeatures Number of columns of the matrices it will see
+ *
+ * @return NNNormalizer*
+ */
+NNNormalizer* constructNormalizer(size_t nbFeatures);
+
+/**
+ * @brief Destroys a normalizer
+ *
+ * @param normalizer
+ */
+void destroyNormalizer(NNNormalizer* normalizer);
+
+/**
+ * @brief Adds every row of X to the statistics, one pass over X
+ *
+ * @param normalizer
+ * @param X
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int accumulateNormalizer(NNNormalizer* normalizer, const gsl_matrix* X);
+
+/**
+ * @brief Adds the statistics of other to the ones of normalizer, as if its rows had been accumulated there
+ *
+ * @param normalizer
+ * @param other
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int mergeNormalizer(NNNormalizer* normalizer, const NNNormalizer* other);
+
+/**
+ * @brief Computes the scales from the accumulated statistics, to be called before applyNormalizer
+ *
+ * @param normalizer
+ */
+void finishNormalizer(NNNormalizer* normalizer);
+
+/**
+ * @brief Accumulates X on several threads, each one takes a contiguous shard of rows and the shards are merged
+ * in order, the statistics do not depend on the scheduling. Finishes the normalizer. See runSharded.
+ *
+ * @param normalizer
+ * @param X
+ * @param nbThreads
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int fitNormalizer(NNNormalizer* normalizer, const gsl_matrix* X, size_t nbThreads);
+
+/**
+ * @brief Standardizes X in place
+ *
+ * @param normalizer A finished normalizer
+ * @param X
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int applyNormalizer(const NNNormalizer* normalizer, gsl_matrix* X);
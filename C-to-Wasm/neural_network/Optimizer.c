@@ -0,0 +1,225 @@
+#include <math.h>
+#include <stdlib.h>
+#include <gsl/gsl_matrix.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "Optimizer.h"
+
+NNOptimizerConfig defaultOptimizerConfig(NNOptimizerMethod method) {
+    NNOptimizerConfig config = {
+        .method = method,
+        .momentum = 0.9,
+        .beta2 = 0.999,
+        .epsilon = 1e-8,
+        .schedule = NN_SCHEDULE_CONSTANT,
+        .decay = 1.0,
+        .decaySteps = 1
+    };
+    return config;
+}
+
+static size_t stateCount(NNOptimizerMethod method) {
+    switch(method) {
+        case NN_OPTIMIZER_MOMENTUM:
+        case NN_OPTIMIZER_NESTEROV:
+            return 1;
+        case NN_OPTIMIZER_ADAM:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static int validConfig(const NNOptimizerConfig* config) {
+    if(config->method > NN_OPTIMIZER_ADAM || config->schedule > NN_SCHEDULE_INVERSE_TIME) return 0;
+    if(config->momentum < 0 || config->momentum >= 1) return 0;
+    if(config->method == NN_OPTIMIZER_ADAM && (config->beta2 < 0 || config->beta2 >= 1 || !(config->epsilon > 0))) return 0;
+    return config->schedule == NN_SCHEDULE_CONSTANT || config->decaySteps > 0;
+}
+
+NNOptimizer* constructOptimizer(const int* dimensions, size_t nbDimensions, const NNOptimizerConfig* config) {
+    REQUIRE_NON_NULL(dimensions);
+    REQUIRE_NON_NULL(config);
+    if(nbDimensions <= 1 || !validConfig(config)) return NULL;
+
+    size_t nbLayers = nbDimensions - 1;
+    size_t nbStates = stateCount(config->method);
+    size_t total = 0;
+    for(size_t i = 0; i < nbLayers; i++) {
+        if(dimensions[i] <= 0 || dimensions[i + 1] <= 0) return NULL;
+        total += (size_t) dimensions[i + 1] * (dimensions[i] + 1);
+    }
+
+    NNOptimizer* optimizer = nnCalloc(1, sizeof(NNOptimizer));
+    REQUIRE_NON_NULL(optimizer);
+
+    optimizer->config = *config;
+    optimizer->nbLayers = nbLayers;
+    optimizer->arena = nnCalloc(total * (1 + nbStates), sizeof(double));
+    optimizer->gradientViews = nnCalloc(3 * nbLayers, sizeof(gsl_matrix_view));
+    optimizer->gradients = nnCalloc(nbLayers, sizeof(gsl_matrix*));
+    if(!optimizer->arena || !optimizer->gradientViews || !optimizer->gradients) {
+        destroyOptimizer(optimizer);
+        return NULL;
+    }
+    optimizer->velocities = optimizer->gradientViews + nbLayers;
+    optimizer->moments = optimizer->velocities + nbLayers;
+
+    // Every buffer of a layer is contiguous, the update walks them in lockstep
+    double* block = optimizer->arena;
+    gsl_matrix_view* buffers[3] = { optimizer->gradientViews, optimizer->velocities, optimizer->moments };
+    for(size_t s = 0; s <= nbStates; s++) {
+        for(size_t i = 0; i < nbLayers; i++) {
+            buffers[s][i] = gsl_matrix_view_array(block, dimensions[i + 1], dimensions[i] + 1);
+            block += (size_t) dimensions[i + 1] * (dimensions[i] + 1);
+        }
+    }
+    for(size_t i = 0; i < nbLayers; i++) {
+        optimizer->gradients[i] = &optimizer->gradientViews[i].matrix;
+    }
+
+    return optimizer;
+}
+
+void destroyOptimizer(NNOptimizer* optimizer) {
+    if(!optimizer) return;
+    free(optimizer->arena);
+    free(optimizer->gradientViews);
+    free(optimizer->gradients);
+    free(optimizer);
+}
+
+void resetOptimizer(NNOptimizer* optimizer) {
+    if(!optimizer) return;
+
+    size_t nbStates = stateCount(optimizer->config.method);
+    for(size_t i = 0; i < optimizer->nbLayers && nbStates > 0; i++) {
+        gsl_matrix_set_zero(&optimizer->velocities[i].matrix);
+        if(nbStates > 1) gsl_matrix_set_zero(&optimizer->moments[i].matrix);
+    }
+    optimizer->step = 0;
+}
+
+double scheduledLearningRate(const NNOptimizer* optimizer, double learningRate) {
+    const NNOptimizerConfig* config = &optimizer->config;
+    switch(config->schedule) {
+        case NN_SCHEDULE_STEP:
+            return learningRate * pow(config->decay, (double) (optimizer->step / config->decaySteps));
+        case NN_SCHEDULE_INVERSE_TIME:
+            return learningRate / (1.0 + config->decay * (double) optimizer->step / (double) config->decaySteps);
+        default:
+            return learningRate;
+    }
+}
+
+// One pass over a row of n weights, the gradient and the state are read and written once
+static void sgdRow(double* restrict w, const double* restrict g, size_t n, double lr, double scale) {
+    double step = lr * scale;
+    for(size_t k = 0; k < n; k++) {
+        w[k] -= step * g[k];
+    }
+}
+
+static void momentumRow(double* restrict w, const double* restrict g, double* restrict v, size_t n, double lr,
+    double scale, double mu, int nesterov) {
+    for(size_t k = 0; k < n; k++) {
+        double gradient = scale * g[k];
+        double velocity = mu * v[k] + gradient;
+        v[k] = velocity;
+        w[k] -= lr * (nesterov ? gradient + mu * velocity : velocity);
+    }
+}
+
+static void adamRow(double* restrict w, const double* restrict g, double* restrict m, double* restrict v, size_t n,
+    double lr, double scale, double beta1, double beta2, double epsilon) {
+    for(size_t k = 0; k < n; k++) {
+        double gradient = scale * g[k];
+        double first = beta1 * m[k] + (1.0 - beta1) * gradient;
+        double second = beta2 * v[k] + (1.0 - beta2) * gradient * gradient;
+        m[k] = first;
+        v[k] = second;
+        w[k] -= lr * first / (sqrt(second) + epsilon);
+    }
+}
+
+int applyOptimizer(NNOptimizer* optimizer, gsl_matrix** allW, const gsl_matrix** gradients, double learningRate,
+    double scale) {
+    if(!optimizer || !allW || !gradients) return -1;
+
+    const NNOptimizerConfig* config = &optimizer->config;
+    double lr = scheduledLearningRate(optimizer, learningRate);
+    if(config->method == NN_OPTIMIZER_ADAM) {
+        // Bias corrections folded into the learning rate
+        double t = (double) (optimizer->step + 1);
+        lr *= sqrt(1.0 - pow(config->beta2, t)) / (1.0 - pow(config->momentum, t));
+    }
+
+    for(size_t i = 0; i < optimizer->nbLayers; i++) {
+        gsl_matrix* W = allW[i];
+        const gsl_matrix* G = gradients[i];
+        gsl_matrix* V = &optimizer->velocities[i].matrix;
+        gsl_matrix* M = &optimizer->moments[i].matrix;
+        if(!W || !G || G->size1 != W->size1 || G->size2 != W->size2 || W->size1 != optimizer->gradientViews[i].matrix.size1
+            || W->size2 != optimizer->gradientViews[i].matrix.size2) return -1;
+
+        size_t n = W->size2;
+        for(size_t r = 0; r < W->size1; r++) {
+            double* w = gsl_matrix_ptr(W, r, 0);
+            const double* g = gsl_matrix_const_ptr(G, r, 0);
+            switch(config->method) {
+                case NN_OPTIMIZER_MOMENTUM:
+                case NN_OPTIMIZER_NESTEROV:
+                    momentumRow(w, g, gsl_matrix_ptr(V, r, 0), n, lr, scale, config->momentum,
+                        config->method == NN_OPTIMIZER_NESTEROV);
+                    break;
+                case NN_OPTIMIZER_ADAM:
+                    // First moment in the velocities, second moment in the moments
+                    adamRow(w, g, gsl_matrix_ptr(V, r, 0), gsl_matrix_ptr(M, r, 0), n, lr, scale, config->momentum,
+                        config->beta2, config->epsilon);
+                    break;
+                default:
+                    sgdRow(w, g, n, lr, scale);
+            }
+        }
+    }
+
+    optimizer->step++;
+    return 0;
+}
+
+int optimizerStep(gsl_nn_workspace* ws, NNOptimizer* optimizer, const gsl_matrix* X, const gsl_matrix* Y,
+    gsl_matrix** allW, double learningRate) {
+    if(!ws || !optimizer || !X || ws->nbLayers != optimizer->nbLayers) return -1;
+
+    if(batchGradient(ws, X, Y, (const gsl_matrix**) allW, optimizer->gradients)) return -1;
+    return applyOptimizer(optimizer, allW, (const gsl_matrix**) optimizer->gradients, learningRate, 1.0 / (double) X->size1);
+}
+
+gsl_matrix** trainOptimized(gsl_nn_workspace* ws, NNOptimizer* optimizer, const gsl_matrix* trainInput,
+    const gsl_matrix* trainOutput, int numEpoch, double learningRate, size_t batchSize) {
+    REQUIRE_NON_NULL(ws);
+    REQUIRE_NON_NULL(optimizer);
+    REQUIRE_NON_NULL(trainInput);
+    REQUIRE_NON_NULL(trainOutput);
+    if(batchSize == 0 || batchSize > ws->batchSize) return NULL;
+
+    gsl_matrix** allW = initNetwork(ws->dimensions, ws->nbLayers + 1);
+    REQUIRE_NON_NULL(allW);
+    resetOptimizer(optimizer);
+
+    size_t nbSamples = trainInput->size1;
+    for(int e = 0; e < numEpoch; e++) {
+        for(size_t r = 0; r < nbSamples; r += batchSize) {
+            size_t b = nbSamples - r < batchSize ? nbSamples - r : batchSize;
+            gsl_matrix_const_view X = gsl_matrix_const_submatrix(trainInput, r, 0, b, trainInput->size2);
+            gsl_matrix_const_view Y = gsl_matrix_const_submatrix(trainOutput, r, 0, b, trainOutput->size2);
+
+            if(optimizerStep(ws, optimizer, &X.matrix, &Y.matrix, allW, learningRate)) {
+                destroyMatricesArray(allW, ws->nbLayers);
+                return NULL;
+            }
+        }
+    }
+
+    return allW;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <gsl/gsl_matrix.h>
+#include "NNWorkspace.h"
+
+typedef enum {
+    // w -= lr * g
+    NN_OPTIMIZER_SGD,
+    // v = momentum * v + g, w -= lr * v
+    NN_OPTIMIZER_MOMENTUM,
+    // v = momentum * v + g, w -= lr * (g + momentum * v)
+    NN_OPTIMIZER_NESTEROV,
+    // Bias corrected first and second moments, momentum is beta1
+    NN_OPTIMIZER_ADAM
+} NNOptimizerMethod;
+
+typedef enum {
+    NN_SCHEDULE_CONSTANT,
+    // Multiplied by decay every decaySteps steps
+    NN_SCHEDULE_STEP,
+    // Divided by 1 + decay * step / decaySteps
+    NN_SCHEDULE_INVERSE_TIME
+} NNSchedule;
+
+typedef struct {
+    NNOptimizerMethod method;
+    double momentum;
+    double beta2;
+    double epsilon;
+    NNSchedule schedule;
+    double decay;
+    size_t decaySteps;
+} NNOptimizerConfig;
+
+typedef struct {
+    NNOptimizerConfig config;
+    size_t nbLayers;
+    // Number of updates applied since the construction or the last reset
+    size_t step;
+    double* arena;
+    // Summed batch gradients, then velocities (first moments) and second moments, all shaped like the weights
+    gsl_matrix_view* gradientViews;
+    gsl_matrix_view* velocities;
+    gsl_matrix_view* moments;
+    gsl_matrix** gradients;
+} NNOptimizer;
+
+/**
+ * @brief Usual settings of a method: momentum 0.9, Adam with beta2 0.999 and epsilon 1e-8, constant learning rate
+ *
+ * @param method
+ *
+ * @return NNOptimizerConfig
+ */
+NNOptimizerConfig defaultOptimizerConfig(NNOptimizerMethod method);
+
+/**
+ * @brief Constructs an optimizer and every buffer it will ever need, in one arena
+ *
+ * @param dimensions The dimensions of every layer, input and output included
+ * @param nbDimensions See above
+ * @param config Copied
+ *
+ * @return NNOptimizer*, NULL on failure or invalid settings
+ */
+NNOptimizer* constructOptimizer(const int* dimensions, size_t nbDimensions, const NNOptimizerConfig* config);
+
+/**
+ * @brief Destroys an optimizer
+ *
+ * @param optimizer
+ */
+void destroyOptimizer(NNOptimizer* optimizer);
+
+/**
+ * @brief Clears the state and the step count, to be called before training a new network
+ *
+ * @param optimizer
+ */
+void resetOptimizer(NNOptimizer* optimizer);
+
+/**
+ * @brief Learning rate of the next update once the schedule is applied
+ *
+ * @param optimizer
+ * @param learningRate The base learning rate
+ *
+ * @return double
+ */
+double scheduledLearningRate(const NNOptimizer* optimizer, double learningRate);
+
+/**
+ * @brief Updates the weights with scale * gradients, every layer is read and written in a single pass together
+ * with the optimizer state
+ *
+ * @param optimizer
+ * @param allW
+ * @param gradients Shaped like the weights
+ * @param learningRate The base learning rate, see scheduledLearningRate
+ * @param scale Applied to the gradients first, 1 / b for gradients summed over b samples
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int applyOptimizer(NNOptimizer* optimizer, gsl_matrix** allW, const gsl_matrix** gradients, double learningRate,
+    double scale);
+
+/**
+ * @brief One mini-batch step, the averaged gradient of the batch goes through the optimizer
+ *
+ * @param ws Holds at least X->size1 rows
+ * @param optimizer
+ * @param X The batch samples
+ * @param Y The batch classifications
+ * @param allW
+ * @param learningRate
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int optimizerStep(gsl_nn_workspace* ws, NNOptimizer* optimizer, const gsl_matrix* X, const gsl_matrix* Y,
+    gsl_matrix** allW, double learningRate);
+
+/**
+ * @brief Trains a new network with mini-batch steps of the optimizer, which is reset first
+ *
+ * @param ws Holds at least batchSize rows
+ * @param optimizer
+ * @param trainInput
+ * @param trainOutput
+ * @param numEpoch
+ * @param learningRate
+ * @param batchSize
+ *
+ * @return The trained weights, NULL on failure
+ */
+gsl_matrix** trainOptimized(gsl_nn_workspace* ws, NNOptimizer* optimizer, const gsl_matrix* trainInput,
+    const gsl_matrix* trainOutput, int numEpoch, double learningRate, size_t batchSize);
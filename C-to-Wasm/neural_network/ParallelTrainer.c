@@ -0,0 +1,236 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <gsl/gsl_matrix.h>
+#include "MatrixNNUtils.h"
+#include "NNWorkspace.h"
+#include "ParallelTrainer.h"
+
+#define PARALLEL_BATCH (PARALLEL_CHUNKS * PARALLEL_CHUNK_ROWS)
+
+typedef struct ParallelJob ParallelJob;
+
+typedef struct {
+    ParallelJob* job;
+    size_t id;
+    gsl_nn_workspace* ws;
+} Worker;
+
+struct ParallelJob {
+    const gsl_matrix* trainInput;
+    const gsl_matrix* trainOutput;
+    int numEpoch;
+    double learningRate;
+    NNParallelMode mode;
+    size_t nbLayers;
+    gsl_matrix** allW;
+    // PARALLEL_CHUNKS arrays of nbLayers gradients, synchronous mode only
+    gsl_matrix*** chunkGradients;
+
+    size_t nbThreads;
+    Worker* workers;
+    pthread_barrier_t barrier;
+    int failed;
+
+    // Workers wait here until the number of threads that could be created is known
+    pthread_mutex_t gate;
+    pthread_cond_t opened;
+    int started;
+};
+
+// Rows of all the layers are dealt out to the threads, every weight is summed over the chunks in chunk order
+static void reduceChunks(ParallelJob* job, size_t id, size_t nbChunks, double step) {
+    size_t row = 0;
+    for(size_t i = 0; i < job->nbLayers; i++) {
+        gsl_matrix* W = job->allW[i];
+        for(size_t j = 0; j < W->size1; j++, row++) {
+            if(row % job->nbThreads != id) continue;
+
+            double* w = gsl_matrix_ptr(W, j, 0);
+            for(size_t k = 0; k < W->size2; k++) {
+                double total = 0.0;
+                for(size_t c = 0; c < nbChunks; c++) {
+                    total += gsl_matrix_get(job->chunkGradients[c][i], j, k);
+                }
+                w[k] -= step * total;
+            }
+        }
+    }
+}
+
+static void trainSynchronous(Worker* worker) {
+    ParallelJob* job = worker->job;
+    size_t nbSamples = job->trainInput->size1;
+
+    for(int e = 0; e < job->numEpoch; e++) {
+        for(size_t r = 0; r < nbSamples; r += PARALLEL_BATCH) {
+            size_t b = nbSamples - r < PARALLEL_BATCH ? nbSamples - r : PARALLEL_BATCH;
+            size_t nbChunks = (b + PARALLEL_CHUNK_ROWS - 1) / PARALLEL_CHUNK_ROWS;
+
+            // A chunk gives the same gradient whichever thread computes it
+            for(size_t c = worker->id; c < nbChunks; c += job->nbThreads) {
+                size_t first = r + c * PARALLEL_CHUNK_ROWS;
+                size_t rows = r + b - first < PARALLEL_CHUNK_ROWS ? r + b - first : PARALLEL_CHUNK_ROWS;
+                gsl_matrix_const_view X = gsl_matrix_const_submatrix(job->trainInput, first, 0, rows, job->trainInput->size2);
+                gsl_matrix_const_view Y = gsl_matrix_const_submatrix(job->trainOutput, first, 0, rows, job->trainOutput->size2);
+                if(batchGradient(worker->ws, &X.matrix, &Y.matrix, (const gsl_matrix**) job->allW, job->chunkGradients[c])) {
+                    job->failed = 1;
+                }
+            }
+
+            pthread_barrier_wait(&job->barrier);
+            reduceChunks(job, worker->id, nbChunks, job->learningRate / (double) b);
+            pthread_barrier_wait(&job->barrier);
+        }
+    }
+}
+
+static void trainHogwild(Worker* worker) {
+    ParallelJob* job = worker->job;
+    size_t nbSamples = job->trainInput->size1;
+    size_t begin = nbSamples * worker->id / job->nbThreads;
+    size_t end = nbSamples * (worker->id + 1) / job->nbThreads;
+
+    for(int e = 0; e < job->numEpoch; e++) {
+        for(size_t r = begin; r < end; r += PARALLEL_CHUNK_ROWS) {
+            size_t rows = end - r < PARALLEL_CHUNK_ROWS ? end - r : PARALLEL_CHUNK_ROWS;
+            gsl_matrix_const_view X = gsl_matrix_const_submatrix(job->trainInput, r, 0, rows, job->trainInput->size2);
+            gsl_matrix_const_view Y = gsl_matrix_const_submatrix(job->trainOutput, r, 0, rows, job->trainOutput->size2);
+            // Reads and writes of the other threads are deliberately not synchronized
+            if(trainStep(worker->ws, &X.matrix, &Y.matrix, job->allW, job->learningRate)) {
+                job->failed = 1;
+            }
+        }
+    }
+}
+
+static void* runWorker(void* data) {
+    Worker* worker = data;
+    ParallelJob* job = worker->job;
+
+    pthread_mutex_lock(&job->gate);
+    while(!job->started) pthread_cond_wait(&job->opened, &job->gate);
+    pthread_mutex_unlock(&job->gate);
+
+    if(job->mode == NN_PARALLEL_SYNCHRONOUS) trainSynchronous(worker);
+    else trainHogwild(worker);
+
+    return NULL;
+}
+
+static void destroyChunkGradients(gsl_matrix*** chunkGradients, size_t nbLayers) {
+    if(!chunkGradients) return;
+    for(size_t c = 0; c < PARALLEL_CHUNKS; c++) {
+        destroyMatricesArray(chunkGradients[c], nbLayers);
+    }
+    free(chunkGradients);
+}
+
+static gsl_matrix*** constructChunkGradients(gsl_matrix** allW, size_t nbLayers) {
+    gsl_matrix*** chunkGradients = nnCalloc(PARALLEL_CHUNKS, sizeof(gsl_matrix**));
+    REQUIRE_NON_NULL(chunkGradients);
+
+    for(size_t c = 0; c < PARALLEL_CHUNKS; c++) {
+        chunkGradients[c] = nnCalloc(nbLayers, sizeof(gsl_matrix*));
+        for(size_t i = 0; chunkGradients[c] && i < nbLayers; i++) {
+            chunkGradients[c][i] = nnMatrixAlloc(allW[i]->size1, allW[i]->size2);
+            if(!chunkGradients[c][i]) {
+                destroyChunkGradients(chunkGradients, nbLayers);
+                return NULL;
+            }
+        }
+        if(!chunkGradients[c]) {
+            destroyChunkGradients(chunkGradients, nbLayers);
+            return NULL;
+        }
+    }
+
+    return chunkGradients;
+}
+
+static void destroyWorkers(Worker* workers, size_t nbWorkers) {
+    if(!workers) return;
+    for(size_t t = 0; t < nbWorkers; t++) {
+        destroyWorkspace(workers[t].ws);
+    }
+    free(workers);
+}
+
+gsl_matrix** trainParallel(const int* dimensions, size_t nbDimensions, const gsl_matrix* trainInput,
+    const gsl_matrix* trainOutput, int numEpoch, double learningRate, size_t nbThreads, NNParallelMode mode) {
+    REQUIRE_NON_NULL(dimensions);
+    REQUIRE_NON_NULL(trainInput);
+    REQUIRE_NON_NULL(trainOutput);
+    if(nbThreads == 0 || trainInput->size1 != trainOutput->size1) return NULL;
+
+    ParallelJob job = {
+        .trainInput = trainInput,
+        .trainOutput = trainOutput,
+        .numEpoch = numEpoch,
+        .learningRate = learningRate,
+        .mode = mode,
+        .nbLayers = nbDimensions - 1,
+        .failed = 0,
+        .started = 0
+    };
+
+    job.allW = initNetwork(dimensions, nbDimensions);
+    REQUIRE_NON_NULL(job.allW);
+
+    job.chunkGradients = mode == NN_PARALLEL_SYNCHRONOUS ? constructChunkGradients(job.allW, job.nbLayers) : NULL;
+    job.workers = nnCalloc(nbThreads, sizeof(Worker));
+    if((mode == NN_PARALLEL_SYNCHRONOUS && !job.chunkGradients) || !job.workers) {
+        destroyChunkGradients(job.chunkGradients, job.nbLayers);
+        free(job.workers);
+        destroyMatricesArray(job.allW, job.nbLayers);
+        return NULL;
+    }
+
+    for(size_t t = 0; t < nbThreads; t++) {
+        job.workers[t].job = &job;
+        job.workers[t].id = t;
+        job.workers[t].ws = constructWorkspace(dimensions, nbDimensions, PARALLEL_CHUNK_ROWS);
+        if(!job.workers[t].ws) {
+            destroyWorkers(job.workers, nbThreads);
+            destroyChunkGradients(job.chunkGradients, job.nbLayers);
+            destroyMatricesArray(job.allW, job.nbLayers);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&job.gate, NULL);
+    pthread_cond_init(&job.opened, NULL);
+
+    // The calling thread is worker 0
+    pthread_t* threads = nnCalloc(nbThreads, sizeof(pthread_t));
+    size_t nbCreated = 0;
+    while(threads && nbCreated + 1 < nbThreads && !pthread_create(&threads[nbCreated], NULL, runWorker, &job.workers[nbCreated + 1])) {
+        nbCreated++;
+    }
+
+    job.nbThreads = nbCreated + 1;
+    pthread_barrier_init(&job.barrier, NULL, job.nbThreads);
+
+    pthread_mutex_lock(&job.gate);
+    job.started = 1;
+    pthread_cond_broadcast(&job.opened);
+    pthread_mutex_unlock(&job.gate);
+
+    runWorker(&job.workers[0]);
+    for(size_t t = 0; t < nbCreated; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_barrier_destroy(&job.barrier);
+    pthread_cond_destroy(&job.opened);
+    pthread_mutex_destroy(&job.gate);
+    free(threads);
+    destroyWorkers(job.workers, nbThreads);
+    destroyChunkGradients(job.chunkGradients, job.nbLayers);
+
+    if(job.failed) {
+        destroyMatricesArray(job.allW, job.nbLayers);
+        return NULL;
+    }
+
+    return job.allW;
+}
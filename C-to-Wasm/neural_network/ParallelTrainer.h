@@ -0,0 +1,39 @@
+#pragma once
+
+#include <gsl/gsl_matrix.h>
+
+typedef enum {
+    // Gradients of every batch are averaged in a fixed order, the weights are the same for any number of threads
+    NN_PARALLEL_SYNCHRONOUS,
+    // Every thread updates the shared weights from its own shard without locking (Hogwild)
+    NN_PARALLEL_HOGWILD
+} NNParallelMode;
+
+// Rows per gradient computation, each one gets its own buffer in synchronous mode
+#define PARALLEL_CHUNK_ROWS 8
+// Chunks per synchronous step, the useful number of threads is at most this
+#define PARALLEL_CHUNKS 32
+
+/**
+ * @brief Trains a new network with mini-batch gradient descent on several threads
+ *
+ * In synchronous mode every step averages the gradient of PARALLEL_CHUNKS x PARALLEL_CHUNK_ROWS samples, the chunks
+ * are shared between the threads and reduced in chunk order. In Hogwild mode the samples are split in one contiguous
+ * shard per thread and every PARALLEL_CHUNK_ROWS rows update the weights directly.
+ *
+ * The workers are the threads that could be created and the calling one, the chunks and shards are split between
+ * them only, so a run without threads still trains on every sample
+ *
+ * @param dimensions The dimensions of every layer, input and output included
+ * @param nbDimensions See above
+ * @param trainInput
+ * @param trainOutput
+ * @param numEpoch
+ * @param learningRate Applied to the gradient averaged over each batch
+ * @param nbThreads
+ * @param mode
+ *
+ * @return The trained weights, NULL on failure
+ */
+gsl_matrix** trainParallel(const int* dimensions, size_t nbDimensions, const gsl_matrix* trainInput,
+    const gsl_matrix* trainOutput, int numEpoch, double learningRate, size_t nbThreads, NNParallelMode mode);
@@ -1,9 +1,13 @@
 #include <time.h>
 #include "ClassificationContract.h"
+#include "MNISTLoader.h"
+#include "Benchmark.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
+// Defaults of --train, --features, --test, --classes, --epochs, --learning-rate, --layers and --layer-size
 #define NB_TRAIN_SAMPLES 100
 #define NB_FEATURES 5
 #define NB_TEST_SAMPLES 2
@@ -13,7 +17,31 @@
 #define NB_LAYERS 1
 #define LAYER_SIZE 3
 
-#define ITER 100
+// Real data benchmark, run with --mnist and the directory holding the MNIST IDX files
+#define MNIST_BATCH 64
+#define MNIST_EPOCH 1
+#define MNIST_LEARNING_RATE 0.1
+#define MNIST_LAYER_SIZE 128
+
+// Parallel training benchmark, run with --scaling
+#define SCALING_SAMPLES 8192
+#define SCALING_FEATURES 64
+#define SCALING_CLASSES 10
+#define SCALING_LAYER_SIZE 128
+#define SCALING_MAX_THREADS 32
+
+// Precision comparison, on the first PRECISION_SAMPLES training images
+#define PRECISION_SAMPLES 10000
+
+// Optimizer comparison, accuracy after each epoch
+#define OPTIMIZER_EPOCH 3
+
+// Evaluation of the MNIST test set, from 1 to EVALUATION_MAX_THREADS threads
+#define EVALUATION_TOP_K 3
+#define EVALUATION_MAX_THREADS 8
+
+// Sparse first layer on the raw MNIST pixels, about a fifth of them are not zero
+#define SPARSE_MAX_DENSITY 0.25
 
 static double* generateData(int rows, int cols) {
     double* data = calloc(rows * cols, sizeof(double));
@@ -28,78 +56,567 @@ static double* generateData(int rows, int cols) {
     return data;
 }
 
-static int* generateLayers() {
-    int* layers = calloc(NB_LAYERS, sizeof(int));
+static int* generateLayers(int nbLayers, int layerSize) {
+    int* layers = calloc(nbLayers, sizeof(int));
     if(!layers) return NULL;
 
-    for (int i = 0; i < NB_LAYERS; i++) {
-        layers[i] = LAYER_SIZE;
+    for (int i = 0; i < nbLayers; i++) {
+        layers[i] = layerSize;
     }
 
     return layers;
 }
 
-long benchmark(void(*fun)(void*), void* data) {
-    struct timespec begin, end; 
-    // Setup
-    clock_gettime(CLOCK_MONOTONIC, &begin);
-    // Start benchmarked code
-    fun(data); 
-    // Cleanup
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    if(end.tv_nsec <= begin.tv_nsec) return 0;
-    return (end.tv_nsec - begin.tv_nsec);
+// Parameters of the default benchmark
+typedef struct {
+    int nbTrain;
+    int nbFeatures;
+    int nbTest;
+    int nbClasses;
+    int nbEpoch;
+    int nbLayers;
+    int layerSize;
+    double learningRate;
+} Scenario;
+
+// What the benchmarked functions receive
+typedef struct {
+    const Scenario* scenario;
+    NNArithmetic arithmetic;
+    ClassificationContract* contract;
+} ScenarioRun;
+
+static ClassificationContract* constructScenarioContract(const Scenario* scenario, NNArithmetic arithmetic) {
+    double* X = generateData(scenario->nbTrain, scenario->nbFeatures);
+    double* Y = generateData(scenario->nbTrain, scenario->nbClasses);
+    double* tX = generateData(scenario->nbTest, scenario->nbFeatures);
+    double* tY = generateData(scenario->nbTest, scenario->nbClasses);
+    int* hiddenLayers = generateLayers(scenario->nbLayers, scenario->layerSize);
+    ClassificationContract* contract = X && Y && tX && tY && hiddenLayers ? constructContractWithArithmetic(X, Y, tX, tY, 
+                                    hiddenLayers, scenario->nbTrain, scenario->nbFeatures, scenario->nbClasses, 
+                                    scenario->nbTest, scenario->nbLayers, arithmetic) : NULL;
+    free(X); free(Y); free(tX); free(tY); free(hiddenLayers);
+    return contract;
+}
+
+// normalizeContract does nothing the second time, every iteration gets a new contract
+void constructBenchmark(void* data) {
+    ScenarioRun* run = data;
+    run->contract = constructScenarioContract(run->scenario, run->arithmetic);
+}
+
+void destroyBenchmark(void* data) {
+    ScenarioRun* run = data;
+    destroyContract(run->contract);
+    run->contract = NULL;
 }
 
 void normalizeBenchmark(void* data) {
-    ClassificationContract* contract = data;
-    normalizeContract(contract);
+    ScenarioRun* run = data;
+    normalizeContract(run->contract);
 }
 
 void trainBenchmark(void* data) {
-    ClassificationContract* contract = data;
-    trainContract(contract, NB_EPOCH, LEARNING_RATE);
+    ScenarioRun* run = data;
+    trainContract(run->contract, run->scenario->nbEpoch, run->scenario->learningRate);
 }
 
 void testBenchmark(void* data) {
-    ClassificationContract* contract = data;
-    testContract(contract);
-}
-
-int main() {
-    long totalNorm = 0;
-    long totalTrain = 0;
-    long totalTest = 0;
-
-    for(int i = 0; i < ITER; i++) {
-        // Setup
-        double* X = generateData(NB_TRAIN_SAMPLES, NB_FEATURES);
-        double* Y = generateData(NB_TRAIN_SAMPLES, NB_CLASSES);
-        double* tX = generateData(NB_TEST_SAMPLES, NB_FEATURES);
-        double* tY = generateData(NB_TEST_SAMPLES, NB_CLASSES);
-        int* hiddenLayers = generateLayers();
-
-        ClassificationContract* contract = constructContract(X, Y, tX, tY, hiddenLayers, NB_TRAIN_SAMPLES, 
-                                    NB_FEATURES, NB_CLASSES, NB_TEST_SAMPLES, NB_LAYERS);
-        
-        free(X); free(Y); free(tX); free(tY); free(hiddenLayers);
-
-        // Result
-        size_t resultNorm = benchmark(normalizeBenchmark, contract);
-        size_t resultTrain = benchmark(trainBenchmark, contract);
-        size_t resultTest = benchmark(testBenchmark, contract);
-    
-        if(!resultNorm || !resultTrain || !resultTest) i--;
-
-        totalNorm += resultNorm;
-        totalTrain += resultTrain;
-        totalTest += resultTest;
-
-        // Cleanup
-        destroyContract(contract);
-    }
-
-    printf("NORM: %lu\n", totalNorm / ITER);
-    printf("TRAIN: %lu\n", totalTrain / ITER);
-    printf("TEST: %lu\n", totalTest / ITER);
-}
\ No newline at end of file
+    ScenarioRun* run = data;
+    testContract(run->contract);
+}
+
+// Non-zero, with a message, when something was allocated since before
+static int checkAllocations(const char* name, size_t before) {
+    size_t allocated = nnAllocationCount() - before;
+    if(allocated) fprintf(stderr, "%s allocated %lu times in steady state\n", name, (unsigned long) allocated);
+    return allocated != 0;
+}
+
+// Prints the result as soon as it is measured, the MNIST benchmarks run for minutes. score is read once the benchmark
+// is done, NULL when it has none
+static int runAndPrintBenchmark(const BenchmarkConfig* config, const char* name, const char* parameters,
+    void (*setup)(void*), void (*run)(void*), void (*teardown)(void*), void* data, const double* score) {
+    BenchmarkResult result;
+    if(runBenchmark(config, name, parameters, setup, run, teardown, data, &result)) return 1;
+    if(score) result.score = *score;
+    printBenchmarkResult(config, &result);
+    fflush(stdout);
+    return 0;
+}
+
+static int openMNISTDirectory(const char* directory, size_t trainBatch, MNISTStream** train, MNISTStream** test) {
+    char paths[4][1024];
+    const char* names[4] = { "train-images.idx3-ubyte", "train-labels.idx1-ubyte", "t10k-images.idx3-ubyte", "t10k-labels.idx1-ubyte" };
+    for(int i = 0; i < 4; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%s", directory, names[i]);
+    }
+
+    *train = openMNIST(paths[0], paths[1], trainBatch, 1.0 / 255.0);
+    *test = openMNIST(paths[2], paths[3], 0, 1.0 / 255.0);
+    if(!*train || !*test) {
+        fprintf(stderr, "Cannot read the MNIST files in %s\n", directory);
+        closeMNIST(*train);
+        closeMNIST(*test);
+        return -1;
+    }
+    return 0;
+}
+
+// What the benchmarks of the MNIST modes receive, the contract of the last iteration is kept for the next benchmark
+typedef struct {
+    MNISTStream* train;
+    MNISTStream* test;
+    gsl_matrix_view tX;
+    gsl_matrix_view tY;
+    // Training set in memory, streamed from train in batches when NULL
+    const gsl_matrix* X;
+    const gsl_matrix* Y;
+    NNArithmetic arithmetic;
+    // Optimizer of the new contracts, plain SGD when NULL
+    const NNOptimizerConfig* optimizer;
+    // Sparse first layer of the new contracts when above 0
+    double maxDensity;
+    // Epochs trained per iteration
+    int nbEpoch;
+    double learningRate;
+    size_t threads;
+    ClassificationContract* contract;
+    NNEvaluation* evaluation;
+    double accuracy;
+    // Accuracy after each iteration, for the optimizer comparison
+    double accuracies[OPTIMIZER_EPOCH];
+    size_t nbAccuracies;
+    int failed;
+} MNISTRun;
+
+// Opens the MNIST files of directory, the whole test set is a single batch
+static int openMNISTRun(const char* directory, size_t trainBatch, MNISTRun* run) {
+    if(openMNISTDirectory(directory, trainBatch, &run->train, &run->test)) return -1;
+    nextMNISTBatch(run->test, &run->tX, &run->tY);
+    return 0;
+}
+
+static void closeMNISTRun(MNISTRun* run) {
+    destroyEvaluation(run->evaluation);
+    destroyContract(run->contract);
+    closeMNIST(run->train);
+    closeMNIST(run->test);
+}
+
+// setup of the training benchmarks, every iteration trains a new contract
+static void newMNISTContract(void* data) {
+    MNISTRun* run = data;
+    int hiddenLayers[1] = { MNIST_LAYER_SIZE };
+    destroyContract(run->contract);
+    run->contract = constructContractFromViewsWithArithmetic(run->X, run->Y, &run->tX.matrix, &run->tY.matrix,
+                        hiddenLayers, 1, run->arithmetic);
+    if(run->contract && ((run->optimizer && setContractOptimizer(run->contract, run->optimizer))
+        || (run->maxDensity > 0 && setContractSparseInput(run->contract, run->maxDensity)))) {
+        destroyContract(run->contract);
+        run->contract = NULL;
+    }
+    run->failed |= !run->contract;
+    run->nbAccuracies = 0;
+}
+
+static void trainMNISTContract(void* data) {
+    MNISTRun* run = data;
+    if(!run->contract) return;
+    if(run->X) {
+        trainContractBatched(run->contract, run->nbEpoch, run->learningRate, MNIST_BATCH);
+        return;
+    }
+
+    for(int e = 0; e < run->nbEpoch; e++) {
+        gsl_matrix_view X, Y;
+        rewindMNIST(run->train);
+        while(nextMNISTBatch(run->train, &X, &Y)) {
+            run->failed |= trainContractOnBatch(run->contract, &X.matrix, &Y.matrix, run->learningRate) != 0;
+        }
+    }
+}
+
+static void testMNISTContract(void* data) {
+    MNISTRun* run = data;
+    run->accuracy = run->contract ? testContract(run->contract) : 0;
+}
+
+// teardown of the optimizer comparison, outside of the timed epoch
+static void recordMNISTAccuracy(void* data) {
+    MNISTRun* run = data;
+    testMNISTContract(run);
+    if(run->nbAccuracies < OPTIMIZER_EPOCH) run->accuracies[run->nbAccuracies++] = run->accuracy;
+}
+
+// setup of the evaluation benchmark, only the evaluation of the last iteration is kept
+static void dropMNISTEvaluation(void* data) {
+    MNISTRun* run = data;
+    destroyEvaluation(run->evaluation);
+    run->evaluation = NULL;
+}
+
+static void evaluateMNISTContract(void* data) {
+    MNISTRun* run = data;
+    run->evaluation = evaluateContract(run->contract, EVALUATION_TOP_K, run->threads);
+    run->failed |= !run->evaluation;
+    run->accuracy = run->evaluation ? (double) run->evaluation->correct / run->evaluation->nbSamples : 0;
+}
+
+// The training set is streamed from the mapped files in batches, only the test set is converted at once
+static int mnistBenchmark(const BenchmarkConfig* config, const char* directory) {
+    MNISTRun run = { .arithmetic = NN_ARITHMETIC_DOUBLE, .nbEpoch = MNIST_EPOCH, .learningRate = MNIST_LEARNING_RATE };
+    if(openMNISTRun(directory, MNIST_BATCH, &run)) return 1;
+
+    char parameters[192];
+    snprintf(parameters, sizeof(parameters), "samples=%lu test=%lu batch=%d epochs=%d layer_size=%d learning_rate=%g",
+            mnistSize(run.train), run.tX.matrix.size1, MNIST_BATCH, MNIST_EPOCH, MNIST_LAYER_SIZE, MNIST_LEARNING_RATE);
+    printBenchmarkHeader(config);
+    int failed = runAndPrintBenchmark(config, "MNIST TRAIN", parameters, newMNISTContract, trainMNISTContract, NULL,
+                    &run, NULL);
+    failed |= runAndPrintBenchmark(config, "MNIST TEST", parameters, NULL, testMNISTContract, NULL, &run, &run.accuracy);
+
+    failed |= run.failed;
+    closeMNISTRun(&run);
+    return failed;
+}
+
+typedef struct {
+    ClassificationContract* contract;
+    size_t threads;
+    NNParallelMode mode;
+} ScalingRun;
+
+static void trainParallelBenchmark(void* data) {
+    ScalingRun* run = data;
+    trainContractParallel(run->contract, NB_EPOCH, LEARNING_RATE, run->threads, run->mode);
+}
+
+// Time of one parallel epoch in both modes from 1 to SCALING_MAX_THREADS threads
+static int scalingBenchmark(const BenchmarkConfig* config) {
+    double* X = generateData(SCALING_SAMPLES, SCALING_FEATURES);
+    double* Y = generateData(SCALING_SAMPLES, SCALING_CLASSES);
+    int hiddenLayers[1] = { SCALING_LAYER_SIZE };
+    ClassificationContract* contract = X && Y ? constructContract(X, Y, X, Y, hiddenLayers, SCALING_SAMPLES,
+                                    SCALING_FEATURES, SCALING_CLASSES, SCALING_SAMPLES, 1) : NULL;
+    free(X); free(Y);
+    if(!contract) return 1;
+
+    normalizeContract(contract);
+    // Targets of the same scale as the inputs
+    gsl_matrix_scale(contract->trainOutput, 1.0 / 1000);
+
+    const char* names[2] = { "PARALLEL SYNCHRONOUS", "PARALLEL HOGWILD" };
+    NNParallelMode modes[2] = { NN_PARALLEL_SYNCHRONOUS, NN_PARALLEL_HOGWILD };
+    int failed = 0;
+    printBenchmarkHeader(config);
+    for(int m = 0; m < 2; m++) {
+        for(size_t threads = 1; threads <= SCALING_MAX_THREADS; threads *= 2) {
+            ScalingRun run = { contract, threads, modes[m] };
+            char parameters[192];
+            snprintf(parameters, sizeof(parameters), "samples=%d features=%d classes=%d layer_size=%d threads=%lu",
+                    SCALING_SAMPLES, SCALING_FEATURES, SCALING_CLASSES, SCALING_LAYER_SIZE, threads);
+            failed |= runAndPrintBenchmark(config, names[m], parameters, NULL, trainParallelBenchmark, NULL, &run, NULL);
+        }
+    }
+
+    destroyContract(contract);
+    return failed;
+}
+
+typedef struct {
+    ClassificationContract* contract;
+    const char* path;
+    int failed;
+} ModelRun;
+
+static void saveModelBenchmark(void* data) {
+    ModelRun* run = data;
+    run->failed |= saveContractModel(run->contract, run->path) != 0;
+}
+
+static void loadModelBenchmark(void* data) {
+    ModelRun* run = data;
+    run->failed |= loadContractModel(run->contract, run->path) != 0;
+}
+
+// Trains the network unless path already holds a checkpoint, then times saving and loading it
+static int modelBenchmark(const BenchmarkConfig* config, const char* path) {
+    double* X = generateData(NB_TRAIN_SAMPLES, NB_FEATURES);
+    double* Y = generateData(NB_TRAIN_SAMPLES, NB_CLASSES);
+    double* tX = generateData(NB_TEST_SAMPLES, NB_FEATURES);
+    double* tY = generateData(NB_TEST_SAMPLES, NB_CLASSES);
+    int* hiddenLayers = generateLayers(NB_LAYERS, LAYER_SIZE);
+    ClassificationContract* contract = X && Y && tX && tY && hiddenLayers ? constructContract(X, Y, tX, tY, hiddenLayers,
+                                    NB_TRAIN_SAMPLES, NB_FEATURES, NB_CLASSES, NB_TEST_SAMPLES, NB_LAYERS) : NULL;
+    free(X); free(Y); free(tX); free(tY); free(hiddenLayers);
+    if(!contract) return 1;
+
+    normalizeContract(contract);
+    if(loadContractModel(contract, path)) trainContract(contract, NB_EPOCH, LEARNING_RATE);
+    // Loading gives back the same weights
+    double accuracy = testContract(contract);
+
+    char parameters[192];
+    snprintf(parameters, sizeof(parameters), "features=%d classes=%d layers=%d layer_size=%d", NB_FEATURES, NB_CLASSES,
+            NB_LAYERS, LAYER_SIZE);
+    ModelRun run = { contract, path, 0 };
+    printBenchmarkHeader(config);
+    int failed = runAndPrintBenchmark(config, "MODEL SAVE", parameters, NULL, saveModelBenchmark, NULL, &run, NULL);
+    if(run.failed) fprintf(stderr, "Cannot save the model to %s\n", path);
+    failed |= run.failed || runAndPrintBenchmark(config, "MODEL LOAD", parameters, NULL, loadModelBenchmark, NULL, &run,
+                                &accuracy);
+
+    failed |= run.failed;
+    destroyContract(contract);
+    return failed;
+}
+
+// Same network and samples in double, float and mixed precision
+static int precisionBenchmark(const BenchmarkConfig* config, const char* directory) {
+    MNISTRun run = { .nbEpoch = MNIST_EPOCH, .learningRate = MNIST_LEARNING_RATE };
+    if(openMNISTRun(directory, PRECISION_SAMPLES, &run)) return 1;
+
+    gsl_matrix_view X, Y;
+    nextMNISTBatch(run.train, &X, &Y);
+    run.X = &X.matrix;
+    run.Y = &Y.matrix;
+
+    char parameters[192];
+    snprintf(parameters, sizeof(parameters), "samples=%lu test=%lu batch=%d epochs=%d layer_size=%d learning_rate=%g",
+            X.matrix.size1, run.tX.matrix.size1, MNIST_BATCH, MNIST_EPOCH, MNIST_LAYER_SIZE, MNIST_LEARNING_RATE);
+    const char* names[3] = { "DOUBLE", "FLOAT", "MIXED" };
+    NNArithmetic arithmetics[3] = { NN_ARITHMETIC_DOUBLE, NN_ARITHMETIC_FLOAT, NN_ARITHMETIC_MIXED };
+    int failed = 0;
+    printBenchmarkHeader(config);
+    for(int a = 0; a < 3 && !failed; a++) {
+        char train[32], test[32];
+        snprintf(train, sizeof(train), "%s TRAIN", names[a]);
+        snprintf(test, sizeof(test), "%s TEST", names[a]);
+        run.arithmetic = arithmetics[a];
+        failed |= runAndPrintBenchmark(config, train, parameters, newMNISTContract, trainMNISTContract, NULL, &run, NULL);
+        failed |= runAndPrintBenchmark(config, test, parameters, NULL, testMNISTContract, NULL, &run, &run.accuracy);
+        failed |= run.failed;
+    }
+
+    closeMNISTRun(&run);
+    return failed;
+}
+
+// Accuracy reached by every optimizer after each epoch on the streamed training set, an iteration is one more epoch
+static int optimizerBenchmark(const BenchmarkConfig* config, const char* directory) {
+    MNISTRun run = { .arithmetic = NN_ARITHMETIC_DOUBLE, .nbEpoch = 1 };
+    if(openMNISTRun(directory, MNIST_BATCH, &run)) return 1;
+
+    BenchmarkConfig epochs = *config;
+    epochs.warmup = 0;
+    epochs.minIterations = OPTIMIZER_EPOCH;
+    epochs.maxIterations = OPTIMIZER_EPOCH;
+    epochs.minTime = 0;
+
+    const char* names[4] = { "SGD", "MOMENTUM", "NESTEROV", "ADAM" };
+    NNOptimizerMethod methods[4] = { NN_OPTIMIZER_SGD, NN_OPTIMIZER_MOMENTUM, NN_OPTIMIZER_NESTEROV, NN_OPTIMIZER_ADAM };
+    // Momentum multiplies the effective step by about 1 / (1 - 0.9)
+    double learningRates[4] = { MNIST_LEARNING_RATE, MNIST_LEARNING_RATE / 10, MNIST_LEARNING_RATE / 10, 0.001 };
+    int failed = 0;
+    printBenchmarkHeader(config);
+    for(int m = 0; m < 4 && !failed; m++) {
+        NNOptimizerConfig optimizer = defaultOptimizerConfig(methods[m]);
+        run.optimizer = &optimizer;
+        run.learningRate = learningRates[m];
+        newMNISTContract(&run);
+
+        char parameters[192];
+        snprintf(parameters, sizeof(parameters), "samples=%lu test=%lu batch=%d layer_size=%d learning_rate=%g",
+                mnistSize(run.train), run.tX.matrix.size1, MNIST_BATCH, MNIST_LAYER_SIZE, learningRates[m]);
+        failed |= run.failed || runAndPrintBenchmark(&epochs, names[m], parameters, NULL, trainMNISTContract,
+                                    recordMNISTAccuracy, &run, &run.accuracy);
+        failed |= run.failed;
+        // Not part of the CSV and JSON outputs, the score is the accuracy after the last epoch
+        for(size_t e = 0; config->format == BENCHMARK_TEXT && e < run.nbAccuracies; e++) {
+            printf("%s EPOCH %lu: ACCURACY %f\n", names[m], e + 1, run.accuracies[e]);
+        }
+    }
+
+    closeMNISTRun(&run);
+    return failed;
+}
+
+// testContract against the evaluation engine on the MNIST test set, the counts must not depend on the threads
+static int evaluationBenchmark(const BenchmarkConfig* config, const char* directory) {
+    MNISTRun run = { .arithmetic = NN_ARITHMETIC_DOUBLE, .nbEpoch = 1, .learningRate = MNIST_LEARNING_RATE };
+    if(openMNISTRun(directory, MNIST_BATCH, &run)) return 1;
+
+    newMNISTContract(&run);
+    trainMNISTContract(&run);
+
+    char parameters[192];
+    snprintf(parameters, sizeof(parameters), "test=%lu layer_size=%d", run.tX.matrix.size1, MNIST_LAYER_SIZE);
+    printBenchmarkHeader(config);
+    int failed = run.failed || runAndPrintBenchmark(config, "TEST CONTRACT", parameters, NULL, testMNISTContract, NULL,
+                                    &run, &run.accuracy);
+
+    NNEvaluation* reference = NULL;
+    int deterministic = 1;
+    for(size_t threads = 1; !failed && threads <= EVALUATION_MAX_THREADS; threads *= 2) {
+        snprintf(parameters, sizeof(parameters), "test=%lu layer_size=%d top_k=%d threads=%lu", run.tX.matrix.size1,
+                MNIST_LAYER_SIZE, EVALUATION_TOP_K, threads);
+        run.threads = threads;
+        failed |= runAndPrintBenchmark(config, "EVALUATE", parameters, dropMNISTEvaluation, evaluateMNISTContract, NULL,
+                        &run, &run.accuracy);
+        failed |= run.failed;
+        if(failed) break;
+
+        if(!reference) {
+            reference = run.evaluation;
+            run.evaluation = NULL;
+            continue;
+        }
+        deterministic &= !memcmp(reference->confusion, run.evaluation->confusion,
+                            reference->nbClasses * reference->nbClasses * sizeof(size_t))
+                            && reference->topKCorrect == run.evaluation->topKCorrect;
+    }
+
+    // Not part of the CSV and JSON outputs
+    if(reference && config->format == BENCHMARK_TEXT) {
+        printf("TOP %d: %f\n", EVALUATION_TOP_K, (double) reference->topKCorrect / reference->nbSamples);
+        for(size_t c = 0; c < reference->nbClasses; c++) {
+            printf("CLASS %lu: PRECISION %f, RECALL %f\n", c, reference->precision[c], reference->recall[c]);
+        }
+    }
+    if(!deterministic) {
+        fprintf(stderr, "EVALUATE depends on the number of threads\n");
+        failed = 1;
+    }
+
+    destroyEvaluation(reference);
+    closeMNISTRun(&run);
+    return failed;
+}
+
+// One epoch on the raw MNIST pixels with the dense and the sparse first layer
+static int sparseBenchmark(const BenchmarkConfig* config, const char* directory) {
+    MNISTRun run = { .arithmetic = NN_ARITHMETIC_DOUBLE, .nbEpoch = 1, .learningRate = MNIST_LEARNING_RATE };
+    if(openMNISTRun(directory, MNIST_BATCH, &run)) return 1;
+
+    char parameters[192];
+    snprintf(parameters, sizeof(parameters), "samples=%lu test=%lu batch=%d layer_size=%d learning_rate=%g "
+            "max_density=%g", mnistSize(run.train), run.tX.matrix.size1, MNIST_BATCH, MNIST_LAYER_SIZE,
+            MNIST_LEARNING_RATE, SPARSE_MAX_DENSITY);
+    const char* names[2] = { "DENSE", "SPARSE" };
+    double maxDensities[2] = { 0, SPARSE_MAX_DENSITY };
+    int failed = 0;
+    printBenchmarkHeader(config);
+    for(int m = 0; m < 2 && !failed; m++) {
+        char train[32], test[32];
+        snprintf(train, sizeof(train), "%s TRAIN", names[m]);
+        snprintf(test, sizeof(test), "%s TEST", names[m]);
+        run.maxDensity = maxDensities[m];
+        failed |= runAndPrintBenchmark(config, train, parameters, newMNISTContract, trainMNISTContract, NULL, &run, NULL);
+        failed |= runAndPrintBenchmark(config, test, parameters, NULL, testMNISTContract, NULL, &run, &run.accuracy);
+        failed |= run.failed;
+    }
+
+    closeMNISTRun(&run);
+    return failed;
+}
+
+static int hasArgument(int argc, char** argv, const char* name) {
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], name)) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Scenario scenario = {
+        .nbTrain = benchmarkLongArgument(argc, argv, "--train", NB_TRAIN_SAMPLES),
+        .nbFeatures = benchmarkLongArgument(argc, argv, "--features", NB_FEATURES),
+        .nbTest = benchmarkLongArgument(argc, argv, "--test", NB_TEST_SAMPLES),
+        .nbClasses = benchmarkLongArgument(argc, argv, "--classes", NB_CLASSES),
+        .nbEpoch = benchmarkLongArgument(argc, argv, "--epochs", NB_EPOCH),
+        .nbLayers = benchmarkLongArgument(argc, argv, "--layers", NB_LAYERS),
+        .layerSize = benchmarkLongArgument(argc, argv, "--layer-size", LAYER_SIZE),
+        .learningRate = benchmarkDoubleArgument(argc, argv, "--learning-rate", LEARNING_RATE)
+    };
+    static const char* const options[] = { "--train", "--features", "--test", "--classes", "--epochs", "--layers",
+        "--layer-size", "--learning-rate", "--mnist", "--model", "--precision", "--optimizer", "--evaluate", "--sparse",
+        NULL };
+    static const char* const flags[] = { "--scaling", NULL };
+    BenchmarkConfig config = defaultBenchmarkConfig();
+    if(parseBenchmarkArguments(argc, argv, options, flags, &config) || scenario.nbTrain < 1 || scenario.nbFeatures < 1
+        || scenario.nbTest < 1 || scenario.nbClasses < 1 || scenario.nbEpoch < 1 || scenario.nbLayers < 1
+        || scenario.layerSize < 1) {
+        fprintf(stderr, "Usage: %s [--train N] [--features N] [--test N] [--classes N] [--epochs N] [--layers N] "
+                "[--layer-size N] [--learning-rate X] [--mnist DIR | --precision DIR | --optimizer DIR | --evaluate DIR "
+                "| --sparse DIR | --model PATH | --scaling] [--warmup N] [--min-iterations N] [--max-iterations N] "
+                "[--min-time S] [--counters] [--format text|csv|json]\n", argv[0]);
+        return 1;
+    }
+
+    // Other modes, timed with the same config
+    const char* mnist = benchmarkStringArgument(argc, argv, "--mnist", NULL);
+    const char* model = benchmarkStringArgument(argc, argv, "--model", NULL);
+    const char* precision = benchmarkStringArgument(argc, argv, "--precision", NULL);
+    const char* optimizer = benchmarkStringArgument(argc, argv, "--optimizer", NULL);
+    const char* evaluate = benchmarkStringArgument(argc, argv, "--evaluate", NULL);
+    const char* sparse = benchmarkStringArgument(argc, argv, "--sparse", NULL);
+    if(mnist) return mnistBenchmark(&config, mnist);
+    if(hasArgument(argc, argv, "--scaling")) return scalingBenchmark(&config);
+    if(model) return modelBenchmark(&config, model);
+    if(precision) return precisionBenchmark(&config, precision);
+    if(optimizer) return optimizerBenchmark(&config, optimizer);
+    if(evaluate) return evaluationBenchmark(&config, evaluate);
+    if(sparse) return sparseBenchmark(&config, sparse);
+
+    char parameters[192];
+    snprintf(parameters, sizeof(parameters), "train=%d features=%d test=%d classes=%d epochs=%d layers=%d layer_size=%d "
+            "learning_rate=%g", scenario.nbTrain, scenario.nbFeatures, scenario.nbTest, scenario.nbClasses,
+            scenario.nbEpoch, scenario.nbLayers, scenario.layerSize, scenario.learningRate);
+
+    // Setup, the normalized contracts are trained and tested again and again
+    ScenarioRun norm = { &scenario, NN_ARITHMETIC_DOUBLE, NULL };
+    ScenarioRun run = { &scenario, NN_ARITHMETIC_DOUBLE, constructScenarioContract(&scenario, NN_ARITHMETIC_DOUBLE) };
+    ScenarioRun fixedRun = { &scenario, NN_ARITHMETIC_FIXED, constructScenarioContract(&scenario, NN_ARITHMETIC_FIXED) };
+    if(!run.contract || !fixedRun.contract || normalizeContractWithThreads(run.contract, 1)
+        || normalizeContractWithThreads(fixedRun.contract, 1)) {
+        destroyContract(run.contract);
+        destroyContract(fixedRun.contract);
+        return 1;
+    }
+
+    // Result
+    BenchmarkResult results[5];
+    int failed = runBenchmark(&config, "NORM", parameters, constructBenchmark, normalizeBenchmark, destroyBenchmark,
+                    &norm, &results[0]);
+    // Training and inference run in the contract workspace and must not touch the heap once it is sized, training
+    // only allocates the weights it returns, once per call whatever the number of epochs
+    trainContract(run.contract, 1, scenario.learningRate);
+    size_t allocations = nnAllocationCount();
+    trainContract(run.contract, 1, scenario.learningRate);
+    size_t perCall = nnAllocationCount() - allocations;
+    allocations = nnAllocationCount();
+    trainContract(run.contract, 2, scenario.learningRate);
+    failed |= checkAllocations("TRAIN", allocations + perCall);
+    failed |= runBenchmark(&config, "TRAIN", parameters, NULL, trainBenchmark, NULL, &run, &results[1]);
+    allocations = nnAllocationCount();
+    failed |= runBenchmark(&config, "TEST", parameters, NULL, testBenchmark, NULL, &run, &results[2]);
+    failed |= checkAllocations("TEST", allocations);
+    // Same data and network with deterministic fixed-point arithmetic
+    failed |= runBenchmark(&config, "FIXED TRAIN", parameters, NULL, trainBenchmark, NULL, &fixedRun, &results[3]);
+    failed |= runBenchmark(&config, "FIXED TEST", parameters, NULL, testBenchmark, NULL, &fixedRun, &results[4]);
+
+    if(!failed) {
+        results[2].score = testContract(run.contract);
+        results[4].score = testContract(fixedRun.contract);
+        printBenchmarkHeader(&config);
+        for(int i = 0; i < 5; i++) {
+            printBenchmarkResult(&config, &results[i]);
+        }
+    }
+
+    // Cleanup
+    destroyContract(run.contract);
+    destroyContract(fixedRun.contract);
+    return failed ? 1 : 0;
+}
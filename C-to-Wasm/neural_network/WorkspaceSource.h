@@ -0,0 +1,110 @@
+// Workspace functions, included by NNWorkspace.c once per element type, see NNTemplatesOn.h
+
+static size_t NN_FUNCTION(blockSize)(size_t rows, size_t cols) {
+    size_t size = rows * cols;
+    size_t alignment = BLOCK_ALIGNMENT / sizeof(BASE);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static VIEW(gsl_matrix, view) NN_FUNCTION(carve)(BASE* arena, size_t* offset, size_t rows, size_t cols) {
+    VIEW(gsl_matrix, view) view = FUNCTION(gsl_matrix, view_array)(arena + *offset, rows, cols);
+    *offset += NN_FUNCTION(blockSize)(rows, cols);
+    return view;
+}
+
+TYPE(gsl_nn_workspace)* NN_FUNCTION(constructWorkspace)(const int* dimensions, size_t nbDimensions, size_t batchSize) {
+    if(!dimensions || nbDimensions <= 1 || batchSize == 0) return NULL;
+
+    size_t nbLayers = nbDimensions - 1;
+    size_t maxDimension = 0;
+    size_t total = 0;
+    for(size_t i = 0; i < nbDimensions; i++) {
+        if(dimensions[i] <= 0) return NULL;
+        if((size_t) dimensions[i] > maxDimension) maxDimension = dimensions[i];
+    }
+    for(size_t i = 0; i < nbLayers; i++) {
+        total += 2 * NN_FUNCTION(blockSize)(batchSize, dimensions[i + 1]);
+        total += NN_FUNCTION(blockSize)(dimensions[i + 1], dimensions[i] + 1);
+    }
+    total += 2 * NN_FUNCTION(blockSize)(batchSize, maxDimension);
+
+    TYPE(gsl_nn_workspace)* ws = nnCalloc(1, sizeof(TYPE(gsl_nn_workspace)));
+    if(!ws) return NULL;
+
+    ws->dimensions = nnCalloc(nbDimensions, sizeof(int));
+    ws->combinations = nnCalloc(3 * nbLayers, sizeof(VIEW(gsl_matrix, view)));
+    ws->arena = nnCalloc(total, sizeof(BASE));
+    if(!ws->dimensions || !ws->combinations || !ws->arena) {
+        NN_FUNCTION(destroyWorkspace)(ws);
+        return NULL;
+    }
+    ws->activations = ws->combinations + nbLayers;
+    ws->gradients = ws->activations + nbLayers;
+
+    ws->nbLayers = nbLayers;
+    ws->batchSize = batchSize;
+    ws->maxDimension = maxDimension;
+    for(size_t i = 0; i < nbDimensions; i++) {
+        ws->dimensions[i] = dimensions[i];
+    }
+
+    size_t offset = 0;
+    for(size_t i = 0; i < nbLayers; i++) {
+        ws->combinations[i] = NN_FUNCTION(carve)(ws->arena, &offset, batchSize, dimensions[i + 1]);
+        ws->activations[i] = NN_FUNCTION(carve)(ws->arena, &offset, batchSize, dimensions[i + 1]);
+        ws->gradients[i] = NN_FUNCTION(carve)(ws->arena, &offset, dimensions[i + 1], dimensions[i] + 1);
+    }
+    ws->deltas[0] = NN_FUNCTION(carve)(ws->arena, &offset, batchSize, maxDimension);
+    ws->deltas[1] = NN_FUNCTION(carve)(ws->arena, &offset, batchSize, maxDimension);
+
+    return ws;
+}
+
+void NN_FUNCTION(destroyWorkspace)(TYPE(gsl_nn_workspace)* ws) {
+    if(!ws) return;
+
+    NN_FUNCTION(setWorkspaceSparseInput)(ws, 0);
+    free(ws->arena);
+    free(ws->combinations);
+    free(ws->dimensions);
+
+    free(ws);
+}
+
+int NN_FUNCTION(setWorkspaceRows)(TYPE(gsl_nn_workspace)* ws, size_t nbRows) {
+    if(!ws || nbRows == 0 || nbRows > ws->batchSize) return -1;
+
+    for(size_t i = 0; i < ws->nbLayers; i++) {
+        size_t cols = ws->dimensions[i + 1];
+        ws->combinations[i] = FUNCTION(gsl_matrix, view_array)(ws->combinations[i].matrix.data, nbRows, cols);
+        ws->activations[i] = FUNCTION(gsl_matrix, view_array)(ws->activations[i].matrix.data, nbRows, cols);
+    }
+    for(size_t i = 0; i < 2; i++) {
+        ws->deltas[i] = FUNCTION(gsl_matrix, view_array)(ws->deltas[i].matrix.data, nbRows, ws->maxDimension);
+    }
+
+    return 0;
+}
+
+int NN_FUNCTION(setWorkspaceSparseInput)(TYPE(gsl_nn_workspace)* ws, double maxDensity) {
+    if(!ws || !(maxDensity >= 0 && maxDensity <= 1)) return -1;
+
+    ws->maxDensity = maxDensity;
+    if(maxDensity == 0) {
+        if(ws->sparseInput) FUNCTION(gsl_spmatrix, free)(ws->sparseInput);
+        ws->sparseInput = NULL;
+        return 0;
+    }
+    if(ws->sparseInput) return 0;
+
+    // Room for a batch with every input set, the last one may hold fewer rows
+    size_t nbInputs = ws->dimensions[0];
+    allocations++;
+    ws->sparseInput = FUNCTION(gsl_spmatrix, alloc_nzmax)(ws->batchSize, nbInputs, ws->batchSize * nbInputs, GSL_SPMATRIX_CSR);
+    if(!ws->sparseInput) {
+        ws->maxDensity = 0;
+        return -1;
+    }
+
+    return 0;
+}
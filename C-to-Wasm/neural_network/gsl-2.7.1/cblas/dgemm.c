@@ -3,6 +3,12 @@
 #include "cblas.h"
 #include "error_cblas_l3.h"
 
+#define BASE double
+#define GEMM_MODE_VARIABLE "GSL_CBLAS_DGEMM"
+#include "source_gemm_blocked.h"
+#undef GEMM_MODE_VARIABLE
+#undef BASE
+
 void
 cblas_dgemm (const enum CBLAS_ORDER Order, const enum CBLAS_TRANSPOSE TransA,
              const enum CBLAS_TRANSPOSE TransB, const int M, const int N,
@@ -10,7 +16,22 @@ cblas_dgemm (const enum CBLAS_ORDER Order, const enum CBLAS_TRANSPOSE TransA,
              const double *B, const int ldb, const double beta, double *C,
              const int ldc)
 {
+  if (gemm_use_blocked (M, N, K))
+    {
+      CHECK_ARGS14(GEMM,Order,TransA,TransB,M,N,K,alpha,A,lda,B,ldb,beta,C,ldc);
+
+      if (alpha == 0.0 && beta == 1.0)
+        return;
+
+      if (gemm_blocked (Order, TransA, TransB, M, N, K, alpha, A, lda, B,
+                        ldb, beta, C, ldc) == 0)
+        return;
+    }
+
+  /* reference triple loop */
+  {
 #define BASE double
 #include "source_gemm_r.h"
 #undef BASE
+  }
 }
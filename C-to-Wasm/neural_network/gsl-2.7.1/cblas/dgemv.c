@@ -2,6 +2,63 @@
 #include <gsl/gsl_cblas.h>
 #include "cblas.h"
 #include "error_cblas_l2.h"
+#include "thread_pool.h"
+
+/* below this many multiply-adds the threads cost more than they save */
+#define GEMV_MIN_THREADED_WORK (256 * 256)
+
+/* each task computes this many elements of y */
+#define GEMV_CHUNK 64
+
+static void
+dgemv_serial (const enum CBLAS_ORDER order, const enum CBLAS_TRANSPOSE TransA,
+              const int M, const int N, const double alpha, const double *A,
+              const int lda, const double *X, const int incX,
+              const double beta, double *Y, const int incY)
+{
+#define BASE double
+#include "source_gemv_r.h"
+#undef BASE
+}
+
+struct dgemv_job
+{
+  enum CBLAS_ORDER order;
+  enum CBLAS_TRANSPOSE TransA;
+  int M, N;
+  double alpha;
+  const double *A;
+  int lda;
+  const double *X;
+  int incX;
+  double beta;
+  double *Y;
+  int incY;
+  int lenY;
+};
+
+/* Every task owns a contiguous range of y and goes through the whole
+   of x in the serial order, so the result is the same for any number
+   of threads. */
+static void
+dgemv_chunk (void *arg, size_t task)
+{
+  const struct dgemv_job *job = arg;
+  const int Trans = (job->TransA != CblasConjTrans) ? job->TransA : CblasTrans;
+  const int o0 = (int) task * GEMV_CHUNK;
+  const int len = (job->lenY - o0 < GEMV_CHUNK) ? job->lenY - o0 : GEMV_CHUNK;
+  /* y follows the rows of A in memory or its columns */
+  const int alongRows = (job->order == CblasRowMajor) == (Trans == CblasNoTrans);
+  const double *A = job->A + (alongRows ? (size_t) o0 * job->lda : (size_t) o0);
+  double *Y = job->Y + (size_t) o0 * job->incY;
+
+  if (Trans == CblasNoTrans)
+    dgemv_serial (job->order, job->TransA, len, job->N, job->alpha, A,
+                  job->lda, job->X, job->incX, job->beta, Y, job->incY);
+  else
+    dgemv_serial (job->order, job->TransA, job->M, len, job->alpha, A,
+                  job->lda, job->X, job->incX, job->beta, Y, job->incY);
+}
 
 void
 cblas_dgemv (const enum CBLAS_ORDER order, const enum CBLAS_TRANSPOSE TransA,
@@ -9,7 +66,35 @@ cblas_dgemv (const enum CBLAS_ORDER order, const enum CBLAS_TRANSPOSE TransA,
              const int lda, const double *X, const int incX,
              const double beta, double *Y, const int incY)
 {
-#define BASE double
-#include "source_gemv_r.h"
-#undef BASE
+  if (cblas_pool_threads () > 1 && incX > 0 && incY > 0
+      && (double) M * N >= GEMV_MIN_THREADED_WORK)
+    {
+      struct dgemv_job job;
+      size_t nbTasks;
+
+      CHECK_ARGS12(GEMV,order,TransA,M,N,alpha,A,lda,X,incX,beta,Y,incY);
+
+      job.order = order;
+      job.TransA = TransA;
+      job.M = M;
+      job.N = N;
+      job.alpha = alpha;
+      job.A = A;
+      job.lda = lda;
+      job.X = X;
+      job.incX = incX;
+      job.beta = beta;
+      job.Y = Y;
+      job.incY = incY;
+      job.lenY = (TransA == CblasNoTrans) ? M : N;
+
+      nbTasks = (job.lenY + GEMV_CHUNK - 1) / GEMV_CHUNK;
+      if (nbTasks > 1)
+        {
+          cblas_pool_run (dgemv_chunk, &job, nbTasks);
+          return;
+        }
+    }
+
+  dgemv_serial (order, TransA, M, N, alpha, A, lda, X, incX, beta, Y, incY);
 }
@@ -601,6 +601,16 @@ void cblas_zher2k(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo,
 
 void cblas_xerbla(int p, const char *rout, const char *form, ...);
 
+/*
+ * ===========================================================================
+ * GSL extensions: threads used by dgemm and dgemv, 1 unless set here or
+ * through the GSL_NUM_THREADS environment variable, always 1 in builds
+ * without pthreads (e.g. emscripten without -pthread)
+ * ===========================================================================
+ */
+void gsl_blas_set_num_threads(int n);
+int gsl_blas_get_num_threads(void);
+
 __END_DECLS
 
 #endif /* __GSL_CBLAS_H__ */
@@ -0,0 +1,598 @@
+/* cblas/source_gemm_blocked.h
+ *
+ * Cache blocked GEMM with packed panels and a register tiled
+ * micro-kernel, used by cblas_dgemm and cblas_sgemm for large enough
+ * products.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Included once per translation unit with BASE set to the element
+   type, BASE_FLOAT defined for float, and GEMM_MODE_VARIABLE naming the
+   environment variable that selects the path.
+
+   The product is always computed in row major order, a column major
+   C = op(A) op(B) is handled as the row major C' = op(B)' op(A)'.
+
+   Loop nest (Goto/BLIS): for each GEMM_NC columns of B and GEMM_KC
+   rows of the shared dimension, op(B) is packed into GEMM_NR wide
+   micro-panels; for each GEMM_MC rows of op(A), alpha * op(A) is packed
+   into GEMM_MR high micro-panels; the micro-kernel then computes one
+   GEMM_MR x GEMM_NR tile of C in registers.  A packed A block stays in
+   L2 and a B micro-panel in L1. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "thread_pool.h"
+
+#define GEMM_MR 4
+#define GEMM_NR 8
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+/* below this size in any dimension packing costs more than it saves */
+#define GEMM_MIN_DIM 16
+
+/* packed panels start on a cache line */
+#define GEMM_ALIGN (64 / sizeof (BASE))
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GEMM_HAVE_VECTOR_EXTENSIONS 1
+/* lowered to SSE2 on x86-64 and to simd128 by emscripten -msimd128 */
+typedef BASE gemm_vector __attribute__ ((vector_size (16)));
+#define GEMM_LANES (16 / sizeof (BASE))
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GEMM_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+typedef void (*gemm_kernel_fn) (size_t kc, const BASE *Ap, const BASE *Bp,
+                                BASE *tile);
+
+/* tile[r * GEMM_NR + c] = sum_k Ap[k * GEMM_MR + r] * Bp[k * GEMM_NR + c] */
+
+static void
+gemm_kernel_generic (size_t kc, const BASE *Ap, const BASE *Bp, BASE *tile)
+{
+#ifdef GEMM_HAVE_VECTOR_EXTENSIONS
+  const gemm_vector zero = { 0 };
+  gemm_vector c[GEMM_MR][GEMM_NR / GEMM_LANES];
+  size_t k, l;
+  int r, q;
+
+  for (r = 0; r < GEMM_MR; r++)
+    for (q = 0; q < (int) (GEMM_NR / GEMM_LANES); q++)
+      c[r][q] = zero;
+
+  for (k = 0; k < kc; k++)
+    {
+      const gemm_vector *b = (const gemm_vector *) (Bp + k * GEMM_NR);
+      for (r = 0; r < GEMM_MR; r++)
+        {
+          const gemm_vector av = zero + Ap[k * GEMM_MR + r];
+          for (q = 0; q < (int) (GEMM_NR / GEMM_LANES); q++)
+            c[r][q] += av * b[q];
+        }
+    }
+
+  for (r = 0; r < GEMM_MR; r++)
+    for (q = 0; q < (int) (GEMM_NR / GEMM_LANES); q++)
+      for (l = 0; l < GEMM_LANES; l++)
+        tile[r * GEMM_NR + q * GEMM_LANES + l] = c[r][q][l];
+#else
+  size_t k;
+  int r, c;
+
+  for (r = 0; r < GEMM_MR * GEMM_NR; r++)
+    tile[r] = 0.0;
+
+  for (k = 0; k < kc; k++)
+    for (r = 0; r < GEMM_MR; r++)
+      {
+        const BASE a = Ap[k * GEMM_MR + r];
+        for (c = 0; c < GEMM_NR; c++)
+          tile[r * GEMM_NR + c] += a * Bp[k * GEMM_NR + c];
+      }
+#endif
+}
+
+#if defined(GEMM_HAVE_AVX2) && defined(BASE_FLOAT)
+/* one row of the tile per register */
+__attribute__ ((target ("avx2,fma")))
+static void
+gemm_kernel_avx2 (size_t kc, const float *Ap, const float *Bp, float *tile)
+{
+  __m256 c0 = _mm256_setzero_ps (), c1 = _mm256_setzero_ps ();
+  __m256 c2 = _mm256_setzero_ps (), c3 = _mm256_setzero_ps ();
+  size_t k;
+
+  for (k = 0; k < kc; k++)
+    {
+      const __m256 b = _mm256_load_ps (Bp + k * GEMM_NR);
+      const float *a = Ap + k * GEMM_MR;
+
+      c0 = _mm256_fmadd_ps (_mm256_broadcast_ss (a), b, c0);
+      c1 = _mm256_fmadd_ps (_mm256_broadcast_ss (a + 1), b, c1);
+      c2 = _mm256_fmadd_ps (_mm256_broadcast_ss (a + 2), b, c2);
+      c3 = _mm256_fmadd_ps (_mm256_broadcast_ss (a + 3), b, c3);
+    }
+
+  _mm256_storeu_ps (tile, c0);
+  _mm256_storeu_ps (tile + 8, c1);
+  _mm256_storeu_ps (tile + 16, c2);
+  _mm256_storeu_ps (tile + 24, c3);
+}
+#elif defined(GEMM_HAVE_AVX2)
+__attribute__ ((target ("avx2,fma")))
+static void
+gemm_kernel_avx2 (size_t kc, const double *Ap, const double *Bp,
+                  double *tile)
+{
+  __m256d c00 = _mm256_setzero_pd (), c01 = _mm256_setzero_pd ();
+  __m256d c10 = _mm256_setzero_pd (), c11 = _mm256_setzero_pd ();
+  __m256d c20 = _mm256_setzero_pd (), c21 = _mm256_setzero_pd ();
+  __m256d c30 = _mm256_setzero_pd (), c31 = _mm256_setzero_pd ();
+  size_t k;
+
+  for (k = 0; k < kc; k++)
+    {
+      const __m256d b0 = _mm256_load_pd (Bp + k * GEMM_NR);
+      const __m256d b1 = _mm256_load_pd (Bp + k * GEMM_NR + 4);
+      const double *a = Ap + k * GEMM_MR;
+      __m256d av;
+
+      av = _mm256_broadcast_sd (a);
+      c00 = _mm256_fmadd_pd (av, b0, c00);
+      c01 = _mm256_fmadd_pd (av, b1, c01);
+      av = _mm256_broadcast_sd (a + 1);
+      c10 = _mm256_fmadd_pd (av, b0, c10);
+      c11 = _mm256_fmadd_pd (av, b1, c11);
+      av = _mm256_broadcast_sd (a + 2);
+      c20 = _mm256_fmadd_pd (av, b0, c20);
+      c21 = _mm256_fmadd_pd (av, b1, c21);
+      av = _mm256_broadcast_sd (a + 3);
+      c30 = _mm256_fmadd_pd (av, b0, c30);
+      c31 = _mm256_fmadd_pd (av, b1, c31);
+    }
+
+  _mm256_storeu_pd (tile, c00);
+  _mm256_storeu_pd (tile + 4, c01);
+  _mm256_storeu_pd (tile + 8, c10);
+  _mm256_storeu_pd (tile + 12, c11);
+  _mm256_storeu_pd (tile + 16, c20);
+  _mm256_storeu_pd (tile + 20, c21);
+  _mm256_storeu_pd (tile + 24, c30);
+  _mm256_storeu_pd (tile + 28, c31);
+}
+#endif
+
+enum gemm_mode
+{
+  GEMM_MODE_UNSET,
+  GEMM_MODE_REFERENCE,
+  GEMM_MODE_DEFAULT,
+  GEMM_MODE_BLOCKED
+};
+
+static enum gemm_mode gemm_mode = GEMM_MODE_UNSET;
+static gemm_kernel_fn gemm_kernel = NULL;
+
+/* Packing buffer kept between calls by each thread, only ever grown */
+struct gemm_buffer
+{
+  size_t capacity;
+  BASE *data;
+};
+
+#ifdef CBLAS_POOL_PTHREADS
+static pthread_once_t gemm_once = PTHREAD_ONCE_INIT;
+static pthread_key_t gemm_buffer_key;
+static int gemm_have_buffer_key = 0;
+
+static void
+gemm_buffer_free (void *p)
+{
+  struct gemm_buffer *buffer = p;
+  free (buffer->data);
+  free (buffer);
+}
+#else
+static struct gemm_buffer gemm_single_buffer = { 0, NULL };
+#endif
+
+/* GEMM_MODE_VARIABLE=reference keeps the original triple loop for every
+   call, GEMM_MODE_VARIABLE=blocked uses the blocked path for every size.
+   The choice is made once, under pthread_once when threads exist. */
+static void
+gemm_dispatch_init (void)
+{
+  const char *mode = getenv (GEMM_MODE_VARIABLE);
+  gemm_kernel_fn kernel = gemm_kernel_generic;
+
+#ifdef GEMM_HAVE_AVX2
+  if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+    kernel = gemm_kernel_avx2;
+#endif
+
+  gemm_kernel = kernel;
+
+#ifdef CBLAS_POOL_PTHREADS
+  gemm_have_buffer_key =
+    pthread_key_create (&gemm_buffer_key, gemm_buffer_free) == 0;
+#endif
+
+  if (mode != NULL && strcmp (mode, "reference") == 0)
+    gemm_mode = GEMM_MODE_REFERENCE;
+  else if (mode != NULL && strcmp (mode, "blocked") == 0)
+    gemm_mode = GEMM_MODE_BLOCKED;
+  else
+    gemm_mode = GEMM_MODE_DEFAULT;
+}
+
+static void
+gemm_dispatch (void)
+{
+#ifdef CBLAS_POOL_PTHREADS
+  pthread_once (&gemm_once, gemm_dispatch_init);
+#else
+  if (gemm_mode == GEMM_MODE_UNSET)
+    gemm_dispatch_init ();
+#endif
+}
+
+/* Returns count elements aligned on a cache line from the calling
+   thread's packing buffer, NULL when it cannot grow that large */
+static BASE *
+gemm_pack_buffer (const size_t count)
+{
+  struct gemm_buffer *buffer;
+
+#ifdef CBLAS_POOL_PTHREADS
+  if (!gemm_have_buffer_key)
+    return NULL;
+  buffer = pthread_getspecific (gemm_buffer_key);
+  if (buffer == NULL)
+    {
+      buffer = calloc (1, sizeof (struct gemm_buffer));
+      if (buffer == NULL)
+        return NULL;
+      if (pthread_setspecific (gemm_buffer_key, buffer) != 0)
+        {
+          free (buffer);
+          return NULL;
+        }
+    }
+#else
+  buffer = &gemm_single_buffer;
+#endif
+
+  if (buffer->capacity < count)
+    {
+      /* 64 bytes of slack to align the packed panels on a cache line */
+      BASE *data = malloc (count * sizeof (BASE) + 64);
+      if (data == NULL)
+        return NULL;
+      free (buffer->data);
+      buffer->data = data;
+      buffer->capacity = count;
+    }
+
+  return (BASE *) (((size_t) buffer->data + 63) & ~(size_t) 63);
+}
+
+static int
+gemm_use_blocked (const int M, const int N, const int K)
+{
+  gemm_dispatch ();
+
+  switch (gemm_mode)
+    {
+    case GEMM_MODE_BLOCKED:
+      return M > 0 && N > 0;
+    case GEMM_MODE_DEFAULT:
+      return M >= GEMM_MIN_DIM && N >= GEMM_MIN_DIM && K >= GEMM_MIN_DIM;
+    default:
+      return 0;
+    }
+}
+
+/* Ap holds ceil(mc / MR) micro-panels of kc x MR values, zero padded */
+static void
+gemm_pack_A (const int transA, const BASE *A, const size_t lda,
+             const size_t i0, const size_t k0, const size_t mc,
+             const size_t kc, const BASE alpha, BASE *Ap)
+{
+  size_t ir, k;
+  int r;
+
+  for (ir = 0; ir < mc; ir += GEMM_MR)
+    {
+      const size_t mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+      for (k = 0; k < kc; k++)
+        {
+          for (r = 0; r < (int) mr; r++)
+            {
+              const size_t i = i0 + ir + r;
+              const BASE a = (transA == CblasNoTrans)
+                ? A[lda * i + k0 + k] : A[lda * (k0 + k) + i];
+              Ap[k * GEMM_MR + r] = alpha * a;
+            }
+          for (; r < GEMM_MR; r++)
+            Ap[k * GEMM_MR + r] = 0.0;
+        }
+      Ap += kc * GEMM_MR;
+    }
+}
+
+/* Bp holds ceil(nc / NR) micro-panels of kc x NR values, zero padded */
+static void
+gemm_pack_B (const int transB, const BASE *B, const size_t ldb,
+             const size_t k0, const size_t j0, const size_t kc,
+             const size_t nc, BASE *Bp)
+{
+  size_t jr, k;
+  int c;
+
+  for (jr = 0; jr < nc; jr += GEMM_NR)
+    {
+      const size_t nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+      for (k = 0; k < kc; k++)
+        {
+          if (transB == CblasNoTrans)
+            {
+              const BASE *b = B + ldb * (k0 + k) + j0 + jr;
+              for (c = 0; c < (int) nr; c++)
+                Bp[k * GEMM_NR + c] = b[c];
+            }
+          else
+            {
+              for (c = 0; c < (int) nr; c++)
+                Bp[k * GEMM_NR + c] = B[ldb * (j0 + jr + c) + k0 + k];
+            }
+          for (c = (int) nr; c < GEMM_NR; c++)
+            Bp[k * GEMM_NR + c] = 0.0;
+        }
+      Bp += kc * GEMM_NR;
+    }
+}
+
+static size_t
+gemm_round_up (size_t n, size_t multiple)
+{
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+/* Offset of the packed B block, a cache line after the packed A block */
+static size_t
+gemm_pack_offset (const size_t m, const size_t K)
+{
+  const size_t mcMax = gemm_round_up ((m < GEMM_MC) ? m : GEMM_MC, GEMM_MR);
+  const size_t kcMax = (K < GEMM_KC) ? K : GEMM_KC;
+
+  return gemm_round_up (mcMax * kcMax, GEMM_ALIGN);
+}
+
+/* Number of elements gemm_blocked_rm needs for its packed panels */
+static size_t
+gemm_pack_size (const size_t m, const size_t n, const size_t K)
+{
+  const size_t kcMax = (K < GEMM_KC) ? K : GEMM_KC;
+  const size_t ncMax = gemm_round_up ((n < GEMM_NC) ? n : GEMM_NC, GEMM_NR);
+
+  return gemm_pack_offset (m, K) + kcMax * ncMax;
+}
+
+/* Row major C := alpha op(F) op(G) + beta C with C m x n and a shared
+   dimension K, Ap holds gemm_pack_size (m, n, K) elements */
+static void
+gemm_blocked_rm (const int transF, const int transG, const size_t m,
+                 const size_t n, const size_t K, const BASE alpha,
+                 const BASE *F, const size_t ldf, const BASE *G,
+                 const size_t ldg, const BASE beta, BASE *C,
+                 const size_t ldc, BASE *Ap)
+{
+  BASE *Bp = Ap + gemm_pack_offset (m, K);
+  size_t i, j;
+  size_t jc, pc, ic, jr, ir;
+
+  /* form  C := beta*C, like the reference loop */
+  if (beta == 0.0)
+    {
+      for (i = 0; i < m; i++)
+        for (j = 0; j < n; j++)
+          C[ldc * i + j] = 0.0;
+    }
+  else if (beta != 1.0)
+    {
+      for (i = 0; i < m; i++)
+        for (j = 0; j < n; j++)
+          C[ldc * i + j] *= beta;
+    }
+
+  if (alpha == 0.0 || K == 0)
+    return;
+
+  for (jc = 0; jc < n; jc += GEMM_NC)
+    {
+      const size_t nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+      for (pc = 0; pc < K; pc += GEMM_KC)
+        {
+          const size_t kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+
+          gemm_pack_B (transG, G, ldg, pc, jc, kc, nc, Bp);
+
+          for (ic = 0; ic < m; ic += GEMM_MC)
+            {
+              const size_t mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+
+              gemm_pack_A (transF, F, ldf, ic, pc, mc, kc, alpha, Ap);
+
+              for (jr = 0; jr < nc; jr += GEMM_NR)
+                {
+                  const size_t nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+                  for (ir = 0; ir < mc; ir += GEMM_MR)
+                    {
+                      const size_t mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+                      BASE tile[GEMM_MR * GEMM_NR];
+                      BASE *c = C + ldc * (ic + ir) + jc + jr;
+                      size_t r, q;
+
+                      gemm_kernel (kc, Ap + ir * kc, Bp + jr * kc, tile);
+
+                      for (r = 0; r < mr; r++)
+                        for (q = 0; q < nr; q++)
+                          c[ldc * r + q] += tile[r * GEMM_NR + q];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Threaded products split C in GEMM_MC x GEMM_TILE_N tiles, each one
+   computed by a single thread with the same blocking of the shared
+   dimension as the serial loop, so the result does not depend on the
+   number of threads. */
+#define GEMM_TILE_N 256
+
+/* below this many multiply-adds the threads cost more than they save */
+#define GEMM_MIN_THREADED_WORK (64 * 64 * 64)
+
+struct gemm_job
+{
+  int transF, transG;
+  size_t m, n, K;
+  BASE alpha;
+  const BASE *F;
+  size_t ldf;
+  const BASE *G;
+  size_t ldg;
+  BASE beta;
+  BASE *C;
+  size_t ldc;
+  size_t tilesN;
+};
+
+/* used for a tile when the packing buffer cannot grow */
+static void
+gemm_tile_naive (const struct gemm_job *job, const BASE *F, const BASE *G,
+                 BASE *C, const size_t m, const size_t n)
+{
+  size_t i, j, k;
+
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      {
+        BASE sum = 0.0;
+        for (k = 0; k < job->K; k++)
+          {
+            const BASE f = (job->transF == CblasNoTrans)
+              ? F[job->ldf * i + k] : F[job->ldf * k + i];
+            const BASE g = (job->transG == CblasNoTrans)
+              ? G[job->ldg * k + j] : G[job->ldg * j + k];
+            sum += (job->alpha * f) * g;
+          }
+        if (job->beta == 0.0)
+          C[job->ldc * i + j] = sum;
+        else
+          C[job->ldc * i + j] = job->beta * C[job->ldc * i + j] + sum;
+      }
+}
+
+static void
+gemm_tile (void *arg, size_t task)
+{
+  const struct gemm_job *job = arg;
+  const size_t i0 = (task / job->tilesN) * GEMM_MC;
+  const size_t j0 = (task % job->tilesN) * GEMM_TILE_N;
+  const size_t m = (job->m - i0 < GEMM_MC) ? job->m - i0 : GEMM_MC;
+  const size_t n = (job->n - j0 < GEMM_TILE_N) ? job->n - j0 : GEMM_TILE_N;
+  const BASE *F = job->F + ((job->transF == CblasNoTrans) ? i0 * job->ldf : i0);
+  const BASE *G = job->G + ((job->transG == CblasNoTrans) ? j0 : j0 * job->ldg);
+  BASE *C = job->C + i0 * job->ldc + j0;
+  BASE *Ap = gemm_pack_buffer (gemm_pack_size (m, n, job->K));
+
+  if (Ap != NULL)
+    gemm_blocked_rm (job->transF, job->transG, m, n, job->K, job->alpha,
+                     F, job->ldf, G, job->ldg, job->beta, C, job->ldc, Ap);
+  else
+    gemm_tile_naive (job, F, G, C, m, n);
+}
+
+/* C := alpha op(A) op(B) + beta C, returns -1 when the packing buffer
+   cannot grow so that the caller can fall back to the
+   reference loop */
+static int
+gemm_blocked (const enum CBLAS_ORDER Order, const enum CBLAS_TRANSPOSE TransA,
+              const enum CBLAS_TRANSPOSE TransB, const int M, const int N,
+              const int K, const BASE alpha, const BASE *A, const int lda,
+              const BASE *B, const int ldb, const BASE beta, BASE *C,
+              const int ldc)
+{
+  struct gemm_job job;
+  size_t tilesM;
+  BASE *Ap;
+
+  if (Order == CblasRowMajor)
+    {
+      job.m = M;
+      job.n = N;
+      job.F = A;
+      job.ldf = lda;
+      job.transF = (TransA == CblasConjTrans) ? CblasTrans : TransA;
+      job.G = B;
+      job.ldg = ldb;
+      job.transG = (TransB == CblasConjTrans) ? CblasTrans : TransB;
+    }
+  else
+    {
+      job.m = N;
+      job.n = M;
+      job.F = B;
+      job.ldf = ldb;
+      job.transF = (TransB == CblasConjTrans) ? CblasTrans : TransB;
+      job.G = A;
+      job.ldg = lda;
+      job.transG = (TransA == CblasConjTrans) ? CblasTrans : TransA;
+    }
+  job.K = K;
+  job.alpha = alpha;
+  job.beta = beta;
+  job.C = C;
+  job.ldc = ldc;
+
+  tilesM = (job.m + GEMM_MC - 1) / GEMM_MC;
+  job.tilesN = (job.n + GEMM_TILE_N - 1) / GEMM_TILE_N;
+
+  if (cblas_pool_threads () > 1 && tilesM * job.tilesN > 1 && alpha != 0.0
+      && (double) job.m * job.n * job.K >= GEMM_MIN_THREADED_WORK)
+    {
+      cblas_pool_run (gemm_tile, &job, tilesM * job.tilesN);
+      return 0;
+    }
+
+  Ap = gemm_pack_buffer (gemm_pack_size (job.m, job.n, job.K));
+  if (Ap == NULL)
+    return -1;
+
+  gemm_blocked_rm (job.transF, job.transG, job.m, job.n, job.K, alpha,
+                   job.F, job.ldf, job.G, job.ldg, beta, C, job.ldc, Ap);
+  return 0;
+}
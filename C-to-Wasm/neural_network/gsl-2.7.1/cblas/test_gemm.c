@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include <gsl/gsl_test.h>
 #include <gsl/gsl_ieee_utils.h>
 #include <gsl/gsl_math.h>
@@ -1397,3 +1399,135 @@ const double flteps = 1e-4, dbleps = 1e-6;
 
 
 }
+
+/* Products large enough to go through the blocked dgemm and sgemm,
+   checked against a plain triple loop for every order and transposition,
+   with edges that are not multiples of the register tile and blocks that
+   span several cache panels.  The values are representable as floats so
+   that both products share the expected result. */
+
+static double
+test_gemm_large_value (unsigned long *state)
+{
+  *state = (*state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+  return (float) ((double) *state / 0x7fffffffUL - 0.5);
+}
+
+void
+test_gemm_large (void) {
+  const int shapes[][3] = { { 16, 16, 16 }, { 37, 45, 29 },
+                            { 130, 19, 300 }, { 17, 2050, 16 } };
+  const double betas[] = { 0.0, 1.0, -0.3 };
+  const double alpha = 0.7;
+  unsigned long state = 1;
+  size_t s;
+  int order, transA, transB, count = 0;
+
+  for (s = 0; s < sizeof (shapes) / sizeof (shapes[0]); s++)
+    for (order = CblasRowMajor; order <= CblasColMajor; order++)
+      for (transA = CblasNoTrans; transA <= CblasTrans; transA++)
+        for (transB = CblasNoTrans; transB <= CblasTrans; transB++)
+          {
+            const int M = shapes[s][0], N = shapes[s][1], K = shapes[s][2];
+            const double beta = betas[count++ % 3];
+            /* leading dimensions with padding */
+            const int rowsA = (transA == CblasNoTrans) ? M : K;
+            const int colsA = (transA == CblasNoTrans) ? K : M;
+            const int rowsB = (transB == CblasNoTrans) ? K : N;
+            const int colsB = (transB == CblasNoTrans) ? N : K;
+            const int lda = ((order == CblasRowMajor) ? colsA : rowsA) + 3;
+            const int ldb = ((order == CblasRowMajor) ? colsB : rowsB) + 1;
+            const int ldc = ((order == CblasRowMajor) ? N : M) + 2;
+            const size_t sizeA = (size_t) lda * ((order == CblasRowMajor) ? rowsA : colsA);
+            const size_t sizeB = (size_t) ldb * ((order == CblasRowMajor) ? rowsB : colsB);
+            const size_t sizeC = (size_t) ldc * ((order == CblasRowMajor) ? M : N);
+            double *A = malloc (sizeA * sizeof (double));
+            double *B = malloc (sizeB * sizeof (double));
+            double *C = malloc (sizeC * sizeof (double));
+            double *C_expected = malloc (sizeC * sizeof (double));
+            double *C_threaded = malloc (sizeC * sizeof (double));
+            float *fA = malloc (sizeA * sizeof (float));
+            float *fB = malloc (sizeB * sizeof (float));
+            float *fC = malloc (sizeC * sizeof (float));
+            float *fC_threaded = malloc (sizeC * sizeof (float));
+            const int threads = gsl_blas_get_num_threads ();
+            size_t n;
+            int i, j, k;
+
+            for (n = 0; n < sizeA; n++)
+              A[n] = test_gemm_large_value (&state);
+            for (n = 0; n < sizeB; n++)
+              B[n] = test_gemm_large_value (&state);
+            for (n = 0; n < sizeC; n++)
+              C[n] = C_expected[n] = C_threaded[n] = test_gemm_large_value (&state);
+            for (n = 0; n < sizeA; n++)
+              fA[n] = A[n];
+            for (n = 0; n < sizeB; n++)
+              fB[n] = B[n];
+            for (n = 0; n < sizeC; n++)
+              fC[n] = fC_threaded[n] = C[n];
+
+            for (i = 0; i < M; i++)
+              for (j = 0; j < N; j++)
+                {
+                  const size_t c = (order == CblasRowMajor) ? (size_t) ldc * i + j : (size_t) ldc * j + i;
+                  double sum = 0.0;
+                  for (k = 0; k < K; k++)
+                    {
+                      const int ai = (transA == CblasNoTrans) ? i : k;
+                      const int aj = (transA == CblasNoTrans) ? k : i;
+                      const int bi = (transB == CblasNoTrans) ? k : j;
+                      const int bj = (transB == CblasNoTrans) ? j : k;
+                      const double a = (order == CblasRowMajor) ? A[(size_t) lda * ai + aj] : A[(size_t) lda * aj + ai];
+                      const double b = (order == CblasRowMajor) ? B[(size_t) ldb * bi + bj] : B[(size_t) ldb * bj + bi];
+                      sum += a * b;
+                    }
+                  C_expected[c] = alpha * sum + ((beta == 0.0) ? 0.0 : beta * C_expected[c]);
+                }
+
+            cblas_dgemm (order, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+
+            {
+              int failed = 0;
+              for (n = 0; n < sizeC && !failed; n++)
+                failed = fabs (C[n] - C_expected[n]) > 1e-12 * K;
+              gsl_test (failed, "dgemm large (M=%d N=%d K=%d order=%d transA=%d transB=%d)",
+                        M, N, K, order, transA, transB);
+            }
+
+            /* the threaded product must be bit for bit the serial one */
+            gsl_blas_set_num_threads ((threads > 1) ? 1 : 4);
+            cblas_dgemm (order, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C_threaded, ldc);
+            gsl_blas_set_num_threads (threads);
+            gsl_test (memcmp (C, C_threaded, sizeC * sizeof (double)) != 0,
+                      "dgemm large threads (M=%d N=%d K=%d order=%d transA=%d transB=%d)",
+                      M, N, K, order, transA, transB);
+
+            cblas_sgemm (order, transA, transB, M, N, K, (float) alpha, fA, lda, fB, ldb, (float) beta, fC, ldc);
+
+            {
+              int failed = 0;
+              for (n = 0; n < sizeC && !failed; n++)
+                failed = fabs (fC[n] - C_expected[n]) > 1e-6 * K;
+              gsl_test (failed, "sgemm large (M=%d N=%d K=%d order=%d transA=%d transB=%d)",
+                        M, N, K, order, transA, transB);
+            }
+
+            gsl_blas_set_num_threads ((threads > 1) ? 1 : 4);
+            cblas_sgemm (order, transA, transB, M, N, K, (float) alpha, fA, lda, fB, ldb, (float) beta, fC_threaded, ldc);
+            gsl_blas_set_num_threads (threads);
+            gsl_test (memcmp (fC, fC_threaded, sizeC * sizeof (float)) != 0,
+                      "sgemm large threads (M=%d N=%d K=%d order=%d transA=%d transB=%d)",
+                      M, N, K, order, transA, transB);
+
+            free (A);
+            free (B);
+            free (C);
+            free (C_expected);
+            free (C_threaded);
+            free (fA);
+            free (fB);
+            free (fC);
+            free (fC_threaded);
+          }
+}
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include <gsl/gsl_test.h>
 #include <gsl/gsl_ieee_utils.h>
 #include <gsl/gsl_math.h>
@@ -501,3 +503,46 @@ const double flteps = 1e-4, dbleps = 1e-6;
 
 
 }
+
+void
+test_gemv_threads (void) {
+  const int M = 300, N = 270, lda = 275;
+  const int threads = gsl_blas_get_num_threads ();
+  double *A = malloc ((size_t) M * lda * sizeof (double));
+  double *X = malloc ((size_t) 2 * GSL_MAX (M, N) * sizeof (double));
+  double *Y = malloc ((size_t) 3 * GSL_MAX (M, N) * sizeof (double));
+  double *Y_threaded = malloc ((size_t) 3 * GSL_MAX (M, N) * sizeof (double));
+  int order, trans;
+  size_t n;
+
+  for (n = 0; n < (size_t) M * lda; n++)
+    A[n] = (double) ((n * 7919) % 1009) / 1009.0 - 0.5;
+  for (n = 0; n < (size_t) 2 * GSL_MAX (M, N); n++)
+    X[n] = (double) ((n * 104729) % 997) / 997.0 - 0.5;
+
+  for (order = CblasRowMajor; order <= CblasColMajor; order++)
+    for (trans = CblasNoTrans; trans <= CblasTrans; trans++)
+      {
+        /* keep A valid with lda for both orders */
+        const int rows = (order == CblasRowMajor) ? M : lda;
+        const int cols = (order == CblasRowMajor) ? N : 250;
+
+        for (n = 0; n < (size_t) 3 * GSL_MAX (M, N); n++)
+          Y[n] = Y_threaded[n] = (double) n / 100.0;
+
+        cblas_dgemv (order, trans, rows, cols, 0.7, A, lda, X, 2, -0.3, Y, 3);
+
+        /* every element of y must be bit for bit the serial one */
+        gsl_blas_set_num_threads ((threads > 1) ? 1 : 4);
+        cblas_dgemv (order, trans, rows, cols, 0.7, A, lda, X, 2, -0.3, Y_threaded, 3);
+        gsl_blas_set_num_threads (threads);
+
+        gsl_test (memcmp (Y, Y_threaded, (size_t) 3 * GSL_MAX (M, N) * sizeof (double)) != 0,
+                  "dgemv threads (order=%d trans=%d)", order, trans);
+      }
+
+  free (A);
+  free (X);
+  free (Y);
+  free (Y_threaded);
+}
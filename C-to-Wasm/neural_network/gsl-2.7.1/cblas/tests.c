@@ -11,6 +11,7 @@
   test_rotmg ();
   test_rotm ();
   test_gemv ();
+  test_gemv_threads ();
   test_gbmv ();
   test_trmv ();
   test_tbmv ();
@@ -34,6 +35,7 @@
   test_her2 ();
   test_hpr2 ();
   test_gemm ();
+  test_gemm_large ();
   test_symm ();
   test_hemm ();
   test_syrk ();
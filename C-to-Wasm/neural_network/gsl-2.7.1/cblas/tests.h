@@ -11,6 +11,7 @@ void test_rot (void);
 void test_rotmg (void);
 void test_rotm (void);
 void test_gemv (void);
+void test_gemv_threads (void);
 void test_gbmv (void);
 void test_trmv (void);
 void test_tbmv (void);
@@ -34,6 +35,7 @@ void test_spr2 (void);
 void test_her2 (void);
 void test_hpr2 (void);
 void test_gemm (void);
+void test_gemm_large (void);
 void test_symm (void);
 void test_hemm (void);
 void test_syrk (void);
@@ -0,0 +1,323 @@
+/* cblas/thread_pool.c
+ *
+ * Persistent worker pool used by the threaded dgemm, sgemm and dgemv.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <gsl/gsl_cblas.h>
+#include "thread_pool.h"
+
+#define CBLAS_POOL_MAX_THREADS 256
+
+static void
+run_serial (cblas_pool_task fn, void *arg, size_t nbTasks)
+{
+  size_t t;
+  for (t = 0; t < nbTasks; t++)
+    fn (arg, t);
+}
+
+#ifdef CBLAS_POOL_PTHREADS
+
+struct task_range
+{
+  pthread_mutex_t lock;
+  size_t begin;
+  size_t end;
+};
+
+/* held for the whole duration of a job and while resizing the pool */
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* protects generation, running, shutting_down and requested */
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static pthread_t *workers = NULL;
+static int nbWorkers = 0;
+static unsigned long generation = 0;
+/* generation when the current workers were created */
+static unsigned long start_generation = 0;
+static int running = 0;
+static int shutting_down = 0;
+/* read from GSL_NUM_THREADS by init_pool, then set explicitly */
+static int requested = 0;
+
+static struct task_range ranges[CBLAS_POOL_MAX_THREADS];
+static cblas_pool_task job_fn;
+static void *job_arg;
+static int job_threads;
+
+static int
+clamp_threads (int n)
+{
+  if (n < 1)
+    return 1;
+  if (n > CBLAS_POOL_MAX_THREADS)
+    return CBLAS_POOL_MAX_THREADS;
+  return n;
+}
+
+/* runs once, before any other access to requested */
+static void
+read_environment (void)
+{
+  const char *value = getenv ("GSL_NUM_THREADS");
+  requested = clamp_threads (value ? atoi (value) : 1);
+}
+
+static void
+init_pool (void)
+{
+  int i;
+  for (i = 0; i < CBLAS_POOL_MAX_THREADS; i++)
+    pthread_mutex_init (&ranges[i].lock, NULL);
+  read_environment ();
+}
+
+static int
+take_front (int id, size_t *task)
+{
+  struct task_range *r = &ranges[id];
+  int found = 0;
+
+  pthread_mutex_lock (&r->lock);
+  if (r->begin < r->end)
+    {
+      *task = r->begin++;
+      found = 1;
+    }
+  pthread_mutex_unlock (&r->lock);
+
+  return found;
+}
+
+static int
+steal_back (int victim, size_t *task)
+{
+  struct task_range *r = &ranges[victim];
+  int found = 0;
+
+  pthread_mutex_lock (&r->lock);
+  if (r->begin < r->end)
+    {
+      *task = --r->end;
+      found = 1;
+    }
+  pthread_mutex_unlock (&r->lock);
+
+  return found;
+}
+
+static void
+participate (int id)
+{
+  size_t task;
+  int v;
+
+  while (take_front (id, &task))
+    job_fn (job_arg, task);
+
+  for (v = 1; v < job_threads; v++)
+    {
+      const int victim = (id + v) % job_threads;
+      while (steal_back (victim, &task))
+        job_fn (job_arg, task);
+    }
+}
+
+static void *
+worker_main (void *p)
+{
+  const int id = (int) (size_t) p;
+  unsigned long seen = start_generation;
+
+  pthread_mutex_lock (&state_lock);
+  for (;;)
+    {
+      while (generation == seen && !shutting_down)
+        pthread_cond_wait (&start_cond, &state_lock);
+      if (shutting_down)
+        break;
+      seen = generation;
+      pthread_mutex_unlock (&state_lock);
+
+      participate (id);
+
+      pthread_mutex_lock (&state_lock);
+      if (--running == 0)
+        pthread_cond_signal (&done_cond);
+    }
+  pthread_mutex_unlock (&state_lock);
+
+  return NULL;
+}
+
+/* job_lock must be held */
+static void
+stop_workers (void)
+{
+  int i;
+
+  pthread_mutex_lock (&state_lock);
+  shutting_down = 1;
+  pthread_cond_broadcast (&start_cond);
+  pthread_mutex_unlock (&state_lock);
+
+  for (i = 0; i < nbWorkers; i++)
+    pthread_join (workers[i], NULL);
+
+  free (workers);
+  workers = NULL;
+  nbWorkers = 0;
+  shutting_down = 0;
+}
+
+/* job_lock must be held, returns the number of usable threads */
+static int
+start_workers (int threads)
+{
+  int i;
+
+  if (nbWorkers == threads - 1)
+    return threads;
+
+  stop_workers ();
+
+  workers = malloc ((threads - 1) * sizeof (pthread_t));
+  if (workers == NULL)
+    return 1;
+
+  /* a worker that is slow to start must still see the next job */
+  start_generation = generation;
+  for (i = 1; i < threads; i++)
+    {
+      if (pthread_create (&workers[i - 1], NULL, worker_main, (void *) (size_t) i) != 0)
+        break;
+      nbWorkers++;
+    }
+
+  return nbWorkers + 1;
+}
+
+int
+cblas_pool_threads (void)
+{
+  int n;
+
+  pthread_once (&init_once, init_pool);
+
+  pthread_mutex_lock (&state_lock);
+  n = requested;
+  pthread_mutex_unlock (&state_lock);
+
+  return n;
+}
+
+void
+cblas_pool_run (cblas_pool_task fn, void *arg, size_t nbTasks)
+{
+  int threads = cblas_pool_threads ();
+  int i;
+
+  if (threads <= 1 || nbTasks <= 1 || pthread_mutex_trylock (&job_lock) != 0)
+    {
+      run_serial (fn, arg, nbTasks);
+      return;
+    }
+
+  threads = start_workers (threads);
+  if (threads <= 1)
+    {
+      pthread_mutex_unlock (&job_lock);
+      run_serial (fn, arg, nbTasks);
+      return;
+    }
+
+  for (i = 0; i < threads; i++)
+    {
+      ranges[i].begin = nbTasks * i / threads;
+      ranges[i].end = nbTasks * (i + 1) / threads;
+    }
+  job_fn = fn;
+  job_arg = arg;
+  job_threads = threads;
+
+  pthread_mutex_lock (&state_lock);
+  running = nbWorkers;
+  generation++;
+  pthread_cond_broadcast (&start_cond);
+  pthread_mutex_unlock (&state_lock);
+
+  participate (0);
+
+  pthread_mutex_lock (&state_lock);
+  while (running > 0)
+    pthread_cond_wait (&done_cond, &state_lock);
+  pthread_mutex_unlock (&state_lock);
+
+  pthread_mutex_unlock (&job_lock);
+}
+
+void
+gsl_blas_set_num_threads (int n)
+{
+  pthread_once (&init_once, init_pool);
+
+  n = clamp_threads (n);
+
+  pthread_mutex_lock (&job_lock);
+  pthread_mutex_lock (&state_lock);
+  requested = n;
+  pthread_mutex_unlock (&state_lock);
+  if (nbWorkers > 0 && nbWorkers != n - 1)
+    stop_workers ();
+  pthread_mutex_unlock (&job_lock);
+}
+
+#else /* !CBLAS_POOL_PTHREADS */
+
+/* without threads GSL_NUM_THREADS and the requested count have no effect */
+
+int
+cblas_pool_threads (void)
+{
+  return 1;
+}
+
+void
+cblas_pool_run (cblas_pool_task fn, void *arg, size_t nbTasks)
+{
+  run_serial (fn, arg, nbTasks);
+}
+
+void
+gsl_blas_set_num_threads (int n)
+{
+  (void) n;
+}
+
+#endif /* CBLAS_POOL_PTHREADS */
+
+int
+gsl_blas_get_num_threads (void)
+{
+  return cblas_pool_threads ();
+}
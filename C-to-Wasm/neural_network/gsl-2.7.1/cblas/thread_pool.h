@@ -0,0 +1,45 @@
+/* cblas/thread_pool.h
+ *
+ * Persistent worker pool used by the threaded dgemm, sgemm and dgemv.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GSL_CBLAS_THREAD_POOL_H__
+#define __GSL_CBLAS_THREAD_POOL_H__
+
+#include <stddef.h>
+
+/* WebAssembly builds only get threads with emscripten -pthread */
+#if (defined(__unix__) || defined(__APPLE__)) \
+    && !(defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__))
+#define CBLAS_POOL_PTHREADS 1
+#include <pthread.h>
+#endif
+
+typedef void (*cblas_pool_task) (void *arg, size_t task);
+
+/* Number of threads a job may use, 1 unless gsl_blas_set_num_threads()
+   or the GSL_NUM_THREADS environment variable asked for more. */
+int cblas_pool_threads (void);
+
+/* Runs fn(arg, t) for every t in [0, nbTasks) and returns once all of
+   them are done.  The calling thread takes part; tasks are split in
+   contiguous ranges, one per thread, and idle threads steal from the
+   end of the other ranges.  When the pool is busy with another job or
+   unavailable the tasks run in order on the calling thread. */
+void cblas_pool_run (cblas_pool_task fn, void *arg, size_t nbTasks);
+
+#endif /* __GSL_CBLAS_THREAD_POOL_H__ */
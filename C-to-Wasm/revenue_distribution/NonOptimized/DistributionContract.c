@@ -3,36 +3,83 @@
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "hashmap.h"
 #include "DistributionContract.h"
+#include "Persistence.h"
+#include "Sharding.h"
 
 // Utility function prototype
-void distributeRevenue(DistributionContract* contract, double amount);
+void distributeRevenue(DistributionContract* contract, double amount, size_t nbThreads);
 
-// Hash function
+// Contiguous part of the ledger distributed by one thread
+typedef struct {
+    const DistributionContract* contract;
+    size_t begin;
+    size_t end;
+    double perShare;
+    __uint128_t exactPerShare;
+    // ACCOUNTING_EXACT, the whole units credited to the users of the shard
+    uint64_t credited;
+} DistributionShard;
+
+// 64 x 64 -> 128 bit multiplication folded back to 64 bits, the mixing step of wyhash
+static uint64_t foldedMultiply(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+// Hash function, the address has a fixed width so it is read as three words without any loop
 uint64_t userDataHash(const void* item, uint64_t seed0, uint64_t seed1) {
     const UserState* userState = item;
-    return hashmap_sip(userState->address, strlen(userState->address), seed0, seed1);
+    uint64_t low, middle;
+    uint32_t high;
+    memcpy(&low, userState->address.bytes, sizeof(low));
+    memcpy(&middle, userState->address.bytes + 8, sizeof(middle));
+    memcpy(&high, userState->address.bytes + 16, sizeof(high));
+    uint64_t h = foldedMultiply(low ^ seed0 ^ 0xa0761d6478bd642full, middle ^ seed1 ^ 0xe7037ed1a0b428dbull);
+    return foldedMultiply(h ^ high ^ 0x8ebc6af09c88c6e3ull, ADDRESS_LENGTH ^ 0x589965cc75374cc3ull);
 }
 
 // Compare function
 int userDataCompare(const void* a, const void* b, void* udata) {
     const UserState* userState1 = a;
     const UserState* userState2 = b;
-    return strcmp(userState1->address, userState2->address);
+    return memcmp(userState1->address.bytes, userState2->address.bytes, ADDRESS_LENGTH);
+}
+
+// Random seed of a new map, so that the addresses colliding in a map cannot be known in advance
+static uint64_t randomSeed(void) {
+    uint64_t seed;
+    if(getentropy(&seed, sizeof(seed))) {
+        // splitmix64 of the clock and of an address, not random but still different between maps
+        seed = (uint64_t) clock() ^ (uint64_t) time(NULL) << 20 ^ (uint64_t) (uintptr_t) &seed;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+        seed ^= seed >> 31;
+    }
+    return seed;
 }
 
 /**
  * @brief Constructs a distribution contract
+ * In ACCOUNTING_EXACT the amounts given to the contract are whole units up to EXACT_MAX_UNITS, other ones revert
  * 
+ * @param accounting The arithmetic of the contract
  * @return DistributionContract*
  */
-DistributionContract* constructContract() {
+DistributionContract* constructContract(AccountingMode accounting) {
+    // Sanity checks
+    if(accounting != ACCOUNTING_DOUBLE && accounting != ACCOUNTING_EXACT) return NULL;
     DistributionContract* contract = calloc(1, sizeof(DistributionContract));
     if(!contract) return NULL;
-    contract->userStateMap = hashmap_new(sizeof(UserState), 0, 0, 0, userDataHash, userDataCompare, NULL, NULL);
-    if(!contract->userStateMap) {
-        free(contract);
+    contract->accounting = accounting;
+    contract->userStateMap = hashmap_new(sizeof(UserState), 0, randomSeed(), randomSeed(), userDataHash, userDataCompare, NULL, NULL);
+    contract->capacity = LEDGER_INIT_CAPACITY;
+    contract->shares = calloc(contract->capacity, sizeof(double));
+    contract->revenues = calloc(contract->capacity, sizeof(double));
+    if(!contract->userStateMap || !contract->shares || !contract->revenues) {
+        destroyContract(contract);
         return NULL;
     }
     return contract;
@@ -47,9 +94,113 @@ void destroyContract(DistributionContract* contract) {
    // Sanitization
    if(!contract) return;
    hashmap_free(contract->userStateMap);
+   free(contract->shares);
+   free(contract->revenues);
    free(contract);
 }
 
+/**
+ * @brief Doubles the capacity of the ledger until it holds nbUsers users, the new entries are zero
+ * 
+ * @param contract The contract 
+ * @param nbUsers The users to hold
+ * @return int Success code: 0 if succeeded else failure
+ */
+int reserveLedger(DistributionContract* contract, size_t nbUsers) {
+    size_t capacity = contract->capacity;
+    while(capacity < nbUsers) capacity *= 2;
+    if(capacity == contract->capacity) return EXIT_SUCCESS;
+    double* shares = realloc(contract->shares, capacity * sizeof(double));
+    if(!shares) return EXIT_FAILURE;
+    contract->shares = shares;
+    double* revenues = realloc(contract->revenues, capacity * sizeof(double));
+    if(!revenues) return EXIT_FAILURE;
+    contract->revenues = revenues;
+    memset(shares + contract->capacity, 0, (capacity - contract->capacity) * sizeof(double));
+    memset(revenues + contract->capacity, 0, (capacity - contract->capacity) * sizeof(double));
+    contract->capacity = capacity;
+    return EXIT_SUCCESS;
+}
+
+// Makes room in the journal, if any, before an operation changes anything, so that recording it cannot fail
+static int reserveOperation(DistributionContract* contract) {
+    return contract->journal ? reserveJournal(contract->journal) : EXIT_SUCCESS;
+}
+
+// Counts an applied operation and appends it to the journal, if any
+static void recordOperation(DistributionContract* contract, JournalOperation operation, const Address* address,
+    double amount) {
+    contract->sequence++;
+    if(contract->journal) appendJournal(contract->journal, contract->sequence, operation, address, amount);
+}
+
+// Whole units of an amount in ACCOUNTING_EXACT
+static int wholeUnits(double amount, int64_t* units) {
+    if(!(fabs(amount) <= EXACT_MAX_UNITS) || amount != trunc(amount)) return EXIT_FAILURE;
+    *units = (int64_t) amount;
+    return EXIT_SUCCESS;
+}
+
+// applyChange in ACCOUNTING_EXACT
+static int applyExactChange(DistributionContract* contract, const Address* dest, double change, uint64_t hash) {
+    int64_t units;
+    if(wholeUnits(change, &units)) return EXIT_FAILURE;
+    // Check whether the transaction will cause a global over/underflow
+    uint64_t newTotalShare = contract->exactTotalShare + (uint64_t) units;
+    if(units < 0 ? (uint64_t) -units > contract->exactTotalShare : newTotalShare < contract->exactTotalShare) {
+        return EXIT_FAILURE;
+    }
+    // Room for a new user, taking the next index
+    if(contract->nbUsers == UINT32_MAX || reserveLedger(contract, contract->nbUsers + 1)) return EXIT_FAILURE;
+    // Resolve the user in the ledger, a single probe finds it or inserts it
+    bool inserted;
+    const UserState* userState = hashmap_upsert_with_hash(contract->userStateMap,
+        &(UserState){ *dest, (uint32_t) contract->nbUsers }, hash, &inserted);
+    if(!userState) return EXIT_FAILURE;
+    size_t id = userState->id;
+    // Check whether the transaction will cause a user underflow
+    if(units < 0 && (uint64_t) -units > contract->exactShares[id]) {
+        if(inserted) hashmap_delete(contract->userStateMap, &(UserState){ .address = *dest });
+        return EXIT_FAILURE;
+    }
+    if(inserted) contract->nbUsers++;
+    // Update global and user data
+    contract->exactTotalShare = newTotalShare;
+    contract->exactShares[id] += (uint64_t) units;
+    recordOperation(contract, JOURNAL_CHANGE_SHARE, dest, change);
+    return EXIT_SUCCESS;
+}
+
+// Updates one user, the hash of its address is already known
+static int applyChange(DistributionContract* contract, const Address* dest, double change, uint64_t hash) {
+    // Sanity checks, a change that cannot be journaled reverts before anything is applied
+    if(change == 0 || reserveOperation(contract)) return EXIT_FAILURE;
+    if(contract->accounting == ACCOUNTING_EXACT) return applyExactChange(contract, dest, change, hash);
+    // Check whether the transaction will cause a global over/underflow
+    double newTotalShare = contract->totalShare + change;
+    if(newTotalShare < 0 || !isfinite(newTotalShare)) return EXIT_FAILURE;
+    // Room for a new user, taking the next index
+    if(contract->nbUsers == UINT32_MAX || reserveLedger(contract, contract->nbUsers + 1)) return EXIT_FAILURE;
+    // Resolve the user in the ledger, a single probe finds it or inserts it
+    bool inserted;
+    const UserState* userState = hashmap_upsert_with_hash(contract->userStateMap,
+        &(UserState){ *dest, (uint32_t) contract->nbUsers }, hash, &inserted);
+    if(!userState) return EXIT_FAILURE;
+    size_t id = userState->id;
+    // Check whether the transaction will cause a user underflow
+    double newUserShare = contract->shares[id] + change;
+    if(newUserShare < 0) {
+        if(inserted) hashmap_delete(contract->userStateMap, &(UserState){ .address = *dest });
+        return EXIT_FAILURE;
+    }
+    if(inserted) contract->nbUsers++;
+    // Update global and user data
+    contract->totalShare = newTotalShare;
+    contract->shares[id] = newUserShare;
+    recordOperation(contract, JOURNAL_CHANGE_SHARE, dest, change);
+    return EXIT_SUCCESS;
+}
+
 /**
  * @brief Function to add share to the destination address
  * WARNING: Any user may add as much share as they want
@@ -61,30 +212,44 @@ void destroyContract(DistributionContract* contract) {
  * @param change The amount to add/remove
  * @return int Success code: 0 if succeeded else transaction revert
  */
-int changeShare(DistributionContract* contract, char* dest, double change) {
+int changeShare(DistributionContract* contract, const Address* dest, double change) {
     // Sanity checks
-    if(change == 0 || !contract || !dest) return EXIT_FAILURE;
-    // Check whether the transaction will cause a global over/underflow
-    double newTotalShare = contract->totalShare + change;
-    if(newTotalShare < 0 || !isfinite(newTotalShare)) return EXIT_FAILURE;
-    // Update global data
-    contract->totalShare = newTotalShare;
-    // Update user data
-    UserState* userState = hashmap_get(contract->userStateMap, &(UserState){ .address = dest });
-    UserState tmp = { 0 };
-    if(!userState) {
-        // If no mapping exists
-        tmp = (UserState){ dest, 0, 0 };    
-    } else {
-        // If there was a mapping
-        tmp = *userState;
+    if(!contract || !dest) return EXIT_FAILURE;
+    UserState key = { .address = *dest };
+    return applyChange(contract, dest, change, hashmap_hash(contract->userStateMap, &key));
+}
+
+/**
+ * @brief Applies n share changes in order, like n calls to changeShare
+ * The map and the ledger are sized for n more users once, and the buckets of the addresses are prefetched block by block
+ * 
+ * @param contract The contract 
+ * @param dests The destination addresses of the changes
+ * @param changes The amounts to add/remove
+ * @param n The number of changes
+ * @return int Success code: 0 if every change succeeded else EXIT_FAILURE, the failing changes alone are reverted,
+ * a change that cannot be journaled fails before it is applied
+ */
+int changeShareBatch(DistributionContract* contract, const Address* dests, const double* changes, size_t n) {
+    // Sanity checks
+    if(!contract || (n && (!dests || !changes))) return EXIT_FAILURE;
+    size_t nbUsers = contract->nbUsers + n;
+    if(!hashmap_reserve(contract->userStateMap, nbUsers) || reserveLedger(contract, nbUsers)) return EXIT_FAILURE;
+    int result = EXIT_SUCCESS;
+    uint64_t hashes[CHANGE_BATCH_BLOCK];
+    for(size_t begin = 0; begin < n; begin += CHANGE_BATCH_BLOCK) {
+        size_t size = n - begin < CHANGE_BATCH_BLOCK ? n - begin : CHANGE_BATCH_BLOCK;
+        // Every bucket of the block is requested before the first one is needed
+        for(size_t i = 0; i < size; i++) {
+            UserState key = { .address = dests[begin + i] };
+            hashes[i] = hashmap_hash(contract->userStateMap, &key);
+            hashmap_prefetch(contract->userStateMap, hashes[i]);
+        }
+        for(size_t i = 0; i < size; i++) {
+            if(applyChange(contract, &dests[begin + i], changes[begin + i], hashes[i])) result = EXIT_FAILURE;
+        }
     }
-    double newUserShare = tmp.share + change;
-    // Check whether the transaction will cause a user underflow
-    if(newUserShare < 0) return EXIT_FAILURE;
-    tmp.share = newUserShare;
-    hashmap_set(contract->userStateMap, &tmp);
-    return EXIT_SUCCESS;
+    return result;
 }
 
 /**
@@ -95,25 +260,103 @@ int changeShare(DistributionContract* contract, char* dest, double change) {
  * @return int Success code: 0 if succeeded else transaction revert
  */
 int addRevenue(DistributionContract* contract, double amount) {
+    return addRevenueWithThreads(contract, amount, 1);
+}
+
+/**
+ * @brief Injects revenue into the contract, the ledger is split in one contiguous shard per thread, see runSharded
+ * 
+ * @param contract The destination address
+ * @param amount The amount to add 
+ * @param nbThreads At least 1
+ * @return int Success code: 0 if succeeded else transaction revert
+ */
+int addRevenueWithThreads(DistributionContract* contract, double amount, size_t nbThreads) {
     // Sanity checks
-    if(!contract || amount <= 0) return EXIT_FAILURE;
-    distributeRevenue(contract, amount);
+    if(!contract || amount <= 0 || nbThreads == 0) return EXIT_FAILURE;
+    int64_t units;
+    if(contract->accounting == ACCOUNTING_EXACT
+        && (wholeUnits(amount, &units) || (uint64_t) units > UINT64_MAX - contract->exactUndistributed)) {
+        return EXIT_FAILURE;
+    }
+    if(reserveOperation(contract)) return EXIT_FAILURE;
+    distributeRevenue(contract, amount, nbThreads);
+    recordOperation(contract, JOURNAL_ADD_REVENUE, NULL, amount);
     return EXIT_SUCCESS;
 }
 
+// One sweep over contiguous arrays, vectorized by the compiler
+static void* distributeShard(void* data) {
+    DistributionShard* shard = data;
+    const double* restrict shares = shard->contract->shares;
+    double* restrict revenues = shard->contract->revenues;
+    double perShare = shard->perShare;
+    for(size_t i = shard->begin; i < shard->end; i++) {
+        revenues[i] += shares[i] * perShare;
+    }
+    return NULL;
+}
+
+// Credits the whole units of their share to the users of the shard and returns their sum, the same two columns as
+// distributeShard are swept without any branch
+static inline __attribute__((always_inline)) uint64_t creditExactShard(DistributionShard* shard, uint64_t whole,
+    uint64_t fraction) {
+    const uint64_t* restrict shares = shard->contract->exactShares;
+    uint64_t* restrict revenues = shard->contract->exactRevenues;
+    uint64_t credited = 0;
+    // The whole part of the revenue per share is multiplied on 64 bits, a single 64 x 64 -> 128 bit product is left
+    for(size_t i = shard->begin; i < shard->end; i++) {
+        uint64_t revenue = shares[i] * whole + (uint64_t) (((__uint128_t) shares[i] * fraction) >> 64);
+        revenues[i] += revenue;
+        credited += revenue;
+    }
+    return credited;
+}
+
+// distributeShard in ACCOUNTING_EXACT
+static void* distributeExactShard(void* data) {
+    DistributionShard* shard = data;
+    uint64_t fraction = (uint64_t) shard->exactPerShare;
+    uint64_t whole = (uint64_t) (shard->exactPerShare >> 64);
+    // Less than a unit per share is the usual case, the loop is then compiled without the first product
+    shard->credited = whole == 0 ? creditExactShard(shard, 0, fraction) : creditExactShard(shard, whole, fraction);
+    return NULL;
+}
+
 /**
  * @brief Utility distribution function
  *
  * @param contract The destination address
  * @param amount The amount to distribute
+ * @param nbThreads At least 1
  */
-void distributeRevenue(DistributionContract* contract, double amount) {
-    // Naive loop
-    struct Node* i = contract->userStateMap->head;
-    void* item;
-    while(hashmap_iter(contract->userStateMap, &i, &item)) {
-        UserState* userState = item;
-        userState->revenue += (userState->share / contract->totalShare) * amount;
-        // printf("Nouvelle valeur: %s: %lf\n", userState->address, userState->revenue); // DEBUG
+void distributeRevenue(DistributionContract* contract, double amount, size_t nbThreads) {
+    // The revenue waits in the contract while nobody has a share
+    double perShare = 0;
+    __uint128_t exactPerShare = 0;
+    void* (*distribute)(void*) = distributeShard;
+    if(contract->accounting == ACCOUNTING_EXACT) {
+        contract->exactUndistributed += (uint64_t) amount;
+        if(contract->exactTotalShare == 0) return;
+        // The division is hoisted out of the loop
+        exactPerShare = ((__uint128_t) contract->exactUndistributed << 64) / contract->exactTotalShare;
+        distribute = distributeExactShard;
+    } else {
+        contract->undistributed += amount;
+        if(contract->totalShare == 0) return;
+        perShare = contract->undistributed / contract->totalShare;
+        contract->undistributed = 0;
+    }
+    size_t maxThreads = contract->nbUsers / DISTRIBUTION_MIN_SHARD;
+    if(nbThreads > maxThreads) nbThreads = maxThreads ? maxThreads : 1;
+    DistributionShard shards[nbThreads];
+    for(size_t t = 0; t < nbThreads; t++) {
+        shards[t] = (DistributionShard){ contract, contract->nbUsers * t / nbThreads,
+            contract->nbUsers * (t + 1) / nbThreads, perShare, exactPerShare, 0 };
     }
-}
\ No newline at end of file
+    runSharded(nbThreads, distribute, shards, sizeof(DistributionShard));
+    // The parts of a unit rounded off by every user stay in the contract for the next revenue
+    for(size_t t = 0; contract->accounting == ACCOUNTING_EXACT && t < nbThreads; t++) {
+        contract->exactUndistributed -= shards[t].credited;
+    }
+}
@@ -1,26 +1,79 @@
 #pragma once
 
+#include <stdint.h>
 #include "hashmap.h"
 
+// Bytes of an address, like Ethereum ones
+#define ADDRESS_LENGTH 20
+
+// A user address, stored inline in the hashmap entries and compared byte by byte
+typedef struct {
+    uint8_t bytes[ADDRESS_LENGTH];
+} Address;
+
+// Initial capacity of the ledger, doubled when full
+#define LEDGER_INIT_CAPACITY 1024
+// Addresses hashed and prefetched at once by changeShareBatch
+#define CHANGE_BATCH_BLOCK 16
+// Below this number of users per thread the shards are not worth a thread
+#define DISTRIBUTION_MIN_SHARD 65536
+
+// Arithmetic of the shares and of the revenue, chosen once when the contract is constructed
+typedef enum {
+    // Doubles, rounding drifts over long runs
+    ACCOUNTING_DOUBLE,
+    // Whole units in 64 bit integers and a 64.64 fixed point revenue per share, the parts of a unit rounded off are
+    // kept for the next revenue instead of dropped so that the revenue of the users and the undistributed units
+    // always add up to the revenue added
+    ACCOUNTING_EXACT
+} AccountingMode;
+
+// Largest amount in ACCOUNTING_EXACT, doubles hold every whole number up to it
+#define EXACT_MAX_UNITS 9007199254740992.0
+
 // The state of the contract at any moment
 typedef struct {
     struct hashmap* userStateMap;
+    AccountingMode accounting;
+    // ACCOUNTING_DOUBLE, and the revenue added while nobody had a share, added to the next revenue
     double totalShare;
+    double undistributed;
+    // ACCOUNTING_EXACT, and the whole units of revenue not credited yet, added to the next revenue: the parts of a
+    // unit rounded off by the users and the revenue added while nobody had a share
+    uint64_t exactTotalShare;
+    uint64_t exactUndistributed;
+    // Ledger, shares[id] and revenues[id] of the nbUsers users in order of arrival, whole units in ACCOUNTING_EXACT
+    size_t nbUsers;
+    size_t capacity;
+    union {
+        double* shares;
+        uint64_t* exactShares;
+    };
+    union {
+        double* revenues;
+        uint64_t* exactRevenues;
+    };
+    // Number of operations applied since the construction, the last one in the journal or in a snapshot
+    uint64_t sequence;
+    // NULL or where the applied operations are appended, see Persistence.h
+    struct ContractJournal* journal;
 } DistributionContract;
 
-// An entry of the hashmap
+// An entry of the hashmap, resolves an address to its index in the ledger
+// 32 bit indices keep the entry at 24 bytes, wasm32 memory could not hold more users anyway
 typedef struct {
-    char* address;
-    double share;
-    double revenue;
+    Address address;
+    uint32_t id;
 } UserState;
 
 /**
  * @brief Constructs a distribution contract
+ * In ACCOUNTING_EXACT the amounts given to the contract are whole units up to EXACT_MAX_UNITS, other ones revert
  * 
+ * @param accounting The arithmetic of the contract
  * @return DistributionContract*
  */
-DistributionContract* constructContract();
+DistributionContract* constructContract(AccountingMode accounting);
 
 /**
  * @brief Destroys a distribution contract
@@ -40,13 +93,46 @@ void destroyContract(DistributionContract* contract);
  * @param change The amount to add/remove
  * @return int Success code: 0 if succeeded else transaction revert
  */
-int changeShare(DistributionContract* contract, char* dest, double change);
+int changeShare(DistributionContract* contract, const Address* dest, double change);
+
+/**
+ * @brief Applies n share changes in order, like n calls to changeShare
+ * The map and the ledger are sized for n more users once, and the buckets of the addresses are prefetched block by block
+ * 
+ * @param contract The contract 
+ * @param dests The destination addresses of the changes
+ * @param changes The amounts to add/remove
+ * @param n The number of changes
+ * @return int Success code: 0 if every change succeeded else EXIT_FAILURE, the failing changes alone are reverted,
+ * a change that cannot be journaled fails before it is applied
+ */
+int changeShareBatch(DistributionContract* contract, const Address* dests, const double* changes, size_t n);
+
+/**
+ * @brief Doubles the capacity of the ledger until it holds nbUsers users, the new entries are zero
+ * 
+ * @param contract The contract 
+ * @param nbUsers The users to hold
+ * @return int Success code: 0 if succeeded else failure
+ */
+int reserveLedger(DistributionContract* contract, size_t nbUsers);
 
 /**
  * @brief Injects revenue into the contract
+ * Added while nobody has a share, the revenue goes to the users of the next one
  * 
  * @param contract The destination address
  * @param amount The amount to add 
  * @return int Success code: 0 if succeeded else transaction revert
  */
 int addRevenue(DistributionContract* contract, double amount);
+
+/**
+ * @brief Injects revenue into the contract, the ledger is split in one contiguous shard per thread, see runSharded
+ * 
+ * @param contract The destination address
+ * @param amount The amount to add 
+ * @param nbThreads At least 1
+ * @return int Success code: 0 if succeeded else transaction revert
+ */
+int addRevenueWithThreads(DistributionContract* contract, double amount, size_t nbThreads);
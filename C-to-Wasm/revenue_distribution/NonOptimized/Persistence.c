@@ -0,0 +1,233 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hashmap.h"
+#include "DistributionContract.h"
+#include "Persistence.h"
+
+#define SNAPSHOT_MAGIC "RDSNAPN3"
+
+// The snapshot starts with this header, the buckets of the user map follow, then the shares and the revenues
+typedef struct {
+    char magic[8];
+    uint64_t sequence;
+    uint64_t accounting;
+    double totalShare;
+    double undistributed;
+    uint64_t exactTotalShare;
+    uint64_t exactUndistributed;
+    uint64_t nbUsers;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t nbBuckets;
+    uint64_t bucketSize;
+    uint64_t count;
+} SnapshotHeader;
+
+// write() until everything is written
+static int writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = data;
+    while(size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return EXIT_FAILURE;
+        bytes += written;
+        size -= (size_t) written;
+    }
+    return EXIT_SUCCESS;
+}
+
+// pwrite() until everything is written at offset
+static int writeAllAt(int fd, const void* data, size_t size, uint64_t offset) {
+    const char* bytes = data;
+    while(size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, (off_t) offset);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return EXIT_FAILURE;
+        bytes += written;
+        size -= (size_t) written;
+        offset += (uint64_t) written;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Maps a whole file for reading, *data is NULL for a missing or empty file
+static int mapFile(const char* path, const void** data, size_t* size) {
+    *data = NULL;
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return errno == ENOENT ? EXIT_SUCCESS : EXIT_FAILURE;
+    struct stat status;
+    if(fstat(fd, &status)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if(status.st_size > 0) {
+        void* mapped = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        *data = mapped;
+        *size = (size_t) status.st_size;
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+ContractJournal* openJournal(const char* path, size_t groupSize) {
+    if(!path || groupSize == 0) return NULL;
+    ContractJournal* journal = calloc(1, sizeof(ContractJournal));
+    if(!journal) return NULL;
+    journal->groupSize = groupSize;
+    journal->pending = calloc(groupSize, sizeof(JournalRecord));
+    journal->fd = open(path, O_WRONLY | O_CREAT, 0644);
+    off_t size = journal->fd < 0 ? -1 : lseek(journal->fd, 0, SEEK_END);
+    journal->size = (uint64_t) size;
+    if(!journal->pending || size < 0) {
+        if(journal->fd >= 0) close(journal->fd);
+        free(journal->pending);
+        free(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+int flushJournal(ContractJournal* journal) {
+    if(!journal) return EXIT_FAILURE;
+    if(journal->nbPending == 0) return EXIT_SUCCESS;
+    // Written over the torn bytes of an attempt that failed, which would otherwise end the replay
+    size_t bytes = journal->nbPending * sizeof(JournalRecord);
+    if(writeAllAt(journal->fd, journal->pending, bytes, journal->size) || fsync(journal->fd)) return EXIT_FAILURE;
+    journal->size += bytes;
+    journal->nbPending = 0;
+    return EXIT_SUCCESS;
+}
+
+int reserveJournal(ContractJournal* journal) {
+    if(!journal) return EXIT_FAILURE;
+    // Still full as long as the group cannot be written
+    return journal->nbPending == journal->groupSize ? flushJournal(journal) : EXIT_SUCCESS;
+}
+
+void appendJournal(ContractJournal* journal, uint64_t sequence, JournalOperation operation, const Address* address,
+    double amount) {
+    journal->pending[journal->nbPending++] = (JournalRecord){ sequence, amount, address ? *address : (Address){ { 0 } },
+        operation };
+}
+
+void closeJournal(ContractJournal* journal) {
+    if(!journal) return;
+    flushJournal(journal);
+    close(journal->fd);
+    free(journal->pending);
+    free(journal);
+}
+
+int saveSnapshot(DistributionContract* contract, const char* path) {
+    if(!contract || !path) return EXIT_FAILURE;
+    size_t nbBuckets, bucketSize;
+    uint64_t seed0, seed1;
+    const void* buckets = hashmap_buckets(contract->userStateMap, &nbBuckets, &bucketSize, &seed0, &seed1);
+    SnapshotHeader header = { .sequence = contract->sequence, .accounting = contract->accounting,
+        .totalShare = contract->totalShare, .undistributed = contract->undistributed,
+        .exactTotalShare = contract->exactTotalShare, .exactUndistributed = contract->exactUndistributed, .nbUsers = contract->nbUsers, .seed0 = seed0, .seed1 = seed1, .nbBuckets = nbBuckets, .bucketSize = bucketSize,
+        .count = hashmap_count(contract->userStateMap) };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    // Written next to the snapshot and renamed over it, a crash leaves the previous snapshot whole
+    char* temporary = malloc(strlen(path) + sizeof(".tmp"));
+    if(!temporary) return EXIT_FAILURE;
+    sprintf(temporary, "%s.tmp", path);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int failed = fd < 0 || writeAll(fd, &header, sizeof(header)) || writeAll(fd, buckets, nbBuckets * bucketSize)
+        || writeAll(fd, contract->shares, contract->nbUsers * sizeof(double))
+        || writeAll(fd, contract->revenues, contract->nbUsers * sizeof(double)) || fsync(fd);
+    if(fd >= 0 && close(fd)) failed = 1;
+    if(!failed && rename(temporary, path)) failed = 1;
+    if(failed) unlink(temporary);
+    free(temporary);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int checkpointContract(DistributionContract* contract, const char* path) {
+    if(saveSnapshot(contract, path)) return EXIT_FAILURE;
+    if(!contract->journal) return EXIT_SUCCESS;
+    // Every record, pending ones included, is at most the sequence of the snapshot
+    contract->journal->nbPending = 0;
+    if(ftruncate(contract->journal->fd, 0)) return EXIT_FAILURE;
+    contract->journal->size = 0;
+    return EXIT_SUCCESS;
+}
+
+// The buckets and the ledger are copied from the mapping as they are, nothing is inserted again
+static int loadSnapshot(DistributionContract* contract, const char* path) {
+    const void* data;
+    size_t size;
+    if(mapFile(path, &data, &size)) return EXIT_FAILURE;
+    if(!data) return EXIT_SUCCESS;
+
+    const SnapshotHeader* header = data;
+    int failed = size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))
+        || header->accounting != contract->accounting || header->bucketSize == 0
+        || header->nbBuckets > (size - sizeof(SnapshotHeader)) / header->bucketSize
+        || header->nbUsers != header->count || header->nbUsers > size / (2 * sizeof(double))
+        || size - sizeof(SnapshotHeader) - header->nbBuckets * header->bucketSize != 2 * header->nbUsers * sizeof(double)
+        || reserveLedger(contract, header->nbUsers)
+        || !hashmap_load_buckets(contract->userStateMap, header + 1, header->nbBuckets, header->bucketSize,
+            header->count, header->seed0, header->seed1);
+    if(!failed) {
+        const double* shares = (const double*) ((const char*) (header + 1) + header->nbBuckets * header->bucketSize);
+        memcpy(contract->shares, shares, header->nbUsers * sizeof(double));
+        memcpy(contract->revenues, shares + header->nbUsers, header->nbUsers * sizeof(double));
+        contract->sequence = header->sequence;
+        contract->totalShare = header->totalShare;
+        contract->undistributed = header->undistributed;
+        contract->exactTotalShare = header->exactTotalShare;
+        contract->exactUndistributed = header->exactUndistributed;
+        contract->nbUsers = header->nbUsers;
+    }
+    munmap((void*) data, size);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int replayJournal(DistributionContract* contract, const char* path) {
+    const void* data;
+    size_t size;
+    if(mapFile(path, &data, &size)) return EXIT_FAILURE;
+    if(!data) return EXIT_SUCCESS;
+
+    // A partial record at the end is ignored like any record out of sequence
+    const JournalRecord* records = data;
+    size_t nbRecords = size / sizeof(JournalRecord);
+    size_t nbValid = 0;
+    int failed = 0;
+    for(; !failed && nbValid < nbRecords; nbValid++) {
+        const JournalRecord* record = &records[nbValid];
+        // Already in the snapshot
+        if(record->sequence <= contract->sequence) continue;
+        if(record->sequence != contract->sequence + 1) break;
+        if(record->operation == JOURNAL_CHANGE_SHARE) failed = changeShare(contract, &record->address, record->amount);
+        else if(record->operation == JOURNAL_ADD_REVENUE) failed = addRevenue(contract, record->amount);
+        else break;
+    }
+    munmap((void*) data, size);
+    // The torn end is cut off, the records appended from now on follow the replayed ones
+    if(!failed && nbValid * sizeof(JournalRecord) < size) failed = truncate(path, nbValid * sizeof(JournalRecord));
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+DistributionContract* restoreContract(AccountingMode accounting, const char* snapshotPath, const char* journalPath) {
+    DistributionContract* contract = constructContract(accounting);
+    if(!contract) return NULL;
+    if((snapshotPath && loadSnapshot(contract, snapshotPath)) || (journalPath && replayJournal(contract, journalPath))) {
+        destroyContract(contract);
+        return NULL;
+    }
+    return contract;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DistributionContract.h"
+
+/*
+ * Persistence of a contract in two files. The journal is an append only log of the operations applied to the
+ * contract, written to disk by groups of records and synced once per group. The snapshot is the whole state at some
+ * sequence: the globals followed by the robin-hood buckets of the user map as they are in memory, so that loading it
+ * is a single copy instead of one insertion per user. A contract is restored from its last snapshot and the records
+ * of the journal that follow it.
+ *
+ * Both files are in the byte order and layout of the machine that wrote them.
+ */
+
+// Records of the journal kept in memory before being written, by default
+#define JOURNAL_GROUP_SIZE 4096
+
+typedef enum {
+    JOURNAL_CHANGE_SHARE = 1,
+    JOURNAL_ADD_REVENUE = 2
+} JournalOperation;
+
+// One applied operation
+typedef struct {
+    // Position of the operation in the history of the contract, from 1
+    uint64_t sequence;
+    double amount;
+    // Zero for JOURNAL_ADD_REVENUE
+    Address address;
+    uint32_t operation;
+} JournalRecord;
+
+typedef struct ContractJournal {
+    int fd;
+    // End of the last group written and synced, where the next one goes
+    uint64_t size;
+    // Records written at once
+    size_t groupSize;
+    size_t nbPending;
+    JournalRecord* pending;
+} ContractJournal;
+
+/**
+ * @brief Opens a journal for appending, the file is created if needed
+ * Attach it to a contract through contract->journal, the contract does not own it
+ *
+ * @param path The file of the journal
+ * @param groupSize The records kept in memory before being written and synced, at least 1
+ * @return ContractJournal*, NULL on failure
+ */
+ContractJournal* openJournal(const char* path, size_t groupSize);
+
+/**
+ * @brief Makes room for the next record, the group is written and synced first if it is full
+ * Called before an operation changes the contract, appending its record cannot fail once it is applied
+ *
+ * @param journal The journal
+ * @return int Success code: 0 if succeeded else the full group could not be written, the operation must revert
+ */
+int reserveJournal(ContractJournal* journal);
+
+/**
+ * @brief Adds a record to the journal, room was made for it by reserveJournal
+ * A full group is written by the next reserveJournal or flushJournal
+ *
+ * @param journal The journal
+ * @param sequence The sequence of the contract after the operation
+ * @param operation The operation
+ * @param address The destination of the change, NULL for revenue
+ * @param amount The change or the revenue
+ */
+void appendJournal(ContractJournal* journal, uint64_t sequence, JournalOperation operation, const Address* address,
+    double amount);
+
+/**
+ * @brief Writes and syncs the pending records, an operation is durable once this returns for its group
+ *
+ * @param journal The journal
+ * @return int Success code: 0 if succeeded else failure
+ */
+int flushJournal(ContractJournal* journal);
+
+/**
+ * @brief Flushes and closes a journal
+ *
+ * @param journal The journal to be closed
+ */
+void closeJournal(ContractJournal* journal);
+
+/**
+ * @brief Writes the state of the contract to a snapshot, replacing it atomically
+ *
+ * @param contract The contract
+ * @param path The file of the snapshot
+ * @return int Success code: 0 if succeeded else failure
+ */
+int saveSnapshot(DistributionContract* contract, const char* path);
+
+/**
+ * @brief Saves a snapshot, then empties the journal of the contract since the snapshot covers it
+ *
+ * @param contract The contract
+ * @param path The file of the snapshot
+ * @return int Success code: 0 if succeeded else failure
+ */
+int checkpointContract(DistributionContract* contract, const char* path);
+
+/**
+ * @brief Constructs a contract from a snapshot and the records of a journal that follow it
+ * Replay stops at the first record out of sequence, e.g. the torn end of a group
+ *
+ * @param accounting The arithmetic of the contract, a snapshot of the other one is rejected
+ * @param snapshotPath NULL or a missing file to start from an empty contract
+ * @param journalPath NULL or a missing file for no replay
+ * @return DistributionContract*, NULL on failure
+ */
+DistributionContract* restoreContract(AccountingMode accounting, const char* snapshotPath, const char* journalPath);
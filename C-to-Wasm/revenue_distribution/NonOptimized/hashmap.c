@@ -27,6 +27,36 @@ void hashmap_set_allocator(void *(*malloc)(size_t), void (*free)(void*))
     exit(1); \
 }
 
+struct bucket {
+    uint64_t hash:48;
+    uint64_t dib:16;
+};
+
+// hashmap is an open addressed hash map using robinhood hashing.
+struct hashmap {
+    void *(*malloc)(size_t);
+    void *(*realloc)(void *, size_t);
+    void (*free)(void *);
+    bool oom;
+    size_t elsize;
+    size_t cap;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1);
+    int (*compare)(const void *a, const void *b, void *udata);
+    void (*elfree)(void *item);
+    void *udata;
+    size_t bucketsz;
+    size_t nbuckets;
+    size_t count;
+    size_t mask;
+    size_t growat;
+    size_t shrinkat;
+    void *buckets;
+    void *spare;
+    void *edata;
+};
+
 static struct bucket *bucket_at(struct hashmap *map, size_t index) {
     return (struct bucket*)(((char*)map->buckets)+(map->bucketsz*index));
 }
@@ -101,7 +131,6 @@ struct hashmap *hashmap_new_with_allocator(
     map->malloc = _malloc;
     map->realloc = _realloc;
     map->free = _free;
-    map->head = NULL;
     return map;  
 }
 
@@ -236,18 +265,7 @@ void *hashmap_set(struct hashmap *map, const void *item) {
     entry->hash = get_hash(map, item);
     entry->dib = 1;
     memcpy(bucket_item(entry), item, map->elsize);
-
-    // For fast scan redundancy
-    struct Node* next = calloc(1, sizeof(struct Node));
-    next->data = calloc(1, map->elsize);
-    if(!next || !next->data) {
-        map->oom = true;
-        return NULL;
-    }
-    memcpy(next->data, item, map->elsize);
-    next->next = map->head;
-    map->head = next;
-
+    
     size_t i = entry->hash & map->mask;
 	for (;;) {
         struct bucket *bucket = bucket_at(map, i);
@@ -296,6 +314,149 @@ void *hashmap_get(struct hashmap *map, const void *key) {
 	}
 }
 
+// hashmap_hash returns the hash of `key` as stored in the buckets, to be
+// given to hashmap_prefetch and hashmap_upsert_with_hash.
+uint64_t hashmap_hash(struct hashmap *map, const void *key) {
+    if (!key) {
+        panic("key is null");
+    }
+    return get_hash(map, key);
+}
+
+// hashmap_prefetch asks for the first bucket of `hash` to be loaded in the
+// cache, so that a later probe of a batch does not stall on memory.
+void hashmap_prefetch(struct hashmap *map, uint64_t hash) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(bucket_at(map, hash & map->mask), 1);
+#else
+    (void)map;
+    (void)hash;
+#endif
+}
+
+// hashmap_reserve grows the hash map so that it holds `count` items without
+// resizing, and does not shrink below that afterwards. Returns false if the
+// system is unable to allocate the buckets.
+bool hashmap_reserve(struct hashmap *map, size_t count) {
+    size_t nbuckets = map->nbuckets;
+    while (count > (size_t)(nbuckets*0.75)) {
+        nbuckets *= 2;
+    }
+    if (nbuckets > map->nbuckets && !resize(map, nbuckets)) {
+        return false;
+    }
+    if (map->cap < map->nbuckets) {
+        map->cap = map->nbuckets;
+    }
+    return true;
+}
+
+// hashmap_upsert_with_hash returns the item matching `item` in place, or
+// inserts a copy of `item` and returns where it lies, with a single probe.
+// Param `hash` must come from hashmap_hash() and `inserted` tells which case
+// happened. The returned pointer is valid until the next change of the map.
+// If the system is unable to allocate additional memory then NULL is returned
+// and hashmap_oom() returns true.
+void *hashmap_upsert_with_hash(struct hashmap *map, const void *item,
+                               uint64_t hash, bool *inserted)
+{
+    if (!item || !inserted) {
+        panic("item is null");
+    }
+    map->oom = false;
+    if (map->count == map->growat) {
+        if (!resize(map, map->nbuckets*2)) {
+            map->oom = true;
+            return NULL;
+        }
+    }
+
+    // Robin hood order: the item would be before any bucket poorer than it
+    size_t i = hash & map->mask;
+    size_t dib = 1;
+    for (;;) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib < dib) {
+            break;
+        }
+        if (bucket->hash == hash && 
+            map->compare(item, bucket_item(bucket), map->udata) == 0)
+        {
+            *inserted = false;
+            return bucket_item(bucket);
+        }
+        i = (i + 1) & map->mask;
+        dib++;
+    }
+
+    // The item takes this bucket, the richer ones after it are shifted
+    struct bucket *target = bucket_at(map, i);
+    struct bucket *entry = map->edata;
+    entry->hash = hash;
+    entry->dib = dib;
+    memcpy(bucket_item(entry), item, map->elsize);
+    for (;;) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib == 0) {
+            memcpy(bucket, entry, map->bucketsz);
+            break;
+        }
+        memcpy(map->spare, bucket, map->bucketsz);
+        memcpy(bucket, entry, map->bucketsz);
+        memcpy(entry, map->spare, map->bucketsz);
+        i = (i + 1) & map->mask;
+        entry->dib += 1;
+    }
+    map->count++;
+    *inserted = true;
+    return bucket_item(target);
+}
+
+// hashmap_buckets returns the bucket array of the hash map, its number of
+// buckets, the size of one bucket and the seeds, e.g. to save it as it is
+// and read it back with hashmap_load_buckets.
+const void *hashmap_buckets(struct hashmap *map, size_t *nbuckets,
+                            size_t *bucketsz, uint64_t *seed0, uint64_t *seed1)
+{
+    *nbuckets = map->nbuckets;
+    *bucketsz = map->bucketsz;
+    *seed0 = map->seed0;
+    *seed1 = map->seed1;
+    return map->buckets;
+}
+
+// hashmap_load_buckets replaces the items of the hash map with a copy of
+// `buckets`, as returned by hashmap_buckets() for a map of the same `elsize`
+// and hash function. The seeds are taken too and nothing is rehashed. Returns
+// false, leaving the map as it was, if the layout does not match or if the
+// system is unable to allocate the buckets.
+bool hashmap_load_buckets(struct hashmap *map, const void *buckets,
+                          size_t nbuckets, size_t bucketsz, size_t count,
+                          uint64_t seed0, uint64_t seed1)
+{
+    if (!buckets || bucketsz != map->bucketsz || nbuckets < 16 || 
+        (nbuckets & (nbuckets-1)) || count > (size_t)(nbuckets*0.75))
+    {
+        return false;
+    }
+    void *copy = map->malloc(map->bucketsz*nbuckets);
+    if (!copy) {
+        return false;
+    }
+    memcpy(copy, buckets, map->bucketsz*nbuckets);
+    free_elements(map);
+    map->free(map->buckets);
+    map->buckets = copy;
+    map->nbuckets = nbuckets;
+    map->mask = map->nbuckets-1;
+    map->growat = map->nbuckets*0.75;
+    map->shrinkat = map->nbuckets*0.10;
+    map->count = count;
+    map->seed0 = seed0;
+    map->seed1 = seed1;
+    return true;
+}
+
 // hashmap_probe returns the item in the bucket at position or NULL if an item
 // is not set for that bucket. The position is 'moduloed' by the number of 
 // buckets in the hashmap.
@@ -357,16 +518,17 @@ size_t hashmap_count(struct hashmap *map) {
     return map->count;
 }
 
+// hashmap_capacity returns the number of items the hash map holds before the
+// next insertion resizes it.
+size_t hashmap_capacity(struct hashmap *map) {
+    return map->growat;
+}
+
 // hashmap_free frees the hash map
 // Every item is called with the element-freeing function given in hashmap_new,
 // if present, to free any data referenced in the elements of the hashmap.
 void hashmap_free(struct hashmap *map) {
     if (!map) return;
-    while(map->head) {
-        struct Node* old = map->head;
-        map->head = old->next;
-        free(old->data); free(old);
-    }
     free_elements(map);
     map->free(map->buckets);
     map->free(map);
@@ -414,13 +576,18 @@ bool hashmap_scan(struct hashmap *map,
 //
 // The function returns true if an item was retrieved; false if the end of the
 // iteration has been reached.
-bool hashmap_iter(struct hashmap *map, struct Node** t, void **item)
+bool hashmap_iter(struct hashmap *map, size_t *i, void **item)
 {
-    struct Node* cur = *t;
-    if(cur == NULL) return false;
+    struct bucket *bucket;
+
+    do {
+        if (*i >= map->nbuckets) return false;
 
-    *item = cur->data;
-    *t = cur->next;
+        bucket = bucket_at(map, *i);
+        (*i)++;
+    } while (!bucket->dib);
+
+    *item = bucket_item(bucket);
 
     return true;
 }
@@ -814,6 +981,52 @@ static void all() {
 
     hashmap_free(map);
 
+    // test hashmap_reserve and hashmap_upsert_with_hash
+    while (!(map = hashmap_new(sizeof(int), 0, seed, seed, 
+                               hash_int, compare_ints_udata, NULL, NULL))) {}
+    while (!hashmap_reserve(map, N)) {}
+    size_t reserved = map->nbuckets;
+    assert(hashmap_capacity(map) >= N);
+    shuffle(vals, N, sizeof(int));
+    for (int i = 0; i < N; i++) {
+        bool inserted;
+        int *v = hashmap_upsert_with_hash(map, &vals[i], 
+                                          hashmap_hash(map, &vals[i]), &inserted);
+        assert(v && inserted && *v == vals[i]);
+        v = hashmap_upsert_with_hash(map, &vals[i], 
+                                     hashmap_hash(map, &vals[i]), &inserted);
+        assert(v && !inserted && *v == vals[i]);
+        assert(map->count == i+1);
+        assert(map->count == deepcount(map));
+    }
+    assert(map->nbuckets == reserved);
+    for (int i = 0; i < N; i++) {
+        int *v = hashmap_get(map, &vals[i]);
+        assert(v && *v == vals[i]);
+    }
+
+    // test hashmap_buckets and hashmap_load_buckets
+    struct hashmap *copy;
+    while (!(copy = hashmap_new(sizeof(int), 0, seed+1, seed+1, 
+                                hash_int, compare_ints_udata, NULL, NULL))) {}
+    size_t nbuckets, bucketsz;
+    uint64_t seed0, seed1;
+    const void *buckets = hashmap_buckets(map, &nbuckets, &bucketsz, &seed0, 
+                                          &seed1);
+    assert(!hashmap_load_buckets(copy, buckets, nbuckets, bucketsz+1, 
+                                 map->count, seed0, seed1));
+    while (!hashmap_load_buckets(copy, buckets, nbuckets, bucketsz, 
+                                 map->count, seed0, seed1)) {}
+    assert(copy->count == map->count);
+    assert(copy->count == deepcount(copy));
+    for (int i = 0; i < N; i++) {
+        int *v = hashmap_get(copy, &vals[i]);
+        assert(v && *v == vals[i]);
+    }
+    hashmap_free(copy);
+
+    hashmap_free(map);
+
     xfree(vals);
 
 
@@ -9,41 +9,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
-struct bucket {
-    uint64_t hash:48;
-    uint64_t dib:16;
-};
-
-struct Node {
-    void* data;
-    struct Node* next;
-};
-
-// hashmap is an open addressed hash map using robinhood hashing.
-struct hashmap {
-    void *(*malloc)(size_t);
-    void *(*realloc)(void *, size_t);
-    void (*free)(void *);
-    bool oom;
-    size_t elsize;
-    size_t cap;
-    uint64_t seed0;
-    uint64_t seed1;
-    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1);
-    int (*compare)(const void *a, const void *b, void *udata);
-    void (*elfree)(void *item);
-    void *udata;
-    size_t bucketsz;
-    size_t nbuckets;
-    size_t count;
-    size_t mask;
-    size_t growat;
-    size_t shrinkat;
-    void *buckets;
-    void *spare;
-    void *edata;
-    struct Node* head;
-};
+struct hashmap;
 
 struct hashmap *hashmap_new(size_t elsize, size_t cap, 
                             uint64_t seed0, uint64_t seed1,
@@ -68,14 +34,25 @@ struct hashmap *hashmap_new_with_allocator(
 void hashmap_free(struct hashmap *map);
 void hashmap_clear(struct hashmap *map, bool update_cap);
 size_t hashmap_count(struct hashmap *map);
+size_t hashmap_capacity(struct hashmap *map);
 bool hashmap_oom(struct hashmap *map);
 void *hashmap_get(struct hashmap *map, const void *item);
 void *hashmap_set(struct hashmap *map, const void *item);
 void *hashmap_delete(struct hashmap *map, void *item);
 void *hashmap_probe(struct hashmap *map, uint64_t position);
+uint64_t hashmap_hash(struct hashmap *map, const void *key);
+void hashmap_prefetch(struct hashmap *map, uint64_t hash);
+bool hashmap_reserve(struct hashmap *map, size_t count);
+void *hashmap_upsert_with_hash(struct hashmap *map, const void *item,
+                               uint64_t hash, bool *inserted);
+const void *hashmap_buckets(struct hashmap *map, size_t *nbuckets,
+                            size_t *bucketsz, uint64_t *seed0, uint64_t *seed1);
+bool hashmap_load_buckets(struct hashmap *map, const void *buckets,
+                          size_t nbuckets, size_t bucketsz, size_t count,
+                          uint64_t seed0, uint64_t seed1);
 bool hashmap_scan(struct hashmap *map,
                   bool (*iter)(const void *item, void *udata), void *udata);
-bool hashmap_iter(struct hashmap *map, struct Node **i, void **item);
+bool hashmap_iter(struct hashmap *map, size_t *i, void **item);
 
 uint64_t hashmap_sip(const void *data, size_t len, 
                      uint64_t seed0, uint64_t seed1);
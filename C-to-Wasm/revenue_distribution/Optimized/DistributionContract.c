@@ -1,44 +1,92 @@
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "hashmap.h"
+#include "ShardedMap.h"
 #include "DistributionContract.h"
+#include "Persistence.h"
 
 #define INDEX_INIT 1000000
+// Growth of the index for a revenue of one per unit of stake
 #define INCR_PER_REV_INIT 10000
+// Largest stake of the users of a shard, so that the sum of the shards cannot overflow
+#define SHARD_MAX_EXACT_STAKE (UINT64_MAX / USER_MAP_SHARDS)
+#define SHARD_MAX_STAKE (DBL_MAX / USER_MAP_SHARDS)
+// Addresses hashed and prefetched at once by changeShareBatch
+#define CHANGE_BATCH_BLOCK 16
+// Buckets ahead of the current one requested by settleAll
+#define SETTLE_PREFETCH_DISTANCE 8
 
 // Utility function prototype
 void distributeRevenue(DistributionContract* contract, double amount);
 
-// Hash function
+// 64 x 64 -> 128 bit multiplication folded back to 64 bits, the mixing step of wyhash
+static uint64_t foldedMultiply(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+// Hash function, the address has a fixed width so it is read as three words without any loop
 uint64_t userDataHash(const void* item, uint64_t seed0, uint64_t seed1) {
     const UserState* userState = item;
-    return hashmap_sip(userState->address, strlen(userState->address), seed0, seed1);
+    uint64_t low, middle;
+    uint32_t high;
+    memcpy(&low, userState->address.bytes, sizeof(low));
+    memcpy(&middle, userState->address.bytes + 8, sizeof(middle));
+    memcpy(&high, userState->address.bytes + 16, sizeof(high));
+    uint64_t h = foldedMultiply(low ^ seed0 ^ 0xa0761d6478bd642full, middle ^ seed1 ^ 0xe7037ed1a0b428dbull);
+    return foldedMultiply(h ^ high ^ 0x8ebc6af09c88c6e3ull, ADDRESS_LENGTH ^ 0x589965cc75374cc3ull);
 }
 
 // Compare function
 int userDataCompare(const void* a, const void* b, void* udata) {
     const UserState* userState1 = a;
     const UserState* userState2 = b;
-    return strcmp(userState1->address, userState2->address);
+    return memcmp(userState1->address.bytes, userState2->address.bytes, ADDRESS_LENGTH);
+}
+
+// Random seed of a new map, so that the addresses colliding in a map cannot be known in advance
+static uint64_t randomSeed(void) {
+    uint64_t seed;
+    if(getentropy(&seed, sizeof(seed))) {
+        // splitmix64 of the clock and of an address, not random but still different between maps
+        seed = (uint64_t) clock() ^ (uint64_t) time(NULL) << 20 ^ (uint64_t) (uintptr_t) &seed;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+        seed ^= seed >> 31;
+    }
+    return seed;
 }
 
 /**
  * @brief Constructs a distribution contract
+ * In ACCOUNTING_EXACT the amounts given to the contract are whole units up to EXACT_MAX_UNITS, other ones revert
  * 
+ * @param accounting The arithmetic of the contract
  * @return DistributionContract*
  */
-DistributionContract* constructContract() {
+DistributionContract* constructContract(AccountingMode accounting) {
+    // Sanity checks
+    if(accounting != ACCOUNTING_DOUBLE && accounting != ACCOUNTING_EXACT) return NULL;
     DistributionContract* contract = calloc(1, sizeof(DistributionContract));
     if(!contract) return NULL;
-    contract->userStateMap = hashmap_new(sizeof(UserState), 0, 0, 0, userDataHash, userDataCompare, NULL, NULL);
-    if(!contract->userStateMap) {
+    contract->accounting = accounting;
+    contract->userStateMap = constructShardedMap(sizeof(UserState), USER_MAP_SHARDS, randomSeed(), randomSeed(),
+        userDataHash, userDataCompare);
+    contract->shardStakes = aligned_alloc(_Alignof(ShardStake), USER_MAP_SHARDS * sizeof(ShardStake));
+    if(!contract->userStateMap || !contract->shardStakes) {
+        destroyShardedMap(contract->userStateMap);
+        free(contract->shardStakes);
         free(contract);
         return NULL;
     }
-    contract->totalStake = 0;
-    contract->incrementPerRevenue = INCR_PER_REV_INIT;
+    memset(contract->shardStakes, 0, USER_MAP_SHARDS * sizeof(ShardStake));
+    pthread_rwlock_init(&contract->lock, NULL);
+    pthread_mutex_init(&contract->journalLock, NULL);
     contract->index = INDEX_INIT;
     return contract;
 }
@@ -51,10 +99,139 @@ DistributionContract* constructContract() {
 void destroyContract(DistributionContract* contract) {
    // Sanitization
    if(!contract) return;
-   hashmap_free(contract->userStateMap);
+   destroyShardedMap(contract->userStateMap);
+   free(contract->shardStakes);
+   pthread_rwlock_destroy(&contract->lock);
+   pthread_mutex_destroy(&contract->journalLock);
    free(contract);
 }
 
+// Counts an operation and appends it to the journal, if any, before it changes anything. Operations that commute,
+// changes of users of different shards, may be recorded in any order. An operation that cannot be journaled reverts
+// like an invalid one
+static int recordOperation(DistributionContract* contract, JournalOperation operation, const Address* address,
+    double amount) {
+    if(!contract->journal) {
+        atomic_fetch_add_explicit(&contract->sequence, 1, memory_order_relaxed);
+        return EXIT_SUCCESS;
+    }
+    pthread_mutex_lock(&contract->journalLock);
+    int result = reserveJournal(contract->journal);
+    if(!result) {
+        uint64_t sequence = atomic_fetch_add_explicit(&contract->sequence, 1, memory_order_relaxed) + 1;
+        appendJournal(contract->journal, sequence, operation, address, amount);
+    }
+    pthread_mutex_unlock(&contract->journalLock);
+    return result;
+}
+
+// Writes and syncs the group the operation set aside, if any, once every lock is released. A group that cannot be
+// written stays aside and the operations revert once the next one is full
+static void commitOperation(DistributionContract* contract) {
+    if(contract->journal) commitJournal(contract->journal);
+}
+
+// Whole units of an amount in ACCOUNTING_EXACT
+static int wholeUnits(double amount, int64_t* units) {
+    if(!(fabs(amount) <= EXACT_MAX_UNITS) || amount != trunc(amount)) return EXIT_FAILURE;
+    *units = (int64_t) amount;
+    return EXIT_SUCCESS;
+}
+
+// Revenue accrued by a user in ACCOUNTING_EXACT since it was last settled, its carry included, in 2^-64 units
+// Both revenues per stake only grow, their difference is right even once the sum wraps around
+static __uint128_t freshExactRevenue(const DistributionContract* contract, const UserState* userState) {
+    return (__uint128_t) userState->exact.stake * (contract->revenuePerStake - userState->exact.lastRevenuePerStake)
+        + userState->exact.carry;
+}
+
+// Revenue accrued by a user since it was last settled, the index grows by INCR_PER_REV_INIT times the revenue per
+// stake
+static double freshRevenue(const DistributionContract* contract, const UserState* userState) {
+    return (contract->index - userState->lastIndex) * userState->ownStake / INCR_PER_REV_INIT;
+}
+
+// Folds the fresh revenue of a user into its total, the user is then up to date with the contract
+static void settle(const DistributionContract* contract, UserState* userState) {
+    if(contract->accounting == ACCOUNTING_EXACT) {
+        __uint128_t fresh = freshExactRevenue(contract, userState);
+        userState->exact.accumulated += (uint64_t) (fresh >> 64);
+        userState->exact.carry = (uint64_t) fresh;
+        userState->exact.lastRevenuePerStake = contract->revenuePerStake;
+        return;
+    }
+    userState->ownAccumulatedTotal += freshRevenue(contract, userState);
+    userState->lastIndex = contract->index;
+}
+
+// Check whether the change will cause an over/underflow of the user or of its shard
+static int checkStakeChange(const DistributionContract* contract, const ShardStake* shardStake,
+    const UserState* userState, double change, int64_t units) {
+    if(contract->accounting == ACCOUNTING_EXACT) {
+        return (units < 0 ? (uint64_t) -units > userState->exact.stake
+            : (uint64_t) units > SHARD_MAX_EXACT_STAKE - shardStake->exactStake) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    double newShardStake = shardStake->stake + change;
+    return !(newShardStake >= 0 && newShardStake <= SHARD_MAX_STAKE) || userState->ownStake + change < 0
+        ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Change of the stake of a user, the revenue per stake does not depend on the total stake so that only the shard of
+// the user changes, the total is summed when revenue is distributed
+static void changeStake(const DistributionContract* contract, ShardStake* shardStake, UserState* userState,
+    double change, int64_t units) {
+    settle(contract, userState);
+    if(contract->accounting == ACCOUNTING_EXACT) {
+        userState->exact.stake += (uint64_t) units;
+        shardStake->exactStake += (uint64_t) units;
+        return;
+    }
+    userState->ownStake += change;
+    shardStake->stake += change;
+}
+
+// Sum of the shards in ACCOUNTING_EXACT, the lock held for writing
+static uint64_t exactTotalStake(const DistributionContract* contract) {
+    uint64_t total = 0;
+    for(size_t s = 0; s < USER_MAP_SHARDS; s++) {
+        total += contract->shardStakes[s].exactStake;
+    }
+    return total;
+}
+
+// Updates one user, the hash of its address is already known
+static int applyChange(DistributionContract* contract, const Address* dest, double change, uint64_t hash) {
+    // Sanity checks
+    int64_t units = 0;
+    if(change == 0 || (contract->accounting == ACCOUNTING_EXACT && wholeUnits(change, &units))) return EXIT_FAILURE;
+    // Get user data in place, a single probe finds it or inserts it, the shard stays locked until the user is updated
+    MapShard* shard = lockShard(contract->userStateMap, hash);
+    bool inserted;
+    UserState key = { .address = *dest };
+    UserState* userState = shardUpsert(contract->userStateMap, shard, &key, hash, &inserted);
+    if(!userState) {
+        unlockShard(shard);
+        return EXIT_FAILURE;
+    }
+    ShardStake* shardStake = &contract->shardStakes[shard - contract->userStateMap->shards];
+    // Shared with the changes of the other shards, only revenue waits for them
+    pthread_rwlock_rdlock(&contract->lock);
+    if(inserted && contract->accounting == ACCOUNTING_EXACT) {
+        // If no mapping existed
+        *userState = (UserState){ .address = *dest, .exact = { .lastRevenuePerStake = contract->revenuePerStake } };
+    } else if(inserted) {
+        *userState = (UserState){ .address = *dest, .lastIndex = contract->index };
+    }
+    int reverted = checkStakeChange(contract, shardStake, userState, change, units)
+        || recordOperation(contract, JOURNAL_CHANGE_SHARE, dest, change);
+    if(!reverted) changeStake(contract, shardStake, userState, change, units);
+    pthread_rwlock_unlock(&contract->lock);
+    if(reverted && inserted) shardDelete(shard, &key);
+    unlockShard(shard);
+    if(!reverted) commitOperation(contract);
+    return reverted ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 /**
  * @brief Function to add share to the destination address
  * WARNING: Any user may add as much share as they want
@@ -66,42 +243,43 @@ void destroyContract(DistributionContract* contract) {
  * @param change The amount to add/remove
  * @return int Success code: 0 if succeeded else transaction revert
  */
-int changeShare(DistributionContract* contract, char* dest, double change) {
+int changeShare(DistributionContract* contract, const Address* dest, double change) {
     // Sanity checks
-    if(change == 0 || !contract || !dest) return EXIT_FAILURE;
-    double newTotalStake = contract->totalStake + change;
-    double oldTotalStake = contract->totalStake;
-    if(newTotalStake < 0 || !isfinite(newTotalStake)) return EXIT_FAILURE;
-    // Get user data
-    UserState* userState = hashmap_get(contract->userStateMap, &(UserState){ .address = dest });
-    UserState tmp = { 0 };
-    if(!userState) {
-        // If no mapping exists
-        tmp = (UserState){ dest, 0, contract->totalStake, contract->incrementPerRevenue, 0, contract->index };    
-    } else {
-        // If there was a mapping
-        tmp = *userState;
-    }
-    if(tmp.ownStake + change < 0) return EXIT_FAILURE;
-    // Phase 1
-    double freshOwn = tmp.ownStake == 0 ? 0 : (contract->index - tmp.lastIndex) * tmp.ownStake / 
-        (tmp.lastIncrementPerRevenue * tmp.lastTotalStake);
-    tmp.ownAccumulatedTotal += freshOwn;
-    // Phase 2
-    if(newTotalStake != 0) { // TODO: Floating points can be dangerous!
-        contract->incrementPerRevenue = INCR_PER_REV_INIT;
-    } else if(oldTotalStake != 0) {
-        contract->incrementPerRevenue *= oldTotalStake / newTotalStake;
-    }
-    contract->totalStake = newTotalStake;
-    // Phase 3
-    tmp.ownStake += change;
-    tmp.lastIndex = contract->index;
-    tmp.lastIncrementPerRevenue = contract->incrementPerRevenue;
-    tmp.lastTotalStake = contract->totalStake;
-    /// Update
-    hashmap_set(contract->userStateMap, &tmp);
-    return EXIT_SUCCESS;
+    if(!contract || !dest) return EXIT_FAILURE;
+    UserState key = { .address = *dest };
+    return applyChange(contract, dest, change, shardedMapHash(contract->userStateMap, &key));
+}
+
+/**
+ * @brief Applies n share changes in order, like n calls to changeShare
+ * The map is sized for n more users once, and the buckets of the addresses are prefetched block by block
+ * 
+ * @param contract The contract 
+ * @param dests The destination addresses of the changes
+ * @param changes The amounts to add/remove
+ * @param n The number of changes
+ * @return int Success code: 0 if every change succeeded else EXIT_FAILURE, the failing changes alone are reverted,
+ * a change that cannot be journaled fails before it is applied
+ */
+int changeShareBatch(DistributionContract* contract, const Address* dests, const double* changes, size_t n) {
+    // Sanity checks
+    if(!contract || (n && (!dests || !changes))) return EXIT_FAILURE;
+    if(!shardedMapReserve(contract->userStateMap, n)) return EXIT_FAILURE;
+    int result = EXIT_SUCCESS;
+    uint64_t hashes[CHANGE_BATCH_BLOCK];
+    for(size_t begin = 0; begin < n; begin += CHANGE_BATCH_BLOCK) {
+        size_t size = n - begin < CHANGE_BATCH_BLOCK ? n - begin : CHANGE_BATCH_BLOCK;
+        // Every bucket of the block is requested before the first one is needed
+        for(size_t i = 0; i < size; i++) {
+            UserState key = { .address = dests[begin + i] };
+            hashes[i] = shardedMapHash(contract->userStateMap, &key);
+            shardedMapPrefetch(contract->userStateMap, hashes[i]);
+        }
+        for(size_t i = 0; i < size; i++) {
+            if(applyChange(contract, &dests[begin + i], changes[begin + i], hashes[i])) result = EXIT_FAILURE;
+        }
+    }
+    return result;
 }
 
 /**
@@ -114,10 +292,149 @@ int changeShare(DistributionContract* contract, char* dest, double change) {
 int addRevenue(DistributionContract* contract, double amount) {
     // Sanity checks
     if(!contract || amount <= 0) return EXIT_FAILURE;
-    distributeRevenue(contract, amount);
+    int64_t units = 0;
+    if(contract->accounting == ACCOUNTING_EXACT && wholeUnits(amount, &units)) return EXIT_FAILURE;
+    pthread_rwlock_wrlock(&contract->lock);
+    int overflow = contract->accounting == ACCOUNTING_EXACT && (uint64_t) units > UINT64_MAX - contract->exactUndistributed;
+    int result = overflow ? EXIT_FAILURE : recordOperation(contract, JOURNAL_ADD_REVENUE, NULL, amount);
+    if(!result) distributeRevenue(contract, amount);
+    pthread_rwlock_unlock(&contract->lock);
+    if(!result) commitOperation(contract);
+    return result;
+}
+
+/**
+ * @brief Revenue accrued to an address and not claimed yet, computed in O(1) without changing anything
+ * 
+ * @param contract The contract 
+ * @param address The address
+ * @return double The pending revenue, 0 for an unknown address
+ */
+double pendingRevenue(DistributionContract* contract, const Address* address) {
+    // Sanity checks
+    if(!contract || !address) return 0;
+    UserState key = { .address = *address };
+    MapShard* shard = lockShard(contract->userStateMap, shardedMapHash(contract->userStateMap, &key));
+    const UserState* userState = shardGet(shard, &key);
+    double pending = 0;
+    pthread_rwlock_rdlock(&contract->lock);
+    if(userState && contract->accounting == ACCOUNTING_EXACT) {
+        pending = (double) (userState->exact.accumulated + (uint64_t) (freshExactRevenue(contract, userState) >> 64));
+    } else if(userState) {
+        pending = userState->ownAccumulatedTotal + freshRevenue(contract, userState);
+    }
+    pthread_rwlock_unlock(&contract->lock);
+    unlockShard(shard);
+    return pending;
+}
+
+/**
+ * @brief Settles the user of an address and withdraws its pending revenue, other users are not touched
+ * 
+ * @param contract The contract 
+ * @param address The address
+ * @param claimed Receives the revenue withdrawn, may be NULL
+ * @return int Success code: 0 if succeeded else transaction revert
+ */
+int claimRevenue(DistributionContract* contract, const Address* address, double* claimed) {
+    // Sanity checks
+    if(!contract || !address) return EXIT_FAILURE;
+    UserState key = { .address = *address };
+    MapShard* shard = lockShard(contract->userStateMap, shardedMapHash(contract->userStateMap, &key));
+    UserState* userState = shardGet(shard, &key);
+    if(!userState) {
+        unlockShard(shard);
+        return EXIT_FAILURE;
+    }
+    pthread_rwlock_rdlock(&contract->lock);
+    if(recordOperation(contract, JOURNAL_CLAIM_REVENUE, address, 0)) {
+        pthread_rwlock_unlock(&contract->lock);
+        unlockShard(shard);
+        return EXIT_FAILURE;
+    }
+    settle(contract, userState);
+    // The carry stays, it is part of a unit to come
+    if(contract->accounting == ACCOUNTING_EXACT) {
+        if(claimed) *claimed = (double) userState->exact.accumulated;
+        userState->exact.accumulated = 0;
+    } else {
+        if(claimed) *claimed = userState->ownAccumulatedTotal;
+        userState->ownAccumulatedTotal = 0;
+    }
+    pthread_rwlock_unlock(&contract->lock);
+    unlockShard(shard);
+    commitOperation(contract);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Settles every user, e.g. at the end of an epoch, walking the buckets in memory order
+ * 
+ * @param contract The contract 
+ * @return int Success code: 0 if succeeded else transaction revert
+ */
+int settleAll(DistributionContract* contract) {
+    // Sanity checks
+    if(!contract) return EXIT_FAILURE;
+    lockContract(contract);
+    if(recordOperation(contract, JOURNAL_SETTLE_ALL, NULL, 0)) {
+        unlockContract(contract);
+        return EXIT_FAILURE;
+    }
+    for(size_t s = 0; s < contract->userStateMap->nbShards; s++) {
+        MapShard* shard = &contract->userStateMap->shards[s];
+        struct hashmap* tables[] = { shard->current, shard->previous };
+        for(size_t t = 0; t < 2 && tables[t]; t++) {
+            size_t position = 0;
+            void* item;
+            while(hashmap_iter(tables[t], &position, &item)) {
+                // A position is its own bucket modulo the number of buckets, like a hash
+                hashmap_prefetch(tables[t], position + SETTLE_PREFETCH_DISTANCE);
+                settle(contract, item);
+            }
+        }
+    }
+    unlockContract(contract);
+    commitOperation(contract);
     return EXIT_SUCCESS;
 }
 
+/**
+ * @brief Waits for the operations in progress and holds the next ones until unlockContract, e.g. for a snapshot
+ * 
+ * @param contract The contract 
+ */
+void lockContract(DistributionContract* contract) {
+    lockAllShards(contract->userStateMap);
+    pthread_rwlock_wrlock(&contract->lock);
+}
+
+/**
+ * @brief Lets the operations held by lockContract go on
+ * 
+ * @param contract The contract 
+ */
+void unlockContract(DistributionContract* contract) {
+    pthread_rwlock_unlock(&contract->lock);
+    unlockAllShards(contract->userStateMap);
+}
+
+/**
+ * @brief Sum of the stakes of the users, with the contract locked by lockContract
+ * 
+ * @param contract The contract 
+ * @return double The total stake, in whole units in ACCOUNTING_EXACT
+ */
+double totalStake(const DistributionContract* contract) {
+    if(contract->accounting == ACCOUNTING_EXACT) return (double) exactTotalStake(contract);
+    // Always in the same order, the same shards give the same total
+    double total = 0;
+    for(size_t s = 0; s < USER_MAP_SHARDS; s++) {
+        total += contract->shardStakes[s].stake;
+    }
+    return total;
+}
+
 /**
  * @brief Utility distribution function
  *
@@ -125,6 +442,22 @@ int addRevenue(DistributionContract* contract, double amount) {
  * @param amount The amount to distribute
  */
 void distributeRevenue(DistributionContract* contract, double amount) {
+    // The revenue waits in the contract while nobody has a stake
+    // The shards are settled into the total stake, the lock is held for writing
+    if(contract->accounting == ACCOUNTING_EXACT) {
+        uint64_t total = exactTotalStake(contract);
+        contract->exactUndistributed += (uint64_t) amount;
+        if(total == 0) return;
+        __uint128_t revenue = ((__uint128_t) contract->exactUndistributed << 64) + contract->revenueRemainder;
+        contract->revenuePerStake += revenue / total;
+        contract->revenueRemainder = (uint64_t) (revenue % total);
+        contract->exactUndistributed = 0;
+        return;
+    }
+    double total = totalStake(contract);
+    contract->undistributed += amount;
+    if(total == 0) return;
     // Efficient distribution
-    contract->index += contract->incrementPerRevenue * amount;
+    contract->index += INCR_PER_REV_INIT * contract->undistributed / total;
+    contract->undistributed = 0;
 }
\ No newline at end of file
@@ -1,31 +1,107 @@
 #pragma once
 
-#include "hashmap.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "ShardedMap.h"
+
+// Bytes of an address, like Ethereum ones
+#define ADDRESS_LENGTH 20
+
+// A user address, stored inline in the hashmap entries and compared byte by byte
+typedef struct {
+    uint8_t bytes[ADDRESS_LENGTH];
+} Address;
+
+// Arithmetic of the stakes and of the revenue, chosen once when the contract is constructed
+typedef enum {
+    // Doubles, rounding drifts over long runs
+    ACCOUNTING_DOUBLE,
+    // Whole units in 64 bit integers and a 64.64 fixed point revenue per stake, the parts of a unit rounded off are
+    // carried instead of dropped so that the revenue of the users always adds up to the revenue added
+    ACCOUNTING_EXACT
+} AccountingMode;
+
+// Largest amount in ACCOUNTING_EXACT, doubles hold every whole number up to it
+#define EXACT_MAX_UNITS 9007199254740992.0
+
+// Shards of the user map, changes of users of different shards do not wait for each other
+#define USER_MAP_SHARDS 64
+
+// 64.64 fixed point, aligned like a double so that it packs in the user entries
+typedef __uint128_t FixedPoint __attribute__((aligned(8)));
+
+// Stake of the users of one shard of the user map, changed under the lock of the shard and summed when revenue is
+// distributed, alone on its cache line
+typedef struct {
+    _Alignas(64) union {
+        // ACCOUNTING_DOUBLE
+        double stake;
+        // ACCOUNTING_EXACT
+        uint64_t exactStake;
+    };
+} ShardStake;
 
 // The state of the contract at any moment
+// The operations below, snapshots included, may be called from several threads at once, the construction and the
+// destruction of a contract and the attachment of its journal excepted
 typedef struct {
-    struct hashmap* userStateMap;
-    double totalStake;
-    double incrementPerRevenue;
+    ShardedMap* userStateMap;
+    // USER_MAP_SHARDS, the total stake is their sum
+    ShardStake* shardStakes;
+    // Held for reading by the operations on a single user, taken after the shard of the user, and for writing by the
+    // ones that read the total stake or change the revenue per stake
+    pthread_rwlock_t lock;
+    // Orders the records of the journal, the operations holding lock for reading append them concurrently
+    pthread_mutex_t journalLock;
+    AccountingMode accounting;
+    // ACCOUNTING_DOUBLE, the index grows by INCR_PER_REV_INIT times the revenue per stake, and the revenue added while
+    // nobody had a stake, added to the next revenue
     double index;
+    double undistributed;
+    // ACCOUNTING_EXACT, the revenue per unit of stake since the construction and what is left of the revenue below
+    // 2^-64 unit per stake, in 2^-64 units, added to the next revenue with the whole units added while nobody had a
+    // stake
+    FixedPoint revenuePerStake;
+    uint64_t revenueRemainder;
+    uint64_t exactUndistributed;
+    // Number of operations applied since the construction, the last one in the journal or in a snapshot
+    _Atomic uint64_t sequence;
+    // NULL or where the applied operations are appended, see Persistence.h
+    struct ContractJournal* journal;
 } DistributionContract;
 
-// An entry of the hashmap
+// An entry of the hashmap, the same size in both accountings
 typedef struct {
-    char* address;
-	double ownStake;
-    double lastTotalStake;
-    double lastIncrementPerRevenue;
-    double ownAccumulatedTotal;
-    double lastIndex;
+    Address address;
+    union {
+        // ACCOUNTING_DOUBLE
+        struct {
+            double ownStake;
+            // Revenue settled and not claimed yet
+            double ownAccumulatedTotal;
+            double lastIndex;
+        };
+        // ACCOUNTING_EXACT
+        struct {
+            uint64_t stake;
+            // Whole units settled and not claimed yet
+            uint64_t accumulated;
+            // Part of a unit settled, in 2^-64 units
+            uint64_t carry;
+            FixedPoint lastRevenuePerStake;
+        } exact;
+    };
 } UserState;
 
 /**
  * @brief Constructs a distribution contract
+ * In ACCOUNTING_EXACT the amounts given to the contract are whole units up to EXACT_MAX_UNITS, other ones revert
  * 
+ * @param accounting The arithmetic of the contract
  * @return DistributionContract*
  */
-DistributionContract* constructContract();
+DistributionContract* constructContract(AccountingMode accounting);
 
 /**
  * @brief Destroys a distribution contract
@@ -45,13 +121,76 @@ void destroyContract(DistributionContract* contract);
  * @param change The amount to add/remove
  * @return int Success code: 0 if succeeded else transaction revert
  */
-int changeShare(DistributionContract* contract, char* dest, double change);
+int changeShare(DistributionContract* contract, const Address* dest, double change);
+
+/**
+ * @brief Applies n share changes in order, like n calls to changeShare
+ * The map is sized for n more users once, and the buckets of the addresses are prefetched block by block
+ * 
+ * @param contract The contract 
+ * @param dests The destination addresses of the changes
+ * @param changes The amounts to add/remove
+ * @param n The number of changes
+ * @return int Success code: 0 if every change succeeded else EXIT_FAILURE, the failing changes alone are reverted,
+ * a change that cannot be journaled fails before it is applied
+ */
+int changeShareBatch(DistributionContract* contract, const Address* dests, const double* changes, size_t n);
 
 /**
  * @brief Injects revenue into the contract
+ * Added while nobody has a stake, the revenue goes to the stakers of the next one
  * 
  * @param contract The destination address
  * @param amount The amount to add 
  * @return int Success code: 0 if succeeded else transaction revert
  */
 int addRevenue(DistributionContract* contract, double amount);
+
+/**
+ * @brief Revenue accrued to an address and not claimed yet, computed in O(1) without changing anything
+ * 
+ * @param contract The contract 
+ * @param address The address
+ * @return double The pending revenue, 0 for an unknown address
+ */
+double pendingRevenue(DistributionContract* contract, const Address* address);
+
+/**
+ * @brief Settles the user of an address and withdraws its pending revenue, other users are not touched
+ * 
+ * @param contract The contract 
+ * @param address The address
+ * @param claimed Receives the revenue withdrawn, may be NULL
+ * @return int Success code: 0 if succeeded else transaction revert
+ */
+int claimRevenue(DistributionContract* contract, const Address* address, double* claimed);
+
+/**
+ * @brief Settles every user, e.g. at the end of an epoch, walking the buckets in memory order
+ * 
+ * @param contract The contract 
+ * @return int Success code: 0 if succeeded else transaction revert
+ */
+int settleAll(DistributionContract* contract);
+
+/**
+ * @brief Waits for the operations in progress and holds the next ones until unlockContract, e.g. for a snapshot
+ * 
+ * @param contract The contract 
+ */
+void lockContract(DistributionContract* contract);
+
+/**
+ * @brief Lets the operations held by lockContract go on
+ * 
+ * @param contract The contract 
+ */
+void unlockContract(DistributionContract* contract);
+
+/**
+ * @brief Sum of the stakes of the users, with the contract locked by lockContract
+ * 
+ * @param contract The contract 
+ * @return double The total stake, in whole units in ACCOUNTING_EXACT
+ */
+double totalStake(const DistributionContract* contract);
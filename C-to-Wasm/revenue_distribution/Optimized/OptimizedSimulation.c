@@ -1,47 +1,295 @@
-#include <time.h>
-#include "DistributionContract.h"
-#include <stdlib.h>
-#include <stdio.h>
-#include <unistd.h>
-
-#define NB_USERS 1000000
-#define ITER 100
-
-long benchmark(void(*fun)(void*), void* data) {
-    long averageTime = 0;
-    struct timespec begin, end; 
-    // Setup
-    for(size_t i = 0; i < ITER; ++i) {
-        clock_gettime(CLOCK_MONOTONIC, &begin);
-        // Start benchmarked code
-        fun(data);
-        // Cleanup
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        if(end.tv_nsec <= begin.tv_nsec) continue;
-        averageTime += (end.tv_nsec - begin.tv_nsec);
-    }
-    return averageTime / ITER;
-}
-
-void distributeRevenueBenchmark(void* data) {
-    DistributionContract* contract = data;
-    addRevenue(contract, NB_USERS);
-}
-
-int main() {
-    // Setup
-    DistributionContract* contract = constructContract();
-    char* addresses[NB_USERS] = {0};
-    for(size_t i = 0 ; i < NB_USERS ; ++i) {
-        addresses[i] = calloc(1, 8 * sizeof(char));
-        sprintf(addresses[i], "%zu", i + 1);
-        changeShare(contract, addresses[i], i + 1);
-    }
-    // Warmup
-    benchmark(distributeRevenueBenchmark, contract);
-    // Result
-    printf("TEMPS: %lu\n", benchmark(distributeRevenueBenchmark, contract));
-    // Cleanup
-    for(size_t i = 0 ; i < NB_USERS ; ++i) free(addresses[i]);
-    destroyContract(contract);
-}
\ No newline at end of file
+#include "DistributionContract.h"
+#include "Persistence.h"
+#include "Benchmark.h"
+#include "Sharding.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Default of --users
+#define NB_USERS 1000000
+// Room for the paths of the files of --journal
+#define PATH_SIZE 4096
+// Share of the users changed again after the checkpoint, replayed from the journal by RESTORE
+#define TAIL_FRACTION 100
+
+typedef struct {
+    DistributionContract* contract;
+    double amount;
+} DistributionScenario;
+
+// One transaction per user, the i-th gets as much share as its rank
+typedef struct {
+    DistributionContract* contract;
+    AccountingMode accounting;
+    Address* addresses;
+    double* changes;
+    long nbUsers;
+    // NULL or a journal started anew for every contract
+    const char* journalPath;
+    ContractJournal* journal;
+} ChangeShareScenario;
+
+// The users split in one contiguous slice per ingestion thread
+typedef struct {
+    ChangeShareScenario changeShare;
+    size_t nbThreads;
+} ThreadedChangeShareScenario;
+
+typedef struct {
+    DistributionContract* contract;
+    const Address* addresses;
+    const double* changes;
+    size_t n;
+} ChangeShareSlice;
+
+// One new user per iteration, the map grows along the run
+typedef struct {
+    DistributionContract* contract;
+    long nbUsers;
+} GrowScenario;
+
+typedef struct {
+    AccountingMode accounting;
+    const char* snapshotPath;
+    const char* journalPath;
+    DistributionContract* contract;
+} RestoreScenario;
+
+// The i-th user, i in big endian in the last bytes like a small Ethereum address
+Address userAddress(long i) {
+    Address address = { { 0 } };
+    for(size_t b = 0; b < sizeof(i); b++) {
+        address.bytes[ADDRESS_LENGTH - 1 - b] = (uint8_t) ((unsigned long) i >> (8 * b));
+    }
+    return address;
+}
+
+void constructContractBenchmark(void* data) {
+    ChangeShareScenario* scenario = data;
+    scenario->contract = constructContract(scenario->accounting);
+    if(scenario->contract && scenario->journalPath) {
+        unlink(scenario->journalPath);
+        scenario->journal = openJournal(scenario->journalPath, JOURNAL_GROUP_SIZE);
+        scenario->contract->journal = scenario->journal;
+    }
+}
+
+void changeShareBenchmark(void* data) {
+    ChangeShareScenario* scenario = data;
+    for(long i = 0 ; i < scenario->nbUsers ; ++i) {
+        changeShare(scenario->contract, &scenario->addresses[i], scenario->changes[i]);
+    }
+}
+
+void changeShareBatchBenchmark(void* data) {
+    ChangeShareScenario* scenario = data;
+    changeShareBatch(scenario->contract, scenario->addresses, scenario->changes, scenario->nbUsers);
+}
+
+void* changeShareSlice(void* data) {
+    ChangeShareSlice* slice = data;
+    changeShareBatch(slice->contract, slice->addresses, slice->changes, slice->n);
+    return NULL;
+}
+
+// One slice of the users per thread, see runSharded
+void changeShareThreadsBenchmark(void* data) {
+    ThreadedChangeShareScenario* scenario = data;
+    size_t nbThreads = scenario->nbThreads;
+    size_t nbUsers = (size_t) scenario->changeShare.nbUsers;
+    ChangeShareSlice slices[nbThreads];
+    for(size_t t = 0; t < nbThreads; t++) {
+        size_t begin = nbUsers * t / nbThreads;
+        slices[t] = (ChangeShareSlice){ scenario->changeShare.contract, &scenario->changeShare.addresses[begin],
+            &scenario->changeShare.changes[begin], nbUsers * (t + 1) / nbThreads - begin };
+    }
+    runSharded(nbThreads, changeShareSlice, slices, sizeof(ChangeShareSlice));
+}
+
+void growBenchmark(void* data) {
+    GrowScenario* scenario = data;
+    Address address = userAddress(++scenario->nbUsers);
+    changeShare(scenario->contract, &address, 1);
+}
+
+void destroyContractBenchmark(void* data) {
+    ChangeShareScenario* scenario = data;
+    destroyContract(scenario->contract);
+    closeJournal(scenario->journal);
+    scenario->journal = NULL;
+}
+
+void restoreContractBenchmark(void* data) {
+    RestoreScenario* scenario = data;
+    scenario->contract = restoreContract(scenario->accounting, scenario->snapshotPath, scenario->journalPath);
+}
+
+void checkpointContractBenchmark(void* data) {
+    RestoreScenario* scenario = data;
+    checkpointContract(scenario->contract, scenario->snapshotPath);
+}
+
+void destroyRestoredBenchmark(void* data) {
+    RestoreScenario* scenario = data;
+    destroyContract(scenario->contract);
+}
+
+/*
+ * JOURNAL builds the contract with every change journaled, REPLAY restores it from the journal alone. CHECKPOINT
+ * snapshots the restored contract and empties the journal, a few more changes are journaled, then RESTORE loads the
+ * snapshot and replays that tail.
+ */
+int persistenceBenchmarks(const BenchmarkConfig* config, const char* parameters, ChangeShareScenario* changeShareScenario,
+    const char* directory) {
+    char snapshotPath[PATH_SIZE];
+    char journalPath[PATH_SIZE];
+    snprintf(snapshotPath, sizeof(snapshotPath), "%s/contract.snapshot", directory);
+    snprintf(journalPath, sizeof(journalPath), "%s/contract.journal", directory);
+    BenchmarkResult result;
+
+    ChangeShareScenario journalScenario = *changeShareScenario;
+    journalScenario.journalPath = journalPath;
+    if(!runBenchmark(config, "JOURNAL", parameters, constructContractBenchmark, changeShareBatchBenchmark,
+            destroyContractBenchmark, &journalScenario, &result)) {
+        printBenchmarkResult(config, &result);
+    }
+    RestoreScenario restoreScenario = { changeShareScenario->accounting, NULL, journalPath, NULL };
+    if(!runBenchmark(config, "REPLAY", parameters, NULL, restoreContractBenchmark, destroyRestoredBenchmark,
+            &restoreScenario, &result)) {
+        printBenchmarkResult(config, &result);
+    }
+
+    RestoreScenario checkpointScenario = { changeShareScenario->accounting, snapshotPath, NULL,
+        restoreContract(changeShareScenario->accounting, NULL, journalPath) };
+    ContractJournal* journal = openJournal(journalPath, JOURNAL_GROUP_SIZE);
+    if(!checkpointScenario.contract || !journal) {
+        destroyContract(checkpointScenario.contract);
+        closeJournal(journal);
+        return 1;
+    }
+    checkpointScenario.contract->journal = journal;
+    if(!runBenchmark(config, "CHECKPOINT", parameters, NULL, checkpointContractBenchmark, NULL, &checkpointScenario,
+            &result)) {
+        printBenchmarkResult(config, &result);
+    }
+    int failed = changeShareBatch(checkpointScenario.contract, changeShareScenario->addresses,
+        changeShareScenario->changes, changeShareScenario->nbUsers / TAIL_FRACTION) || flushJournal(journal);
+    destroyContract(checkpointScenario.contract);
+    closeJournal(journal);
+    if(failed) return 1;
+
+    restoreScenario.snapshotPath = snapshotPath;
+    if(!runBenchmark(config, "RESTORE", parameters, NULL, restoreContractBenchmark, destroyRestoredBenchmark,
+            &restoreScenario, &result)) {
+        printBenchmarkResult(config, &result);
+    }
+    return 0;
+}
+
+void distributeRevenueBenchmark(void* data) {
+    DistributionScenario* scenario = data;
+    addRevenue(scenario->contract, scenario->amount);
+}
+
+// As much revenue as there are users, so that every claim withdraws something
+void addClaimRevenueBenchmark(void* data) {
+    ChangeShareScenario* scenario = data;
+    addRevenue(scenario->contract, (double) scenario->nbUsers);
+}
+
+// Every user withdraws in turn, the pull path one transaction at a time
+void claimRevenueBenchmark(void* data) {
+    ChangeShareScenario* scenario = data;
+    for(long i = 0 ; i < scenario->nbUsers ; ++i) {
+        claimRevenue(scenario->contract, &scenario->addresses[i], NULL);
+    }
+}
+
+void settleAllBenchmark(void* data) {
+    DistributionScenario* scenario = data;
+    settleAll(scenario->contract);
+}
+
+int main(int argc, char** argv) {
+    BenchmarkConfig config = defaultBenchmarkConfig();
+    long nbUsers = benchmarkLongArgument(argc, argv, "--users", NB_USERS);
+    const char* directory = benchmarkStringArgument(argc, argv, "--journal", NULL);
+    long nbThreads = benchmarkLongArgument(argc, argv, "--threads", 1);
+    const char* accounting = benchmarkStringArgument(argc, argv, "--accounting", "double");
+    int exact = !strcmp(accounting, "exact");
+    static const char* const options[] = { "--users", "--journal", "--threads", "--accounting", NULL };
+    if(parseBenchmarkArguments(argc, argv, options, NULL, &config) || nbUsers < 1 || nbThreads < 1
+        || (!exact && strcmp(accounting, "double"))) {
+        fprintf(stderr, "Usage: %s [--users N] [--threads N] [--accounting double|exact] [--journal DIR] [--warmup N] "
+                "[--min-iterations N] [--max-iterations N] [--min-time S] [--counters] [--format text|csv|json]\n",
+                argv[0]);
+        return 1;
+    }
+
+    // Setup
+    ChangeShareScenario changeShareScenario = { NULL, exact ? ACCOUNTING_EXACT : ACCOUNTING_DOUBLE,
+        calloc(nbUsers, sizeof(Address)), calloc(nbUsers, sizeof(double)), nbUsers, NULL, NULL };
+    DistributionContract* contract = constructContract(changeShareScenario.accounting);
+    int failed = !contract || !changeShareScenario.addresses || !changeShareScenario.changes;
+    for(long i = 0 ; !failed && i < nbUsers ; ++i) {
+        changeShareScenario.addresses[i] = userAddress(i + 1);
+        changeShareScenario.changes[i] = i + 1;
+    }
+    if(failed || changeShareBatch(contract, changeShareScenario.addresses, changeShareScenario.changes, nbUsers)) {
+        destroyContract(contract);
+        free(changeShareScenario.addresses);
+        free(changeShareScenario.changes);
+        return 1;
+    }
+
+    // Result, as much revenue as there are users like before
+    DistributionScenario scenario = { contract, (double) nbUsers };
+    char parameters[96];
+    snprintf(parameters, sizeof(parameters), "users=%ld threads=%ld accounting=%s", nbUsers, nbThreads, accounting);
+    BenchmarkResult result;
+    printBenchmarkHeader(&config);
+    if(!runBenchmark(&config, "CHANGE_SHARE", parameters, constructContractBenchmark, changeShareBenchmark,
+            destroyContractBenchmark, &changeShareScenario, &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    if(!runBenchmark(&config, "CHANGE_SHARE_BATCH", parameters, constructContractBenchmark, changeShareBatchBenchmark,
+            destroyContractBenchmark, &changeShareScenario, &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    ThreadedChangeShareScenario threadedScenario = { changeShareScenario, (size_t) nbThreads };
+    if(!runBenchmark(&config, "CHANGE_SHARE_THREADS", parameters, constructContractBenchmark,
+            changeShareThreadsBenchmark, destroyContractBenchmark, &threadedScenario, &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    // The max is the worst single change, growth included
+    GrowScenario growScenario = { constructContract(changeShareScenario.accounting), 0 };
+    if(growScenario.contract && !runBenchmark(&config, "GROW", parameters, NULL, growBenchmark, NULL, &growScenario,
+            &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    destroyContract(growScenario.contract);
+    if(!runBenchmark(&config, "DISTRIBUTE", parameters, NULL, distributeRevenueBenchmark, NULL, &scenario, &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    // Revenue is added before every run so that there is something to settle
+    ChangeShareScenario claimScenario = changeShareScenario;
+    claimScenario.contract = contract;
+    if(!runBenchmark(&config, "CLAIM", parameters, addClaimRevenueBenchmark, claimRevenueBenchmark, NULL,
+            &claimScenario, &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    if(!runBenchmark(&config, "SETTLE_ALL", parameters, distributeRevenueBenchmark, settleAllBenchmark, NULL, &scenario,
+            &result)) {
+        printBenchmarkResult(&config, &result);
+    }
+    if(directory && persistenceBenchmarks(&config, parameters, &changeShareScenario, directory)) {
+        fprintf(stderr, "Could not write the journal or the snapshot in %s\n", directory);
+    }
+
+    // Cleanup
+    destroyContract(contract);
+    free(changeShareScenario.addresses);
+    free(changeShareScenario.changes);
+}
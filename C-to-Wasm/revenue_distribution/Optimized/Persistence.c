@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ShardedMap.h"
+#include "DistributionContract.h"
+#include "Persistence.h"
+
+#define SNAPSHOT_MAGIC "RDSNAPO5"
+
+// The snapshot starts with this header, every shard of the user map follows as a ShardHeader and its buckets
+typedef struct {
+    char magic[8];
+    uint64_t sequence;
+    uint64_t accounting;
+    double index;
+    double undistributed;
+    FixedPoint revenuePerStake;
+    uint64_t revenueRemainder;
+    uint64_t exactUndistributed;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t nbShards;
+    uint64_t bucketSize;
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t nbBuckets;
+    uint64_t count;
+    // ShardStake in both accountings
+    double stake;
+    uint64_t exactStake;
+} ShardHeader;
+
+// write() until everything is written
+static int writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = data;
+    while(size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return EXIT_FAILURE;
+        bytes += written;
+        size -= (size_t) written;
+    }
+    return EXIT_SUCCESS;
+}
+
+// pwrite() until everything is written at offset
+static int writeAllAt(int fd, const void* data, size_t size, uint64_t offset) {
+    const char* bytes = data;
+    while(size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, (off_t) offset);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return EXIT_FAILURE;
+        bytes += written;
+        size -= (size_t) written;
+        offset += (uint64_t) written;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Maps a whole file for reading, *data is NULL for a missing or empty file
+static int mapFile(const char* path, const void** data, size_t* size) {
+    *data = NULL;
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return errno == ENOENT ? EXIT_SUCCESS : EXIT_FAILURE;
+    struct stat status;
+    if(fstat(fd, &status)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if(status.st_size > 0) {
+        void* mapped = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        *data = mapped;
+        *size = (size_t) status.st_size;
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+ContractJournal* openJournal(const char* path, size_t groupSize) {
+    if(!path || groupSize == 0) return NULL;
+    ContractJournal* journal = calloc(1, sizeof(ContractJournal));
+    if(!journal) return NULL;
+    journal->groupSize = groupSize;
+    // pending and full share one allocation, closeJournal frees the lower one
+    journal->pending = calloc(2 * groupSize, sizeof(JournalRecord));
+    journal->fd = open(path, O_WRONLY | O_CREAT, 0644);
+    off_t size = journal->fd < 0 ? -1 : lseek(journal->fd, 0, SEEK_END);
+    journal->size = (uint64_t) size;
+    if(!journal->pending || size < 0) {
+        if(journal->fd >= 0) close(journal->fd);
+        free(journal->pending);
+        free(journal);
+        return NULL;
+    }
+    journal->full = journal->pending + groupSize;
+    atomic_init(&journal->nbFull, 0);
+    pthread_mutex_init(&journal->writeLock, NULL);
+    return journal;
+}
+
+// Writes and syncs records after the last group, journal->writeLock held
+static int writeGroup(ContractJournal* journal, const JournalRecord* records, size_t nbRecords) {
+    // Written over the torn bytes of an attempt that failed, which would otherwise end the replay
+    size_t bytes = nbRecords * sizeof(JournalRecord);
+    if(writeAllAt(journal->fd, records, bytes, journal->size) || fsync(journal->fd)) return EXIT_FAILURE;
+    journal->size += bytes;
+    return EXIT_SUCCESS;
+}
+
+// Writes the group set aside, if any, journal->writeLock held. Once it is written appendJournal may reuse its buffer
+static int writeFullGroup(ContractJournal* journal) {
+    size_t nbFull = atomic_load_explicit(&journal->nbFull, memory_order_acquire);
+    if(nbFull == 0) return EXIT_SUCCESS;
+    if(writeGroup(journal, journal->full, nbFull)) return EXIT_FAILURE;
+    atomic_store_explicit(&journal->nbFull, 0, memory_order_release);
+    return EXIT_SUCCESS;
+}
+
+int flushJournal(ContractJournal* journal) {
+    if(!journal) return EXIT_FAILURE;
+    pthread_mutex_lock(&journal->writeLock);
+    // The group set aside comes first, its records are older
+    int result = writeFullGroup(journal);
+    if(!result && journal->nbPending > 0) result = writeGroup(journal, journal->pending, journal->nbPending);
+    if(!result) journal->nbPending = 0;
+    pthread_mutex_unlock(&journal->writeLock);
+    return result;
+}
+
+int reserveJournal(ContractJournal* journal) {
+    if(!journal) return EXIT_FAILURE;
+    // Full when the last group was still set aside, waits for it to be written or writes it
+    return journal->nbPending == journal->groupSize ? flushJournal(journal) : EXIT_SUCCESS;
+}
+
+void appendJournal(ContractJournal* journal, uint64_t sequence, JournalOperation operation, const Address* address,
+    double amount) {
+    journal->pending[journal->nbPending++] = (JournalRecord){ sequence, amount, address ? *address : (Address){ { 0 } },
+        operation };
+    // Swapped with the buffer of the last group once written, the operations go on while the full one is written
+    if(journal->nbPending < journal->groupSize || atomic_load_explicit(&journal->nbFull, memory_order_acquire)) return;
+    JournalRecord* full = journal->pending;
+    journal->pending = journal->full;
+    journal->full = full;
+    journal->nbPending = 0;
+    atomic_store_explicit(&journal->nbFull, journal->groupSize, memory_order_release);
+}
+
+int commitJournal(ContractJournal* journal) {
+    if(!journal || atomic_load_explicit(&journal->nbFull, memory_order_acquire) == 0) return EXIT_SUCCESS;
+    if(pthread_mutex_trylock(&journal->writeLock)) return EXIT_SUCCESS;
+    int result = writeFullGroup(journal);
+    pthread_mutex_unlock(&journal->writeLock);
+    return result;
+}
+
+void closeJournal(ContractJournal* journal) {
+    if(!journal) return;
+    flushJournal(journal);
+    close(journal->fd);
+    pthread_mutex_destroy(&journal->writeLock);
+    free(journal->pending < journal->full ? journal->pending : journal->full);
+    free(journal);
+}
+
+// saveSnapshot with the contract already locked
+static int writeSnapshot(DistributionContract* contract, const char* path) {
+    ShardedMap* map = contract->userStateMap;
+    SnapshotHeader header = { .sequence = contract->sequence, .accounting = contract->accounting,
+        .index = contract->index, .revenuePerStake = contract->revenuePerStake,
+        .revenueRemainder = contract->revenueRemainder, .undistributed = contract->undistributed,
+        .exactUndistributed = contract->exactUndistributed, .seed0 = map->seed0, .seed1 = map->seed1,
+        .nbShards = map->nbShards, .bucketSize = map->bucketSize };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    // Written next to the snapshot and renamed over it, a crash leaves the previous snapshot whole
+    char* temporary = malloc(strlen(path) + sizeof(".tmp"));
+    if(!temporary) return EXIT_FAILURE;
+    sprintf(temporary, "%s.tmp", path);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int failed = fd < 0 || writeAll(fd, &header, sizeof(header));
+    for(size_t s = 0; !failed && s < map->nbShards; s++) {
+        size_t nbBuckets, count;
+        const void* buckets = shardedMapBuckets(map, s, &nbBuckets, &count);
+        ShardHeader shardHeader = { .nbBuckets = nbBuckets, .count = count, .stake = contract->shardStakes[s].stake,
+            .exactStake = contract->shardStakes[s].exactStake };
+        failed = writeAll(fd, &shardHeader, sizeof(shardHeader)) || writeAll(fd, buckets, nbBuckets * map->bucketSize);
+    }
+    if(!failed && fsync(fd)) failed = 1;
+    if(fd >= 0 && close(fd)) failed = 1;
+    if(!failed && rename(temporary, path)) failed = 1;
+    if(failed) unlink(temporary);
+    free(temporary);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int saveSnapshot(DistributionContract* contract, const char* path) {
+    if(!contract || !path) return EXIT_FAILURE;
+    lockContract(contract);
+    int result = writeSnapshot(contract, path);
+    unlockContract(contract);
+    return result;
+}
+
+int checkpointContract(DistributionContract* contract, const char* path) {
+    if(!contract || !path) return EXIT_FAILURE;
+    // No record may be appended between the snapshot and the truncation
+    lockContract(contract);
+    int result = writeSnapshot(contract, path);
+    if(!result && contract->journal) {
+        // Every record, pending and set aside ones included, is at most the sequence of the snapshot. A group
+        // being written is waited for, it would land after the truncation
+        ContractJournal* journal = contract->journal;
+        pthread_mutex_lock(&journal->writeLock);
+        journal->nbPending = 0;
+        atomic_store_explicit(&journal->nbFull, 0, memory_order_release);
+        result = ftruncate(journal->fd, 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+        if(!result) journal->size = 0;
+        pthread_mutex_unlock(&journal->writeLock);
+    }
+    unlockContract(contract);
+    return result;
+}
+
+// The buckets are copied from the mapping as they are, nothing is inserted again
+static int loadSnapshot(DistributionContract* contract, const char* path) {
+    const void* data;
+    size_t size;
+    if(mapFile(path, &data, &size)) return EXIT_FAILURE;
+    if(!data) return EXIT_SUCCESS;
+
+    ShardedMap* map = contract->userStateMap;
+    const SnapshotHeader* header = data;
+    int failed = size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))
+        || header->accounting != contract->accounting || header->nbShards != map->nbShards
+        || header->bucketSize != map->bucketSize;
+    size_t offset = sizeof(SnapshotHeader);
+    for(size_t s = 0; !failed && s < map->nbShards; s++) {
+        const ShardHeader* shardHeader = (const ShardHeader*) ((const char*) data + offset);
+        failed = size - offset < sizeof(ShardHeader)
+            || shardHeader->nbBuckets > (size - offset - sizeof(ShardHeader)) / map->bucketSize
+            || !shardedMapLoadBuckets(map, s, shardHeader + 1, shardHeader->nbBuckets, shardHeader->count,
+                header->seed0, header->seed1);
+        if(failed) break;
+        offset += sizeof(ShardHeader) + shardHeader->nbBuckets * map->bucketSize;
+        if(contract->accounting == ACCOUNTING_EXACT) contract->shardStakes[s].exactStake = shardHeader->exactStake;
+        else contract->shardStakes[s].stake = shardHeader->stake;
+    }
+    failed = failed || offset != size;
+    if(!failed) {
+        contract->sequence = header->sequence;
+        contract->index = header->index;
+        contract->revenuePerStake = header->revenuePerStake;
+        contract->revenueRemainder = header->revenueRemainder;
+        contract->undistributed = header->undistributed;
+        contract->exactUndistributed = header->exactUndistributed;
+    }
+    munmap((void*) data, size);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int replayJournal(DistributionContract* contract, const char* path) {
+    const void* data;
+    size_t size;
+    if(mapFile(path, &data, &size)) return EXIT_FAILURE;
+    if(!data) return EXIT_SUCCESS;
+
+    // A partial record at the end is ignored like any record out of sequence
+    const JournalRecord* records = data;
+    size_t nbRecords = size / sizeof(JournalRecord);
+    size_t nbValid = 0;
+    int failed = 0;
+    for(; !failed && nbValid < nbRecords; nbValid++) {
+        const JournalRecord* record = &records[nbValid];
+        // Already in the snapshot
+        if(record->sequence <= contract->sequence) continue;
+        if(record->sequence != contract->sequence + 1) break;
+        if(record->operation == JOURNAL_CHANGE_SHARE) failed = changeShare(contract, &record->address, record->amount);
+        else if(record->operation == JOURNAL_ADD_REVENUE) failed = addRevenue(contract, record->amount);
+        else if(record->operation == JOURNAL_CLAIM_REVENUE) failed = claimRevenue(contract, &record->address, NULL);
+        else if(record->operation == JOURNAL_SETTLE_ALL) failed = settleAll(contract);
+        else break;
+    }
+    munmap((void*) data, size);
+    // The torn end is cut off, the records appended from now on follow the replayed ones
+    if(!failed && nbValid * sizeof(JournalRecord) < size) failed = truncate(path, nbValid * sizeof(JournalRecord));
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+DistributionContract* restoreContract(AccountingMode accounting, const char* snapshotPath, const char* journalPath) {
+    DistributionContract* contract = constructContract(accounting);
+    if(!contract) return NULL;
+    if((snapshotPath && loadSnapshot(contract, snapshotPath)) || (journalPath && replayJournal(contract, journalPath))) {
+        destroyContract(contract);
+        return NULL;
+    }
+    return contract;
+}
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashmap.h"
+#include "ShardedMap.h"
+
+// Bits of the hashes stored by the hashmap, the shard is taken from the highest ones
+#define HASH_BITS 48
+#define MAX_SHARDS 65536
+
+// An empty table of the map, never shrunk since shrinking would rehash it at once
+static struct hashmap* newTable(const ShardedMap* map, size_t nbBuckets) {
+    return hashmap_new(map->elementSize, nbBuckets, map->seed0, map->seed1, map->hash, map->compare, NULL, NULL);
+}
+
+// Gives the buckets of the current table to shardedMapPrefetch
+// A prefetch between both stores only requests a useless line, it never faults
+static void publishBuckets(MapShard* shard) {
+    size_t nbBuckets, bucketSize;
+    uint64_t seed0, seed1;
+    const void* buckets = hashmap_buckets(shard->current, &nbBuckets, &bucketSize, &seed0, &seed1);
+    atomic_store_explicit(&shard->buckets, buckets, memory_order_relaxed);
+    atomic_store_explicit(&shard->mask, nbBuckets - 1, memory_order_relaxed);
+}
+
+// Moves the items of the next buckets of the previous table, which is freed once empty
+static void moveBuckets(MapShard* shard, size_t nbSteps) {
+    size_t nbBuckets, bucketSize;
+    uint64_t seed0, seed1;
+    if(shard->previous) hashmap_buckets(shard->previous, &nbBuckets, &bucketSize, &seed0, &seed1);
+    for(; shard->previous && nbSteps > 0; nbSteps--) {
+        void* item = hashmap_probe(shard->previous, shard->cursor);
+        if(item) {
+            // The delete shifts the next items back, the same bucket is looked at again
+            hashmap_set(shard->current, hashmap_delete(shard->previous, item));
+        } else if(++shard->cursor == nbBuckets) {
+            hashmap_free(shard->previous);
+            shard->previous = NULL;
+        }
+    }
+}
+
+// Replaces the full current table by one twice as large, its items are moved by the next changes
+static bool growShard(ShardedMap* map, MapShard* shard) {
+    moveBuckets(shard, SIZE_MAX);
+    size_t nbBuckets, bucketSize;
+    uint64_t seed0, seed1;
+    hashmap_buckets(shard->current, &nbBuckets, &bucketSize, &seed0, &seed1);
+    struct hashmap* table = newTable(map, 2 * nbBuckets);
+    if(!table) return false;
+    shard->previous = shard->current;
+    shard->current = table;
+    shard->cursor = 0;
+    publishBuckets(shard);
+    return true;
+}
+
+ShardedMap* constructShardedMap(size_t elementSize, size_t nbShards, uint64_t seed0, uint64_t seed1,
+    uint64_t (*hash)(const void* item, uint64_t seed0, uint64_t seed1),
+    int (*compare)(const void* a, const void* b, void* udata)) {
+    if(nbShards == 0 || nbShards > MAX_SHARDS || (nbShards & (nbShards - 1)) || !hash || !compare) return NULL;
+    ShardedMap* map = calloc(1, sizeof(ShardedMap));
+    if(!map) return NULL;
+    *map = (ShardedMap){ .nbShards = nbShards, .shardShift = HASH_BITS, .elementSize = elementSize, .seed0 = seed0,
+        .seed1 = seed1, .hash = hash, .compare = compare };
+    for(size_t n = nbShards; n > 1; n /= 2) map->shardShift--;
+    map->shards = aligned_alloc(_Alignof(MapShard), nbShards * sizeof(MapShard));
+    if(!map->shards) {
+        free(map);
+        return NULL;
+    }
+    memset(map->shards, 0, nbShards * sizeof(MapShard));
+    for(size_t s = 0; s < nbShards; s++) {
+        MapShard* shard = &map->shards[s];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->current = newTable(map, 0);
+        if(!shard->current) {
+            map->nbShards = s + 1;
+            destroyShardedMap(map);
+            return NULL;
+        }
+        publishBuckets(shard);
+    }
+    uint64_t unusedSeed0, unusedSeed1;
+    hashmap_buckets(map->shards[0].current, &(size_t){ 0 }, &map->bucketSize, &unusedSeed0, &unusedSeed1);
+    return map;
+}
+
+void destroyShardedMap(ShardedMap* map) {
+    if(!map) return;
+    for(size_t s = 0; s < map->nbShards; s++) {
+        hashmap_free(map->shards[s].current);
+        hashmap_free(map->shards[s].previous);
+        pthread_mutex_destroy(&map->shards[s].lock);
+    }
+    free(map->shards);
+    free(map);
+}
+
+uint64_t shardedMapHash(const ShardedMap* map, const void* key) {
+    // Like the hashmap, which keeps the low bits
+    return map->hash(key, map->seed0, map->seed1) << (64 - HASH_BITS) >> (64 - HASH_BITS);
+}
+
+void shardedMapPrefetch(ShardedMap* map, uint64_t hash) {
+#if defined(__GNUC__) || defined(__clang__)
+    MapShard* shard = &map->shards[hash >> map->shardShift];
+    const char* buckets = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+    size_t mask = atomic_load_explicit(&shard->mask, memory_order_relaxed);
+    __builtin_prefetch(buckets + (hash & mask) * map->bucketSize, 1);
+#else
+    (void) map;
+    (void) hash;
+#endif
+}
+
+MapShard* lockShard(ShardedMap* map, uint64_t hash) {
+    MapShard* shard = &map->shards[hash >> map->shardShift];
+    pthread_mutex_lock(&shard->lock);
+    return shard;
+}
+
+void unlockShard(MapShard* shard) {
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void lockAllShards(ShardedMap* map) {
+    for(size_t s = 0; s < map->nbShards; s++) {
+        pthread_mutex_lock(&map->shards[s].lock);
+    }
+}
+
+void unlockAllShards(ShardedMap* map) {
+    for(size_t s = map->nbShards; s > 0; s--) {
+        pthread_mutex_unlock(&map->shards[s - 1].lock);
+    }
+}
+
+void* shardUpsert(ShardedMap* map, MapShard* shard, const void* item, uint64_t hash, bool* inserted) {
+    if(hashmap_count(shard->current) >= hashmap_capacity(shard->current) && !growShard(map, shard)) return NULL;
+    if(shard->previous) {
+        moveBuckets(shard, SHARD_MOVE_STEP);
+        // Not moved yet, it is moved now so that it is returned from the current table
+        void* old = shard->previous ? hashmap_get(shard->previous, item) : NULL;
+        if(old) hashmap_set(shard->current, hashmap_delete(shard->previous, old));
+    }
+    return hashmap_upsert_with_hash(shard->current, item, hash, inserted);
+}
+
+void* shardGet(MapShard* shard, const void* key) {
+    void* item = hashmap_get(shard->current, key);
+    return item || !shard->previous ? item : hashmap_get(shard->previous, key);
+}
+
+void shardDelete(MapShard* shard, void* key) {
+    if(!hashmap_delete(shard->current, key) && shard->previous) hashmap_delete(shard->previous, key);
+}
+
+bool shardedMapReserve(ShardedMap* map, size_t count) {
+    // The hashes spread the items evenly, the slack covers the shards above the average
+    size_t perShard = count / map->nbShards;
+    perShard += perShard / 8 + 16;
+    bool reserved = true;
+    for(size_t s = 0; reserved && s < map->nbShards; s++) {
+        MapShard* shard = &map->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        moveBuckets(shard, SIZE_MAX);
+        reserved = hashmap_reserve(shard->current, hashmap_count(shard->current) + perShard);
+        publishBuckets(shard);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return reserved;
+}
+
+size_t shardedMapCount(ShardedMap* map) {
+    size_t count = 0;
+    for(size_t s = 0; s < map->nbShards; s++) {
+        count += hashmap_count(map->shards[s].current);
+        if(map->shards[s].previous) count += hashmap_count(map->shards[s].previous);
+    }
+    return count;
+}
+
+const void* shardedMapBuckets(ShardedMap* map, size_t index, size_t* nbBuckets, size_t* count) {
+    MapShard* shard = &map->shards[index];
+    moveBuckets(shard, SIZE_MAX);
+    size_t bucketSize;
+    uint64_t seed0, seed1;
+    *count = hashmap_count(shard->current);
+    return hashmap_buckets(shard->current, nbBuckets, &bucketSize, &seed0, &seed1);
+}
+
+bool shardedMapLoadBuckets(ShardedMap* map, size_t index, const void* buckets, size_t nbBuckets, size_t count,
+    uint64_t seed0, uint64_t seed1) {
+    MapShard* shard = &map->shards[index];
+    moveBuckets(shard, SIZE_MAX);
+    if(!hashmap_load_buckets(shard->current, buckets, nbBuckets, map->bucketSize, count, seed0, seed1)) return false;
+    // The loaded table does not shrink either
+    hashmap_reserve(shard->current, count);
+    map->seed0 = seed0;
+    map->seed1 = seed1;
+    publishBuckets(shard);
+    return true;
+}
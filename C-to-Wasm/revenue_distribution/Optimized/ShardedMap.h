@@ -0,0 +1,188 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hashmap.h"
+
+/*
+ * A hash map split in independent robin-hood tables. The shard of an item is picked by the high bits of its hash and
+ * its bucket in the shard by the low ones, every shard has its own lock so that threads changing different shards do
+ * not wait for each other. A full shard does not rehash at once: a table twice as large takes its place and the items
+ * of the old one are moved a few buckets at a time by the next changes of the shard, so that no single change pays
+ * for the whole growth.
+ */
+
+// Buckets of the old table moved by every change of a growing shard
+// At least 2, the old table is then empty before the new one is full
+#define SHARD_MOVE_STEP 4
+
+typedef struct {
+    // First, and alone on its cache line with the rest of the shard
+    _Alignas(64) pthread_mutex_t lock;
+    struct hashmap* current;
+    // NULL or the table moved into current, its buckets before the cursor are empty
+    struct hashmap* previous;
+    size_t cursor;
+    // Buckets of current for shardedMapPrefetch, which does not take the lock
+    _Atomic(const char*) buckets;
+    _Atomic size_t mask;
+} MapShard;
+
+typedef struct {
+    // A power of 2
+    size_t nbShards;
+    // Shifts a hash down to its shard
+    unsigned shardShift;
+    size_t elementSize;
+    size_t bucketSize;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t (*hash)(const void* item, uint64_t seed0, uint64_t seed1);
+    int (*compare)(const void* a, const void* b, void* udata);
+    MapShard* shards;
+} ShardedMap;
+
+/**
+ * @brief Constructs an empty map, the arguments are the ones of hashmap_new
+ *
+ * @param elementSize The size of an item
+ * @param nbShards A power of 2, at most 65536
+ * @param seed0
+ * @param seed1
+ * @param hash
+ * @param compare
+ * @return ShardedMap*, NULL on failure
+ */
+ShardedMap* constructShardedMap(size_t elementSize, size_t nbShards, uint64_t seed0, uint64_t seed1,
+    uint64_t (*hash)(const void* item, uint64_t seed0, uint64_t seed1),
+    int (*compare)(const void* a, const void* b, void* udata));
+
+/**
+ * @brief Destroys a map, no shard may be locked
+ *
+ * @param map The map to be destroyed
+ */
+void destroyShardedMap(ShardedMap* map);
+
+/**
+ * @brief Hash of a key, as stored in the buckets and as given to the other functions
+ *
+ * @param map The map
+ * @param key The key
+ * @return uint64_t
+ */
+uint64_t shardedMapHash(const ShardedMap* map, const void* key);
+
+/**
+ * @brief Asks for the bucket of a hash to be loaded in the cache, without locking its shard
+ *
+ * @param map The map
+ * @param hash The hash of a key
+ */
+void shardedMapPrefetch(ShardedMap* map, uint64_t hash);
+
+/**
+ * @brief Locks and returns the shard of a hash, the shard functions below need it locked
+ *
+ * @param map The map
+ * @param hash The hash of a key
+ * @return MapShard*
+ */
+MapShard* lockShard(ShardedMap* map, uint64_t hash);
+
+/**
+ * @brief Unlocks a shard locked by lockShard
+ *
+ * @param shard The shard
+ */
+void unlockShard(MapShard* shard);
+
+/**
+ * @brief Locks every shard, in order
+ *
+ * @param map The map
+ */
+void lockAllShards(ShardedMap* map);
+
+/**
+ * @brief Unlocks every shard locked by lockAllShards
+ *
+ * @param map The map
+ */
+void unlockAllShards(ShardedMap* map);
+
+/**
+ * @brief hashmap_upsert_with_hash in a locked shard, a growing shard moves some of its items first
+ *
+ * @param map The map
+ * @param shard The locked shard of the hash
+ * @param item The item inserted when its key is missing
+ * @param hash The hash of the item
+ * @param inserted Tells whether the item was inserted
+ * @return void* The item in the shard, valid until the shard is unlocked, NULL on failure
+ */
+void* shardUpsert(ShardedMap* map, MapShard* shard, const void* item, uint64_t hash, bool* inserted);
+
+/**
+ * @brief hashmap_get in a locked shard
+ *
+ * @param shard The locked shard of the key
+ * @param key The key
+ * @return void* The item in the shard, valid until the shard is unlocked, NULL when missing
+ */
+void* shardGet(MapShard* shard, const void* key);
+
+/**
+ * @brief hashmap_delete in a locked shard
+ *
+ * @param shard The locked shard of the key
+ * @param key The key
+ */
+void shardDelete(MapShard* shard, void* key);
+
+/**
+ * @brief Grows every shard once so that count more items, spread over the shards by their hash, fit without growing
+ *
+ * @param map The map
+ * @param count The items to come
+ * @return bool false if the buckets could not be allocated
+ */
+bool shardedMapReserve(ShardedMap* map, size_t count);
+
+/**
+ * @brief Number of items, every shard locked or no other thread using the map
+ *
+ * @param map The map
+ * @return size_t
+ */
+size_t shardedMapCount(ShardedMap* map);
+
+/**
+ * @brief Ends the growth of a locked shard and returns its buckets, like hashmap_buckets
+ *
+ * @param map The map
+ * @param index The index of the shard
+ * @param nbBuckets Receives the number of buckets
+ * @param count Receives the number of items
+ * @return const void* The buckets
+ */
+const void* shardedMapBuckets(ShardedMap* map, size_t index, size_t* nbBuckets, size_t* count);
+
+/**
+ * @brief Replaces the items of a locked shard with a copy of buckets given by shardedMapBuckets, like
+ * hashmap_load_buckets, the seeds of the whole map are replaced
+ *
+ * @param map The map
+ * @param index The index of the shard
+ * @param buckets The buckets
+ * @param nbBuckets The number of buckets
+ * @param count The number of items
+ * @param seed0
+ * @param seed1
+ * @return bool false, the shard being left as it was, if the buckets do not fit or could not be allocated
+ */
+bool shardedMapLoadBuckets(ShardedMap* map, size_t index, const void* buckets, size_t nbBuckets, size_t count,
+    uint64_t seed0, uint64_t seed1);
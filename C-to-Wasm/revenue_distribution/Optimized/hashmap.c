@@ -314,6 +314,149 @@ void *hashmap_get(struct hashmap *map, const void *key) {
 	}
 }
 
+// hashmap_hash returns the hash of `key` as stored in the buckets, to be
+// given to hashmap_prefetch and hashmap_upsert_with_hash.
+uint64_t hashmap_hash(struct hashmap *map, const void *key) {
+    if (!key) {
+        panic("key is null");
+    }
+    return get_hash(map, key);
+}
+
+// hashmap_prefetch asks for the first bucket of `hash` to be loaded in the
+// cache, so that a later probe of a batch does not stall on memory.
+void hashmap_prefetch(struct hashmap *map, uint64_t hash) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(bucket_at(map, hash & map->mask), 1);
+#else
+    (void)map;
+    (void)hash;
+#endif
+}
+
+// hashmap_reserve grows the hash map so that it holds `count` items without
+// resizing, and does not shrink below that afterwards. Returns false if the
+// system is unable to allocate the buckets.
+bool hashmap_reserve(struct hashmap *map, size_t count) {
+    size_t nbuckets = map->nbuckets;
+    while (count > (size_t)(nbuckets*0.75)) {
+        nbuckets *= 2;
+    }
+    if (nbuckets > map->nbuckets && !resize(map, nbuckets)) {
+        return false;
+    }
+    if (map->cap < map->nbuckets) {
+        map->cap = map->nbuckets;
+    }
+    return true;
+}
+
+// hashmap_upsert_with_hash returns the item matching `item` in place, or
+// inserts a copy of `item` and returns where it lies, with a single probe.
+// Param `hash` must come from hashmap_hash() and `inserted` tells which case
+// happened. The returned pointer is valid until the next change of the map.
+// If the system is unable to allocate additional memory then NULL is returned
+// and hashmap_oom() returns true.
+void *hashmap_upsert_with_hash(struct hashmap *map, const void *item,
+                               uint64_t hash, bool *inserted)
+{
+    if (!item || !inserted) {
+        panic("item is null");
+    }
+    map->oom = false;
+    if (map->count == map->growat) {
+        if (!resize(map, map->nbuckets*2)) {
+            map->oom = true;
+            return NULL;
+        }
+    }
+
+    // Robin hood order: the item would be before any bucket poorer than it
+    size_t i = hash & map->mask;
+    size_t dib = 1;
+    for (;;) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib < dib) {
+            break;
+        }
+        if (bucket->hash == hash && 
+            map->compare(item, bucket_item(bucket), map->udata) == 0)
+        {
+            *inserted = false;
+            return bucket_item(bucket);
+        }
+        i = (i + 1) & map->mask;
+        dib++;
+    }
+
+    // The item takes this bucket, the richer ones after it are shifted
+    struct bucket *target = bucket_at(map, i);
+    struct bucket *entry = map->edata;
+    entry->hash = hash;
+    entry->dib = dib;
+    memcpy(bucket_item(entry), item, map->elsize);
+    for (;;) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib == 0) {
+            memcpy(bucket, entry, map->bucketsz);
+            break;
+        }
+        memcpy(map->spare, bucket, map->bucketsz);
+        memcpy(bucket, entry, map->bucketsz);
+        memcpy(entry, map->spare, map->bucketsz);
+        i = (i + 1) & map->mask;
+        entry->dib += 1;
+    }
+    map->count++;
+    *inserted = true;
+    return bucket_item(target);
+}
+
+// hashmap_buckets returns the bucket array of the hash map, its number of
+// buckets, the size of one bucket and the seeds, e.g. to save it as it is
+// and read it back with hashmap_load_buckets.
+const void *hashmap_buckets(struct hashmap *map, size_t *nbuckets,
+                            size_t *bucketsz, uint64_t *seed0, uint64_t *seed1)
+{
+    *nbuckets = map->nbuckets;
+    *bucketsz = map->bucketsz;
+    *seed0 = map->seed0;
+    *seed1 = map->seed1;
+    return map->buckets;
+}
+
+// hashmap_load_buckets replaces the items of the hash map with a copy of
+// `buckets`, as returned by hashmap_buckets() for a map of the same `elsize`
+// and hash function. The seeds are taken too and nothing is rehashed. Returns
+// false, leaving the map as it was, if the layout does not match or if the
+// system is unable to allocate the buckets.
+bool hashmap_load_buckets(struct hashmap *map, const void *buckets,
+                          size_t nbuckets, size_t bucketsz, size_t count,
+                          uint64_t seed0, uint64_t seed1)
+{
+    if (!buckets || bucketsz != map->bucketsz || nbuckets < 16 || 
+        (nbuckets & (nbuckets-1)) || count > (size_t)(nbuckets*0.75))
+    {
+        return false;
+    }
+    void *copy = map->malloc(map->bucketsz*nbuckets);
+    if (!copy) {
+        return false;
+    }
+    memcpy(copy, buckets, map->bucketsz*nbuckets);
+    free_elements(map);
+    map->free(map->buckets);
+    map->buckets = copy;
+    map->nbuckets = nbuckets;
+    map->mask = map->nbuckets-1;
+    map->growat = map->nbuckets*0.75;
+    map->shrinkat = map->nbuckets*0.10;
+    map->count = count;
+    map->seed0 = seed0;
+    map->seed1 = seed1;
+    return true;
+}
+
 // hashmap_probe returns the item in the bucket at position or NULL if an item
 // is not set for that bucket. The position is 'moduloed' by the number of 
 // buckets in the hashmap.
@@ -375,6 +518,12 @@ size_t hashmap_count(struct hashmap *map) {
     return map->count;
 }
 
+// hashmap_capacity returns the number of items the hash map holds before the
+// next insertion resizes it.
+size_t hashmap_capacity(struct hashmap *map) {
+    return map->growat;
+}
+
 // hashmap_free frees the hash map
 // Every item is called with the element-freeing function given in hashmap_new,
 // if present, to free any data referenced in the elements of the hashmap.
@@ -443,6 +592,329 @@ bool hashmap_iter(struct hashmap *map, size_t *i, void **item)
     return true;
 }
 
+//-----------------------------------------------------------------------------
+// swissmap is an open addressed hash map laid out like a SwissTable. The
+// slots are split in groups of 16 and every slot has a control byte in a
+// separate array: empty, deleted, or the 7 low bits of the hash of its item.
+// A probe loads the 16 control bytes of a group at once (SSE2 or wasm simd128)
+// and `compare` is only called for the slots whose byte matches, the items
+// are stored inline without any header.
+//-----------------------------------------------------------------------------
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#define SWISS_GROUP 16
+#define SWISS_EMPTY ((int8_t)-128)
+#define SWISS_DELETED ((int8_t)-2)
+
+struct swissmap {
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+    bool oom;
+    size_t elsize;
+    size_t cap;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1);
+    int (*compare)(const void *a, const void *b, void *udata);
+    void (*elfree)(void *item);
+    void *udata;
+    size_t nslots;
+    size_t count;
+    // insertions in empty slots before the next resize, deleted slots are
+    // reused without counting
+    size_t growth_left;
+    int8_t *ctrl;
+    char *slots;
+    void *spare;
+};
+
+// bit i is set when the control byte i of the group equals `tag`
+static uint32_t group_match(const int8_t *ctrl, int8_t tag) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, 
+                                                      _mm_set1_epi8(tag)));
+#elif defined(__wasm_simd128__)
+    v128_t group = wasm_v128_load(ctrl);
+    return (uint32_t)wasm_i8x16_bitmask(wasm_i8x16_eq(group, 
+                                                   wasm_i8x16_splat(tag)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+// bit i is set when the slot i of the group is empty or deleted, the only
+// control bytes with their high bit set
+static uint32_t group_match_free(const int8_t *ctrl) {
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#elif defined(__wasm_simd128__)
+    return (uint32_t)wasm_i8x16_bitmask(wasm_v128_load(ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+static size_t lowest_bit(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static void *swiss_slot(struct swissmap *map, size_t index) {
+    return map->slots+map->elsize*index;
+}
+
+// 7/8 of the slots may be used, some groups always keep an empty slot to
+// end the probes
+static size_t swiss_growat(size_t nslots) {
+    return nslots-nslots/8;
+}
+
+// The low 7 bits of the hash are the tag, the first group is picked by the
+// bits above them and the next ones by triangular steps, which visit every
+// group of a power of 2 count.
+static size_t swiss_find(struct swissmap *map, const void *key, uint64_t hash)
+{
+    int8_t tag = (int8_t)(hash & 0x7F);
+    size_t gmask = map->nslots/SWISS_GROUP-1;
+    size_t g = (hash >> 7) & gmask;
+    for (size_t step = 1;; step++) {
+        const int8_t *ctrl = map->ctrl+g*SWISS_GROUP;
+#if defined(__GNUC__) || defined(__clang__)
+        // The slots of the group are fetched while its control bytes are
+        // compared, instead of after
+        __builtin_prefetch(swiss_slot(map, g*SWISS_GROUP));
+#endif
+        for (uint32_t mask = group_match(ctrl, tag); mask; mask &= mask-1) {
+            size_t i = g*SWISS_GROUP+lowest_bit(mask);
+            if (map->compare(key, swiss_slot(map, i), map->udata) == 0) {
+                return i;
+            }
+        }
+        if (group_match(ctrl, SWISS_EMPTY)) {
+            return SIZE_MAX;
+        }
+        g = (g + step) & gmask;
+    }
+}
+
+// The first empty or deleted slot on the probe sequence of `hash`
+static size_t swiss_find_free(struct swissmap *map, uint64_t hash) {
+    size_t gmask = map->nslots/SWISS_GROUP-1;
+    size_t g = (hash >> 7) & gmask;
+    for (size_t step = 1;; step++) {
+        uint32_t mask = group_match_free(map->ctrl+g*SWISS_GROUP);
+        if (mask) {
+            return g*SWISS_GROUP+lowest_bit(mask);
+        }
+        g = (g + step) & gmask;
+    }
+}
+
+// Allocates the control bytes and the slots together, all slots empty
+static bool swiss_alloc(struct swissmap *map, size_t nslots) {
+    int8_t *ctrl = map->malloc(nslots+map->elsize*nslots);
+    if (!ctrl) {
+        return false;
+    }
+    memset(ctrl, SWISS_EMPTY, nslots);
+    map->ctrl = ctrl;
+    map->slots = (char*)ctrl+nslots;
+    map->nslots = nslots;
+    map->growth_left = swiss_growat(nslots)-map->count;
+    return true;
+}
+
+// Rehashes every item in `nslots` slots, the deleted slots are dropped
+static bool swiss_resize(struct swissmap *map, size_t nslots) {
+    int8_t *old_ctrl = map->ctrl;
+    char *old_slots = map->slots;
+    size_t old_nslots = map->nslots;
+    if (!swiss_alloc(map, nslots)) {
+        return false;
+    }
+    for (size_t i = 0; i < old_nslots; i++) {
+        if (old_ctrl[i] < 0) {
+            continue;
+        }
+        void *item = old_slots+map->elsize*i;
+        uint64_t hash = map->hash(item, map->seed0, map->seed1);
+        size_t j = swiss_find_free(map, hash);
+        map->ctrl[j] = (int8_t)(hash & 0x7F);
+        memcpy(swiss_slot(map, j), item, map->elsize);
+    }
+    map->free(old_ctrl);
+    return true;
+}
+
+// swissmap_new returns a new swiss map, the parameters are the ones of
+// hashmap_new. The map must be freed with swissmap_free().
+struct swissmap *swissmap_new(size_t elsize, size_t cap, 
+                              uint64_t seed0, uint64_t seed1,
+                              uint64_t (*hash)(const void *item, 
+                                               uint64_t seed0, uint64_t seed1),
+                              int (*compare)(const void *a, const void *b, 
+                                             void *udata),
+                              void (*elfree)(void *item),
+                              void *udata)
+{
+    void *(*malloc_fn)(size_t) = _malloc ? _malloc : malloc;
+    void (*free_fn)(void *) = _free ? _free : free;
+    size_t nslots = SWISS_GROUP;
+    while (swiss_growat(nslots) < cap) {
+        nslots *= 2;
+    }
+    // swissmap + spare
+    struct swissmap *map = malloc_fn(sizeof(struct swissmap)+elsize);
+    if (!map) {
+        return NULL;
+    }
+    memset(map, 0, sizeof(struct swissmap));
+    map->malloc = malloc_fn;
+    map->free = free_fn;
+    map->elsize = elsize;
+    map->cap = nslots;
+    map->seed0 = seed0;
+    map->seed1 = seed1;
+    map->hash = hash;
+    map->compare = compare;
+    map->elfree = elfree;
+    map->udata = udata;
+    map->spare = (char*)map+sizeof(struct swissmap);
+    if (!swiss_alloc(map, nslots)) {
+        free_fn(map);
+        return NULL;
+    }
+    return map;
+}
+
+// swissmap_free frees the swiss map, calling `elfree` on every item
+void swissmap_free(struct swissmap *map) {
+    if (!map) return;
+    if (map->elfree) {
+        for (size_t i = 0; i < map->nslots; i++) {
+            if (map->ctrl[i] >= 0) map->elfree(swiss_slot(map, i));
+        }
+    }
+    map->free(map->ctrl);
+    map->free(map);
+}
+
+// swissmap_count returns the number of items in the swiss map.
+size_t swissmap_count(struct swissmap *map) {
+    return map->count;
+}
+
+// swissmap_oom returns true if the last swissmap_set() call failed due to the
+// system being out of memory.
+bool swissmap_oom(struct swissmap *map) {
+    return map->oom;
+}
+
+// swissmap_get returns the item based on the provided key. If the item is not
+// found then NULL is returned.
+void *swissmap_get(struct swissmap *map, const void *key) {
+    if (!key) {
+        panic("key is null");
+    }
+    size_t i = swiss_find(map, key, map->hash(key, map->seed0, map->seed1));
+    return i == SIZE_MAX ? NULL : swiss_slot(map, i);
+}
+
+// swissmap_set inserts or replaces an item in the swiss map, like
+// hashmap_set.
+void *swissmap_set(struct swissmap *map, const void *item) {
+    if (!item) {
+        panic("item is null");
+    }
+    map->oom = false;
+    uint64_t hash = map->hash(item, map->seed0, map->seed1);
+    size_t i = swiss_find(map, item, hash);
+    if (i != SIZE_MAX) {
+        memcpy(map->spare, swiss_slot(map, i), map->elsize);
+        memcpy(swiss_slot(map, i), item, map->elsize);
+        return map->spare;
+    }
+    i = swiss_find_free(map, hash);
+    if (map->ctrl[i] == SWISS_EMPTY && map->growth_left == 0) {
+        // Doubled when more than half full, else only cleared of the deleted
+        // slots
+        size_t nslots = map->count*2 >= swiss_growat(map->nslots) ? 
+                        map->nslots*2 : map->nslots;
+        if (!swiss_resize(map, nslots)) {
+            map->oom = true;
+            return NULL;
+        }
+        i = swiss_find_free(map, hash);
+    }
+    if (map->ctrl[i] == SWISS_EMPTY) {
+        map->growth_left--;
+    }
+    map->ctrl[i] = (int8_t)(hash & 0x7F);
+    memcpy(swiss_slot(map, i), item, map->elsize);
+    map->count++;
+    return NULL;
+}
+
+// swissmap_delete removes an item from the swiss map and returns it. If the
+// item is not found then NULL is returned.
+void *swissmap_delete(struct swissmap *map, const void *key) {
+    if (!key) {
+        panic("key is null");
+    }
+    size_t i = swiss_find(map, key, map->hash(key, map->seed0, map->seed1));
+    if (i == SIZE_MAX) {
+        return NULL;
+    }
+    memcpy(map->spare, swiss_slot(map, i), map->elsize);
+    // A group with an empty slot has never been full, so no probe goes
+    // through it and the slot can be empty again. The slots of the other
+    // groups stay deleted to keep the probes going.
+    const int8_t *group = map->ctrl+i/SWISS_GROUP*SWISS_GROUP;
+    if (group_match(group, SWISS_EMPTY)) {
+        map->ctrl[i] = SWISS_EMPTY;
+        map->growth_left++;
+    } else {
+        map->ctrl[i] = SWISS_DELETED;
+    }
+    map->count--;
+    return map->spare;
+}
+
+// swissmap_iter iterates like hashmap_iter, the iterator stays valid across
+// swissmap_delete() calls since no item is moved.
+bool swissmap_iter(struct swissmap *map, size_t *i, void **item) {
+    while (*i < map->nslots) {
+        size_t j = (*i)++;
+        if (map->ctrl[j] >= 0) {
+            *item = swiss_slot(map, j);
+            return true;
+        }
+    }
+    return false;
+}
+
 
 //-----------------------------------------------------------------------------
 // SipHash reference C implementation
@@ -832,6 +1304,121 @@ static void all() {
 
     hashmap_free(map);
 
+    // test hashmap_reserve and hashmap_upsert_with_hash
+    while (!(map = hashmap_new(sizeof(int), 0, seed, seed, 
+                               hash_int, compare_ints_udata, NULL, NULL))) {}
+    while (!hashmap_reserve(map, N)) {}
+    size_t reserved = map->nbuckets;
+    assert(hashmap_capacity(map) >= N);
+    shuffle(vals, N, sizeof(int));
+    for (int i = 0; i < N; i++) {
+        bool inserted;
+        int *v = hashmap_upsert_with_hash(map, &vals[i], 
+                                          hashmap_hash(map, &vals[i]), &inserted);
+        assert(v && inserted && *v == vals[i]);
+        v = hashmap_upsert_with_hash(map, &vals[i], 
+                                     hashmap_hash(map, &vals[i]), &inserted);
+        assert(v && !inserted && *v == vals[i]);
+        assert(map->count == i+1);
+        assert(map->count == deepcount(map));
+    }
+    assert(map->nbuckets == reserved);
+    for (int i = 0; i < N; i++) {
+        int *v = hashmap_get(map, &vals[i]);
+        assert(v && *v == vals[i]);
+    }
+
+    // test hashmap_buckets and hashmap_load_buckets
+    struct hashmap *copy;
+    while (!(copy = hashmap_new(sizeof(int), 0, seed+1, seed+1, 
+                                hash_int, compare_ints_udata, NULL, NULL))) {}
+    size_t nbuckets, bucketsz;
+    uint64_t seed0, seed1;
+    const void *buckets = hashmap_buckets(map, &nbuckets, &bucketsz, &seed0, 
+                                          &seed1);
+    assert(!hashmap_load_buckets(copy, buckets, nbuckets, bucketsz+1, 
+                                 map->count, seed0, seed1));
+    while (!hashmap_load_buckets(copy, buckets, nbuckets, bucketsz, 
+                                 map->count, seed0, seed1)) {}
+    assert(copy->count == map->count);
+    assert(copy->count == deepcount(copy));
+    for (int i = 0; i < N; i++) {
+        int *v = hashmap_get(copy, &vals[i]);
+        assert(v && *v == vals[i]);
+    }
+    hashmap_free(copy);
+
+    hashmap_free(map);
+
+    // test swissmap, every other item is deleted and set again so that
+    // deleted slots are reused and cleared by the resizes
+    struct swissmap *swiss;
+    while (!(swiss = swissmap_new(sizeof(int), 0, seed, seed, 
+                                  hash_int, compare_ints_udata, NULL, NULL))) {}
+    shuffle(vals, N, sizeof(int));
+    for (int i = 0; i < N; i++) {
+        int *v;
+        assert(!swissmap_get(swiss, &vals[i]));
+        assert(!swissmap_delete(swiss, &vals[i]));
+        while (true) {
+            assert(!swissmap_set(swiss, &vals[i]));
+            if (!swissmap_oom(swiss)) {
+                break;
+            }
+        }
+        v = swissmap_set(swiss, &vals[i]);
+        assert(v && *v == vals[i]);
+        if (i % 2) {
+            v = swissmap_delete(swiss, &vals[i]);
+            assert(v && *v == vals[i]);
+            assert(!swissmap_get(swiss, &vals[i]));
+            while (true) {
+                assert(!swissmap_set(swiss, &vals[i]));
+                if (!swissmap_oom(swiss)) {
+                    break;
+                }
+            }
+        }
+        assert(swissmap_count(swiss) == i+1);
+        for (int j = 0; j <= i; j++) {
+            v = swissmap_get(swiss, &vals[j]);
+            assert(v && *v == vals[j]);
+        }
+    }
+
+    while (!(vals2 = xmalloc(N * sizeof(int)))) {}
+    memset(vals2, 0, N * sizeof(int));
+    iter = 0;
+    while (swissmap_iter(swiss, &iter, &iter_val)) {
+        assert(iter_ints(iter_val, &vals2));
+    }
+    for (int i = 0; i < N; i++) {
+        assert(vals2[i] == 1);
+    }
+    xfree(vals2);
+
+    shuffle(vals, N, sizeof(int));
+    for (int i = 0; i < N; i++) {
+        int *v = swissmap_delete(swiss, &vals[i]);
+        assert(v && *v == vals[i]);
+        assert(!swissmap_get(swiss, &vals[i]));
+        assert(swissmap_count(swiss) == N-i-1);
+        for (int j = N-1; j > i; j--) {
+            v = swissmap_get(swiss, &vals[j]);
+            assert(v && *v == vals[j]);
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        while (true) {
+            assert(!swissmap_set(swiss, &vals[i]));
+            if (!swissmap_oom(swiss)) {
+                break;
+            }
+        }
+    }
+    assert(swissmap_count(swiss) == N);
+    swissmap_free(swiss);
+
     xfree(vals);
 
 
@@ -950,6 +1537,46 @@ static void benchmarks() {
 
     hashmap_free(map);
 
+    // the same with the swiss map layout
+    struct swissmap *swiss;
+    shuffle(vals, N, sizeof(int));
+
+    swiss = swissmap_new(sizeof(int), 0, seed, seed, hash_int, 
+                         compare_ints_udata, NULL, NULL);
+    bench("swiss set", N, {
+        int *v = swissmap_set(swiss, &vals[i]);
+        assert(!v);
+    })
+    shuffle(vals, N, sizeof(int));
+    bench("swiss get", N, {
+        int *v = swissmap_get(swiss, &vals[i]);
+        assert(v && *v == vals[i]);
+    })
+    shuffle(vals, N, sizeof(int));
+    bench("swiss delete", N, {
+        int *v = swissmap_delete(swiss, &vals[i]);
+        assert(v && *v == vals[i]);
+    })
+    swissmap_free(swiss);
+
+    swiss = swissmap_new(sizeof(int), N, seed, seed, hash_int, 
+                         compare_ints_udata, NULL, NULL);
+    bench("swiss set (cap)", N, {
+        int *v = swissmap_set(swiss, &vals[i]);
+        assert(!v);
+    })
+    shuffle(vals, N, sizeof(int));
+    bench("swiss get (cap)", N, {
+        int *v = swissmap_get(swiss, &vals[i]);
+        assert(v && *v == vals[i]);
+    })
+    shuffle(vals, N, sizeof(int));
+    bench("swiss delete (cap)", N, {
+        int *v = swissmap_delete(swiss, &vals[i]);
+        assert(v && *v == vals[i]);
+    })
+    swissmap_free(swiss);
+
     
     xfree(vals);
 
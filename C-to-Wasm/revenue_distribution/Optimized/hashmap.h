@@ -34,15 +34,46 @@ struct hashmap *hashmap_new_with_allocator(
 void hashmap_free(struct hashmap *map);
 void hashmap_clear(struct hashmap *map, bool update_cap);
 size_t hashmap_count(struct hashmap *map);
+size_t hashmap_capacity(struct hashmap *map);
 bool hashmap_oom(struct hashmap *map);
 void *hashmap_get(struct hashmap *map, const void *item);
 void *hashmap_set(struct hashmap *map, const void *item);
 void *hashmap_delete(struct hashmap *map, void *item);
 void *hashmap_probe(struct hashmap *map, uint64_t position);
+uint64_t hashmap_hash(struct hashmap *map, const void *key);
+void hashmap_prefetch(struct hashmap *map, uint64_t hash);
+bool hashmap_reserve(struct hashmap *map, size_t count);
+void *hashmap_upsert_with_hash(struct hashmap *map, const void *item,
+                               uint64_t hash, bool *inserted);
+const void *hashmap_buckets(struct hashmap *map, size_t *nbuckets,
+                            size_t *bucketsz, uint64_t *seed0, uint64_t *seed1);
+bool hashmap_load_buckets(struct hashmap *map, const void *buckets,
+                          size_t nbuckets, size_t bucketsz, size_t count,
+                          uint64_t seed0, uint64_t seed1);
 bool hashmap_scan(struct hashmap *map,
                   bool (*iter)(const void *item, void *udata), void *udata);
 bool hashmap_iter(struct hashmap *map, size_t *i, void **item);
 
+// SwissTable-style layout with the same API, only measured by the benchmarks
+// of hashmap.c: ShardedMap and the snapshots rely on the robin-hood buckets
+struct swissmap;
+
+struct swissmap *swissmap_new(size_t elsize, size_t cap, 
+                              uint64_t seed0, uint64_t seed1,
+                              uint64_t (*hash)(const void *item, 
+                                               uint64_t seed0, uint64_t seed1),
+                              int (*compare)(const void *a, const void *b, 
+                                             void *udata),
+                              void (*elfree)(void *item),
+                              void *udata);
+void swissmap_free(struct swissmap *map);
+size_t swissmap_count(struct swissmap *map);
+bool swissmap_oom(struct swissmap *map);
+void *swissmap_get(struct swissmap *map, const void *key);
+void *swissmap_set(struct swissmap *map, const void *item);
+void *swissmap_delete(struct swissmap *map, const void *key);
+bool swissmap_iter(struct swissmap *map, size_t *i, void **item);
+
 uint64_t hashmap_sip(const void *data, size_t len, 
                      uint64_t seed0, uint64_t seed1);
 uint64_t hashmap_murmur(const void *data, size_t len, 
@@ -0,0 +1,24 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "Sharding.h"
+
+size_t runSharded(size_t nbShards, void* (*run)(void*), void* shards, size_t shardSize) {
+    char* first = shards;
+    pthread_t* threads = nbShards > 1 ? malloc((nbShards - 1) * sizeof(pthread_t)) : NULL;
+
+    size_t nbCreated = 0;
+    while(threads && nbCreated + 1 < nbShards
+        && !pthread_create(&threads[nbCreated], NULL, run, first + (nbCreated + 1) * shardSize)) {
+        nbCreated++;
+    }
+    run(first);
+    for(size_t t = nbCreated + 1; t < nbShards; t++) {
+        run(first + t * shardSize);
+    }
+    for(size_t t = 0; t < nbCreated; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(threads);
+    return nbCreated;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Fork-join over contiguous shards, shared by the neural network and the revenue distribution. The calling thread
+ * takes the first shard and one thread is created for each of the others. When threads cannot be created (out of
+ * resources, or a WebAssembly build without -pthread), the calling thread runs the shards left without a thread
+ * itself afterwards: every shard runs exactly once whatever the number of threads obtained, down to the calling one
+ * alone.
+ */
+
+/**
+ * @brief Runs run(&shards[t]) for every shard t and returns once all of them are done
+ *
+ * @param nbShards At least 1
+ * @param run
+ * @param shards Array of nbShards elements of shardSize bytes
+ * @param shardSize
+ *
+ * @return Number of threads created besides the calling one
+ */
+size_t runSharded(size_t nbShards, void* (*run)(void*), void* shards, size_t shardSize);